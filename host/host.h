@@ -0,0 +1,101 @@
+// host.h - headless engine stand-in for running the renderer off-game
+#ifndef HOST_H
+#define HOST_H
+
+// engine globals the renderer's platform layer expects, defined in host_engine.cpp
+extern "C"
+{
+extern Render::Vector3 r_origin, vpn, vright, vup;
+extern cl_entity_t *currententity;
+extern Render::Lightstyle cl_lightstyle[MAX_LIGHTSTYLES];
+}
+
+namespace Render
+{
+
+// the host plays the engine's part so these mirror what the engine keeps around
+constexpr int HostMaxModels = 512;
+constexpr int HostMaxEntities = 1024; // must not exceed MaxClientEntities in studio_misc.cpp
+
+struct HostOptions
+{
+    const char *gameDir{ "cstrike" };
+    const char *baseDir{ "." };
+    const char *mapName{ nullptr };
+    const char *replayPath{ nullptr };
+    int replayLoops{ 1 };
+    const char *propModel{ nullptr };
+    int propCount{ 0 };
+    int width{ 1280 };
+    int height{ 720 };
+    int frames{ 500 };
+    int warmupFrames{ 10 };
+    float fov{ 90 };
+    float loadBudget{ -1 }; // gl3_load_budget, negative keeps the default
+};
+
+struct HostClientState
+{
+    // must match the layout internalUpdateViewmodelAnimation expects
+    cl_entity_t viewent;
+    int cdtrack;
+    int looptrack;
+    CRC32_t serverCRC;
+    unsigned char clientdllmd5[16];
+    float weaponstarttime;
+    int weaponsequence;
+
+    // not part of the engine struct
+    double time;
+    double oldtime;
+    int framecount;
+
+    int numentities;
+    cl_entity_t entities[HostMaxEntities];
+
+    movevars_t movevars;
+};
+
+struct HostSpawnPoint
+{
+    Vector3 origin;
+    Vector3 angles;
+};
+
+extern HostOptions g_hostOptions;
+extern HostClientState g_hostClient;
+
+// host_engine.cpp
+void hostEngineInit(cl_enginefunc_t *engfuncs);
+byte *hostLoadFile(const char *path, int *length);
+void hostFreeFile(void *buffer);
+void hostSetLightstyle(int style, const char *pattern);
+double hostAbsoluteTime();
+
+// host_model.cpp
+extern std::vector<HostSpawnPoint> g_hostSpawnPoints;
+
+model_t *hostModelForName(const char *name, bool crashIfMissing);
+model_t *hostModelByIndex(int index);
+int hostModelIndex(const model_t *model);
+model_t *hostLoadWorld(const char *path);
+void hostSpawnEntities(model_t *world);
+
+// host_studio.cpp
+void hostStudioInit(engine_studio_api_t *studio, r_studio_interface_t **pinterface);
+void hostUploadStudioTextures(studiohdr_t *header);
+
+// host_replay.cpp
+model_t *hostReplayOpen(const char *path);
+bool hostReplayRead();
+void hostReplayRewind();
+void hostReplayAddEntities();
+void hostReplaySetupView(ref_params_t &refParams, Params &params);
+
+// host_egl.cpp
+void hostContextInit(int width, int height);
+void hostContextShutdown();
+
+}
+
+#endif
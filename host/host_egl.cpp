@@ -0,0 +1,109 @@
+// offscreen gl context through egl, no window system needed
+#include "stdafx.h"
+#include "host.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace Render
+{
+
+static EGLDisplay s_display{ EGL_NO_DISPLAY };
+static EGLSurface s_surface{ EGL_NO_SURFACE };
+static EGLContext s_context{ EGL_NO_CONTEXT };
+
+void hostContextInit(int width, int height)
+{
+    s_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (s_display == EGL_NO_DISPLAY)
+    {
+        platformError("Could not get EGL display");
+    }
+
+    EGLint major, minor;
+    if (!eglInitialize(s_display, &major, &minor))
+    {
+        platformError("Could not initialize EGL");
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        platformError("EGL does not support desktop OpenGL");
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount;
+    if (!eglChooseConfig(s_display, configAttribs, &config, 1, &configCount) || !configCount)
+    {
+        platformError("No suitable EGL config");
+    }
+
+    // the pbuffer is the default framebuffer, the renderer binds 0 when it's done with its own
+    const EGLint surfaceAttribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+
+    s_surface = eglCreatePbufferSurface(s_display, config, surfaceAttribs);
+    if (s_surface == EGL_NO_SURFACE)
+    {
+        platformError("Could not create %dx%d pbuffer", width, height);
+    }
+
+    // the renderer still leans on fixed function bits, so it has to be compatibility
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    s_context = eglCreateContext(s_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (s_context == EGL_NO_CONTEXT)
+    {
+        platformError("Could not create OpenGL compatibility context");
+    }
+
+    if (!eglMakeCurrent(s_display, s_surface, s_surface, s_context))
+    {
+        platformError("Could not make context current");
+    }
+
+    // the renderer loads its own pointers in Initialize, this is for the host's uploads
+    if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress)))
+    {
+        platformError("Could not load OpenGL functions");
+    }
+
+    printf("EGL %d.%d, %s, %s\n", major, minor, glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    glViewport(0, 0, width, height);
+}
+
+void hostContextShutdown()
+{
+    if (s_display == EGL_NO_DISPLAY)
+    {
+        return;
+    }
+
+    eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(s_display, s_context);
+    eglDestroySurface(s_display, s_surface);
+    eglTerminate(s_display);
+
+    s_display = EGL_NO_DISPLAY;
+}
+
+}
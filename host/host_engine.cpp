@@ -0,0 +1,468 @@
+// engine function table stand-ins: cvars, files, time, efx and triapi
+#include "stdafx.h"
+#include "host.h"
+
+#include <time.h>
+
+using namespace Render;
+
+// the renderer's headless platform layer looks these up by name like it
+// would in the engine binary, see platform_headless.cpp
+extern "C"
+{
+Vector3 r_origin, vpn, vright, vup;
+cl_entity_t *currententity;
+Lightstyle cl_lightstyle[MAX_LIGHTSTYLES];
+
+void *Draw_DecalTexture(int)
+{
+    // no decals are ever spawned by the host
+    return nullptr;
+}
+}
+
+namespace Render
+{
+
+HostOptions g_hostOptions;
+HostClientState g_hostClient;
+
+constexpr int MaxCvars = 256;
+
+static int s_cvarCount;
+static cvar_t s_cvars[MaxCvars];
+
+static dlight_t s_dlights[MAX_DLIGHTS];
+static dlight_t s_elights[MAX_ELIGHTS];
+
+static cvar_t *RegisterVariable(char *name, char *value, int flags)
+{
+    for (int i = 0; i < s_cvarCount; i++)
+    {
+        if (!strcmp(s_cvars[i].name, name))
+        {
+            return &s_cvars[i];
+        }
+    }
+
+    if (s_cvarCount == MaxCvars)
+    {
+        platformError("Too many cvars");
+    }
+
+    cvar_t *cvar = &s_cvars[s_cvarCount++];
+    cvar->name = strdup(name);
+    cvar->string = strdup(value);
+    cvar->flags = flags;
+    cvar->value = static_cast<float>(atof(value));
+    cvar->next = (s_cvarCount > 1) ? &s_cvars[s_cvarCount - 2] : nullptr;
+    return cvar;
+}
+
+static cvar_t *GetCvarPointer(const char *name)
+{
+    for (int i = 0; i < s_cvarCount; i++)
+    {
+        if (!strcmp(s_cvars[i].name, name))
+        {
+            return &s_cvars[i];
+        }
+    }
+
+    return nullptr;
+}
+
+static cvar_t *GetFirstCvarPtr()
+{
+    return s_cvarCount ? &s_cvars[s_cvarCount - 1] : nullptr;
+}
+
+static void Cvar_Set(char *name, char *value)
+{
+    cvar_t *cvar = GetCvarPointer(name);
+    if (!cvar)
+    {
+        return;
+    }
+
+    free(cvar->string);
+    cvar->string = strdup(value);
+    cvar->value = static_cast<float>(atof(value));
+}
+
+static void RegisterEngineCvars()
+{
+    // cvars the renderer expects the engine to have registered
+    static const char *const s_engineCvars[][2] = {
+        { "r_norefresh", "0" },
+        { "r_fullbright", "0" },
+        { "direct", "0.9" },
+        { "gl_spriteblend", "1" },
+        { "gl_polyoffset", "4" },
+        { "gl_fog", "1" },
+        { "gl_texturemode", "GL_LINEAR_MIPMAP_LINEAR" },
+        { "r_traceglow", "0" },
+        { "r_glowshellfreq", "2.2" },
+        { "cl_righthand", "1" },
+        { "brightness", "0" },
+        { "gamma", "2.5" },
+        { "lightgamma", "2.5" },
+        { "texgamma", "2.0" },
+        { "tracerred", "0.8" },
+        { "tracergreen", "0.8" },
+        { "tracerblue", "0.4" },
+        { "traceralpha", "0.5" },
+        { "crosshair", "1" }
+    };
+
+    for (auto &cvar : s_engineCvars)
+    {
+        RegisterVariable(const_cast<char *>(cvar[0]), const_cast<char *>(cvar[1]), 0);
+    }
+}
+
+static int AddCommand(char *, void (*)())
+{
+    // nobody is going to type anything
+    return 1;
+}
+
+static void Con_Printf(char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+}
+
+static int GetScreenInfo(SCREENINFO *info)
+{
+    if (!info || info->iSize != sizeof(*info))
+    {
+        return 0;
+    }
+
+    info->iWidth = g_hostOptions.width;
+    info->iHeight = g_hostOptions.height;
+    info->iFlags = 0;
+    info->iCharHeight = 16;
+    return 1;
+}
+
+static void SetCrosshair(HSPRITE, wrect_t, int, int, int)
+{
+}
+
+static void SPR_Set(HSPRITE, int, int, int)
+{
+}
+
+static void SPR_DrawHoles(int, int, int, const wrect_t *)
+{
+}
+
+static int DrawString(int, int, const char *, int, int, int)
+{
+    return 0;
+}
+
+static cl_entity_t *GetViewModel()
+{
+    return &g_hostClient.viewent;
+}
+
+static cl_entity_t *GetEntityByIndex(int index)
+{
+    if (index < 0 || index >= g_hostClient.numentities)
+    {
+        return nullptr;
+    }
+
+    return &g_hostClient.entities[index];
+}
+
+static float GetClientTime()
+{
+    return static_cast<float>(g_hostClient.time);
+}
+
+static float GetClientOldTime()
+{
+    return static_cast<float>(g_hostClient.oldtime);
+}
+
+double hostAbsoluteTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int CreateVisibleEntity(int type, cl_entity_t *entity)
+{
+    return AddEntity(type, entity);
+}
+
+static void GetScreenFade(screenfade_t *fade)
+{
+    memset(fade, 0, sizeof(*fade));
+}
+
+byte *hostLoadFile(const char *path, int *length)
+{
+    // same search order as the engine: mod directory first, then valve
+    const char *directories[] = { g_hostOptions.gameDir, "valve" };
+
+    for (const char *directory : directories)
+    {
+        char fullPath[512];
+        snprintf(fullPath, sizeof(fullPath), "%s/%s/%s", g_hostOptions.baseDir, directory, path);
+
+        FILE *file = fopen(fullPath, "rb");
+        if (!file)
+        {
+            continue;
+        }
+
+        fseek(file, 0, SEEK_END);
+        int size = static_cast<int>(ftell(file));
+        fseek(file, 0, SEEK_SET);
+
+        // null terminate for text files like the engine does
+        byte *data = static_cast<byte *>(malloc(size + 1));
+        if (fread(data, 1, size, file) != static_cast<size_t>(size))
+        {
+            free(data);
+            fclose(file);
+            continue;
+        }
+
+        data[size] = 0;
+        fclose(file);
+
+        if (length)
+        {
+            *length = size;
+        }
+
+        return data;
+    }
+
+    if (length)
+    {
+        *length = 0;
+    }
+
+    return nullptr;
+}
+
+void hostFreeFile(void *buffer)
+{
+    free(buffer);
+}
+
+static byte *COM_LoadFile(char *path, int, int *length)
+{
+    return hostLoadFile(path, length);
+}
+
+// the engine returns the mod directory relative to the working directory, ours is wherever
+static const char *GetGameDirectory()
+{
+    static char directory[512];
+    snprintf(directory, sizeof(directory), "%s/%s", g_hostOptions.baseDir, g_hostOptions.gameDir);
+    return directory;
+}
+
+void hostSetLightstyle(int style, const char *pattern)
+{
+    GL3_ASSERT(style >= 0 && style < MAX_LIGHTSTYLES);
+
+    Lightstyle &dest = cl_lightstyle[style];
+    size_t length = Q_min(strlen(pattern), sizeof(dest.data) - 1);
+    memcpy(dest.data, pattern, length);
+    dest.data[length] = '\0';
+    dest.size = static_cast<int>(length);
+}
+
+static void SetupLightstyles()
+{
+    // what the game dll sends on map start
+    hostSetLightstyle(0, "m");
+    hostSetLightstyle(1, "mmnmmommommnonmmonqnmmo");
+    hostSetLightstyle(2, "abcdefghijklmnopqrstuvwxyzyxwvutsrqponmlkjihgfedcba");
+    hostSetLightstyle(3, "mmmmmaaaaammmmmaaaaaabcdefgabcdefg");
+    hostSetLightstyle(4, "mamamamamama");
+    hostSetLightstyle(5, "jklmnopqrstuvwxyzyxwvutsrqponmlkj");
+    hostSetLightstyle(6, "nmonqnmomnmomomno");
+    hostSetLightstyle(7, "mmmaaaabcdefgmmmmaaaammmaamm");
+    hostSetLightstyle(8, "mmmaaammmaaammmabcdefaaaammmmabcdefmmmaaaa");
+    hostSetLightstyle(9, "aaaaaaaazzzzzzzz");
+    hostSetLightstyle(10, "mmamammmmammamamaaamammma");
+    hostSetLightstyle(11, "abcdefghijklmnopqrrqponmlkjihgfedcba");
+    hostSetLightstyle(12, "mmnnmmnnnmmnn");
+    hostSetLightstyle(NULL_LIGHTSTYLE, "a");
+}
+
+// efx, only the allocators are used by the renderer itself
+static dlight_t *CL_AllocDlight(int key)
+{
+    if (key)
+    {
+        for (dlight_t &light : s_dlights)
+        {
+            if (light.key == key)
+            {
+                memset(&light, 0, sizeof(light));
+                light.key = key;
+                return &light;
+            }
+        }
+    }
+
+    for (dlight_t &light : s_dlights)
+    {
+        if (light.die < g_hostClient.time)
+        {
+            memset(&light, 0, sizeof(light));
+            light.key = key;
+            return &light;
+        }
+    }
+
+    memset(&s_dlights[0], 0, sizeof(s_dlights[0]));
+    s_dlights[0].key = key;
+    return &s_dlights[0];
+}
+
+static dlight_t *CL_AllocElight(int key)
+{
+    for (dlight_t &light : s_elights)
+    {
+        if (!key || light.die < g_hostClient.time)
+        {
+            memset(&light, 0, sizeof(light));
+            light.key = key;
+            return &light;
+        }
+    }
+
+    memset(&s_elights[0], 0, sizeof(s_elights[0]));
+    s_elights[0].key = key;
+    return &s_elights[0];
+}
+
+static efx_api_t s_efx;
+
+// the gl1 triapi, only reached outside of RenderScene
+static void Tri_RenderMode(int) {}
+static void Tri_Begin(int) {}
+static void Tri_End() {}
+static void Tri_Color4f(float, float, float, float) {}
+static void Tri_Color4ub(unsigned char, unsigned char, unsigned char, unsigned char) {}
+static void Tri_TexCoord2f(float, float) {}
+static void Tri_Vertex3fv(float *) {}
+static void Tri_Vertex3f(float, float, float) {}
+static void Tri_Brightness(float) {}
+static void Tri_CullFace(TRICULLSTYLE) {}
+static int Tri_SpriteTexture(model_t *, int) { return 1; }
+static int Tri_WorldToScreen(float *, float *screen) { screen[0] = screen[1] = screen[2] = 0; return 1; }
+static void Tri_Fog(float *, float, float, int) {}
+static void Tri_ScreenToWorld(float *, float *world) { world[0] = world[1] = world[2] = 0; }
+static void Tri_GetMatrix(const int, float *matrix) { memset(matrix, 0, sizeof(float) * 16); }
+static int Tri_BoxInPVS(float *, float *) { return 1; }
+static void Tri_LightAtPoint(float *, float *value) { value[0] = value[1] = value[2] = 255; }
+static void Tri_Color4fRendermode(float, float, float, float, int) {}
+static void Tri_FogParams(float, int) {}
+
+static triangleapi_t s_triapi = {
+    TRI_API_VERSION,
+    Tri_RenderMode,
+    Tri_Begin,
+    Tri_End,
+    Tri_Color4f,
+    Tri_Color4ub,
+    Tri_TexCoord2f,
+    Tri_Vertex3fv,
+    Tri_Vertex3f,
+    Tri_Brightness,
+    Tri_CullFace,
+    Tri_SpriteTexture,
+    Tri_WorldToScreen,
+    Tri_Fog,
+    Tri_ScreenToWorld,
+    Tri_GetMatrix,
+    Tri_BoxInPVS,
+    Tri_LightAtPoint,
+    Tri_Color4fRendermode,
+    Tri_FogParams
+};
+
+static void EV_SetTraceHull(int)
+{
+}
+
+static void EV_PlayerTrace(float *, float *end, int, int, pmtrace_t *trace)
+{
+    // no collision, everything is in plain sight
+    memset(trace, 0, sizeof(*trace));
+    trace->fraction = 1.0f;
+    trace->endpos = { end[0], end[1], end[2] };
+    trace->ent = -1;
+}
+
+static event_api_t s_eventapi;
+
+void hostEngineInit(cl_enginefunc_t *engfuncs)
+{
+    memset(engfuncs, 0, sizeof(*engfuncs));
+
+    s_efx.CL_AllocDlight = CL_AllocDlight;
+    s_efx.CL_AllocElight = CL_AllocElight;
+
+    s_eventapi.version = EVENT_API_VERSION;
+    s_eventapi.EV_SetTraceHull = EV_SetTraceHull;
+    s_eventapi.EV_PlayerTrace = EV_PlayerTrace;
+
+    engfuncs->pfnSPR_Set = SPR_Set;
+    engfuncs->pfnSPR_DrawHoles = SPR_DrawHoles;
+    engfuncs->pfnGetScreenInfo = GetScreenInfo;
+    engfuncs->pfnSetCrosshair = SetCrosshair;
+    engfuncs->pfnRegisterVariable = RegisterVariable;
+    engfuncs->pfnAddCommand = AddCommand;
+    engfuncs->Con_Printf = Con_Printf;
+    engfuncs->GetViewModel = GetViewModel;
+    engfuncs->GetEntityByIndex = GetEntityByIndex;
+    engfuncs->GetClientTime = GetClientTime;
+    engfuncs->CL_CreateVisibleEntity = CreateVisibleEntity;
+    engfuncs->pfnGetCvarPointer = GetCvarPointer;
+    engfuncs->pfnGetScreenFade = GetScreenFade;
+    engfuncs->COM_LoadFile = COM_LoadFile;
+    engfuncs->COM_FreeFile = hostFreeFile;
+    engfuncs->pfnGetGameDirectory = GetGameDirectory;
+    engfuncs->pTriAPI = &s_triapi;
+    engfuncs->pEfxAPI = &s_efx;
+    engfuncs->pEventAPI = &s_eventapi;
+    engfuncs->GetFirstCvarPtr = GetFirstCvarPtr;
+    engfuncs->hudGetClientOldTime = GetClientOldTime;
+    engfuncs->hudGetModelByIndex = hostModelByIndex;
+    engfuncs->pfnDrawString = DrawString;
+    engfuncs->Cvar_Set = Cvar_Set;
+    engfuncs->GetAbsoluteTime = hostAbsoluteTime;
+
+    RegisterEngineCvars();
+    SetupLightstyles();
+
+    // sane movevars for sky lighting and zfar
+    movevars_t &movevars = g_hostClient.movevars;
+    movevars.zmax = 4096;
+    movevars.skycolor_r = 128;
+    movevars.skycolor_g = 128;
+    movevars.skycolor_b = 128;
+    movevars.skyvec_x = 0;
+    movevars.skyvec_y = 0;
+    movevars.skyvec_z = -1;
+    Q_strcpy(movevars.skyName, "desert");
+}
+
+}
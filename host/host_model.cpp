@@ -0,0 +1,1589 @@
+// model loading: bsp30, sprites and studio models straight from disk into the
+// same structures the engine would have built for us
+#include "stdafx.h"
+#include "host.h"
+#include "model_goldsrc.h"
+#include "brush.h"
+#include "gamma.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+namespace Render
+{
+
+static_assert(sizeof(goldsrc::model_t) == sizeof(model_t), "model_t mismatch");
+
+std::vector<HostSpawnPoint> g_hostSpawnPoints;
+
+// index 0 is unused like in the engine, 1 is reserved for the world since
+// Initialize already precaches a few sprites before there is a level
+constexpr int WorldModelIndex = 1;
+
+static int s_modelCount = WorldModelIndex + 1;
+static goldsrc::model_t *s_models[HostMaxModels];
+
+template<typename T>
+static T *Alloc(int count)
+{
+    // never freed, the host only ever loads one level
+    void *memory = calloc(Q_max(count, 1), sizeof(T));
+    if (!memory)
+    {
+        platformError("Out of memory");
+    }
+
+    return static_cast<T *>(memory);
+}
+
+static goldsrc::model_t *NewModel(const char *name)
+{
+    if (s_modelCount == HostMaxModels)
+    {
+        platformError("Too many models");
+    }
+
+    goldsrc::model_t *model = Alloc<goldsrc::model_t>(1);
+    Q_strcpy_truncate(model->name, name);
+    s_models[s_modelCount++] = model;
+    return model;
+}
+
+model_t *hostModelByIndex(int index)
+{
+    if (index <= 0 || index >= s_modelCount)
+    {
+        return nullptr;
+    }
+
+    return reinterpret_cast<model_t *>(s_models[index]);
+}
+
+int hostModelIndex(const model_t *model)
+{
+    for (int i = 1; i < s_modelCount; i++)
+    {
+        if (reinterpret_cast<const model_t *>(s_models[i]) == model)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static float RadiusFromBounds(const Vector3 &mins, const Vector3 &maxs)
+{
+    Vector3 corner;
+
+    for (int i = 0; i < 3; i++)
+    {
+        corner.Get(i) = Q_max(fabsf(mins.Get(i)), fabsf(maxs.Get(i)));
+    }
+
+    return VectorLength(corner);
+}
+
+enum IndexedTextureMode
+{
+    IndexedOpaque,
+    IndexedMasked, // index 255 is transparent
+    IndexedAlpha // alpha is the index, color is the last palette entry
+};
+
+// 8 bit paletted image to a gl texture like GL_LoadTexture does
+static GLuint UploadIndexedTexture(const byte *pixels, int width, int height, const byte *palette, IndexedTextureMode mode, bool mipmapped)
+{
+    std::vector<byte> rgba(width * height * 4);
+
+    for (int i = 0; i < width * height; i++)
+    {
+        int index = pixels[i];
+        byte *dest = &rgba[i * 4];
+
+        if (mode == IndexedAlpha)
+        {
+            dest[0] = g_gammaTextureTable[palette[255 * 3 + 0]];
+            dest[1] = g_gammaTextureTable[palette[255 * 3 + 1]];
+            dest[2] = g_gammaTextureTable[palette[255 * 3 + 2]];
+            dest[3] = static_cast<byte>(index);
+        }
+        else if (mode == IndexedMasked && index == 255)
+        {
+            dest[0] = dest[1] = dest[2] = dest[3] = 0;
+        }
+        else
+        {
+            dest[0] = g_gammaTextureTable[palette[index * 3 + 0]];
+            dest[1] = g_gammaTextureTable[palette[index * 3 + 1]];
+            dest[2] = g_gammaTextureTable[palette[index * 3 + 2]];
+            dest[3] = 255;
+        }
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+
+    if (mipmapped)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+/************************************************/
+/* bsp30
+ */
+
+enum
+{
+    LUMP_ENTITIES,
+    LUMP_PLANES,
+    LUMP_TEXTURES,
+    LUMP_VERTEXES,
+    LUMP_VISIBILITY,
+    LUMP_NODES,
+    LUMP_TEXINFO,
+    LUMP_FACES,
+    LUMP_LIGHTING,
+    LUMP_CLIPNODES,
+    LUMP_LEAFS,
+    LUMP_MARKSURFACES,
+    LUMP_EDGES,
+    LUMP_SURFEDGES,
+    LUMP_MODELS,
+    HEADER_LUMPS
+};
+
+constexpr int BspVersion = 30;
+
+struct dlump_t
+{
+    int fileofs;
+    int filelen;
+};
+
+struct dheader_t
+{
+    int version;
+    dlump_t lumps[HEADER_LUMPS];
+};
+
+struct dplane_t
+{
+    float normal[3];
+    float dist;
+    int type;
+};
+
+struct dmiptexlump_t
+{
+    int nummiptex;
+    int dataofs[1];
+};
+
+struct miptex_t
+{
+    char name[16];
+    unsigned width, height;
+    unsigned offsets[4];
+};
+
+struct dnode_t
+{
+    int planenum;
+    short children[2];
+    short mins[3];
+    short maxs[3];
+    unsigned short firstface;
+    unsigned short numfaces;
+};
+
+struct dtexinfo_t
+{
+    float vecs[2][4];
+    int miptex;
+    int flags;
+};
+
+struct dface_t
+{
+    short planenum;
+    short side;
+    int firstedge;
+    short numedges;
+    short texinfo;
+    byte styles[MAXLIGHTMAPS];
+    int lightofs;
+};
+
+struct dleaf_t
+{
+    int contents;
+    int visofs;
+    short mins[3];
+    short maxs[3];
+    unsigned short firstmarksurface;
+    unsigned short nummarksurfaces;
+    byte ambient_level[4];
+};
+
+struct dedge_t
+{
+    unsigned short v[2];
+};
+
+struct wadinfo_t
+{
+    char identification[4];
+    int numlumps;
+    int infotableofs;
+};
+
+struct lumpinfo_t
+{
+    int filepos;
+    int disksize;
+    int size;
+    char type;
+    char compression;
+    char pad1, pad2;
+    char name[16];
+};
+
+struct WadFile
+{
+    byte *data;
+    int length;
+};
+
+struct BspContext
+{
+    const byte *base;
+    const dheader_t *header;
+    goldsrc::model_t *model;
+    std::vector<WadFile> wads;
+};
+
+template<typename T>
+static const T *LumpData(const BspContext &context, int lump, int &count)
+{
+    const dlump_t &info = context.header->lumps[lump];
+    if (info.filelen % sizeof(T))
+    {
+        platformError("Funny lump size in %s", context.model->name);
+    }
+
+    count = info.filelen / sizeof(T);
+    return reinterpret_cast<const T *>(context.base + info.fileofs);
+}
+
+// worldspawn key lookup, returns false if not found
+static bool ValueForKey(const char *entity, const char *key, char (&value)[256])
+{
+    char search[80];
+    snprintf(search, sizeof(search), "\"%s\"", key);
+
+    const char *found = strstr(entity, search);
+    if (!found)
+    {
+        return false;
+    }
+
+    found = strchr(found + strlen(search), '"');
+    if (!found)
+    {
+        return false;
+    }
+
+    found++;
+
+    size_t length = 0;
+    while (found[length] && found[length] != '"' && length < sizeof(value) - 1)
+    {
+        value[length] = found[length];
+        length++;
+    }
+
+    value[length] = '\0';
+    return true;
+}
+
+static void LoadWads(BspContext &context, const char *entities)
+{
+    // only parse the worldspawn
+    const char *end = strchr(entities, '}');
+    std::string worldspawn{ entities, end ? static_cast<size_t>(end - entities) : strlen(entities) };
+
+    char wads[256];
+    if (!ValueForKey(worldspawn.c_str(), "wad", wads))
+    {
+        return;
+    }
+
+    // paths are absolute paths on the mapper's machine, only the file name is useful
+    for (char *token = strtok(wads, ";"); token; token = strtok(nullptr, ";"))
+    {
+        const char *name1 = strrchr(token, '/');
+        const char *name2 = strrchr(token, '\\');
+        const char *name = Q_max(name1, name2);
+        name = name ? name + 1 : token;
+
+        WadFile wad;
+        wad.data = hostLoadFile(name, &wad.length);
+        if (!wad.data)
+        {
+            printf("Could not load wad file %s\n", name);
+            continue;
+        }
+
+        if (memcmp(wad.data, "WAD3", 4))
+        {
+            printf("%s is not a wad3 file\n", name);
+            hostFreeFile(wad.data);
+            continue;
+        }
+
+        context.wads.push_back(wad);
+    }
+}
+
+static const miptex_t *FindWadTexture(const BspContext &context, const char *name)
+{
+    for (const WadFile &wad : context.wads)
+    {
+        const wadinfo_t *info = reinterpret_cast<const wadinfo_t *>(wad.data);
+        const lumpinfo_t *lumps = reinterpret_cast<const lumpinfo_t *>(wad.data + info->infotableofs);
+
+        for (int i = 0; i < info->numlumps; i++)
+        {
+            if (!Q_strcasecmp(lumps[i].name, name))
+            {
+                return reinterpret_cast<const miptex_t *>(wad.data + lumps[i].filepos);
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+static void LoadTextureData(goldsrc::texture_t *texture, const miptex_t *miptex)
+{
+    texture->width = miptex->width;
+    texture->height = miptex->height;
+
+    const byte *base = reinterpret_cast<const byte *>(miptex);
+    const byte *pixels = base + miptex->offsets[0];
+
+    // palette follows the last mip level with a 16 bit color count
+    const byte *palette = base + miptex->offsets[3] + (miptex->width / 8) * (miptex->height / 8) + 2;
+    texture->pPal = Alloc<byte>(256 * 3);
+    memcpy(texture->pPal, palette, 256 * 3);
+
+    IndexedTextureMode mode = (texture->name[0] == '{') ? IndexedMasked : IndexedOpaque;
+    texture->gl_texturenum = UploadIndexedTexture(pixels, miptex->width, miptex->height, palette, mode, true);
+}
+
+static void LoadMissingTexture(goldsrc::texture_t *texture)
+{
+    // checkerboard like the engine's r_notexture_mip
+    constexpr int Size = 16;
+    byte pixels[Size * Size];
+
+    for (int y = 0; y < Size; y++)
+    {
+        for (int x = 0; x < Size; x++)
+        {
+            pixels[y * Size + x] = ((x < Size / 2) ^ (y < Size / 2)) ? 1 : 0;
+        }
+    }
+
+    texture->width = Size;
+    texture->height = Size;
+    texture->pPal = Alloc<byte>(256 * 3);
+    texture->pPal[3] = texture->pPal[4] = texture->pPal[5] = 255;
+    texture->gl_texturenum = UploadIndexedTexture(pixels, Size, Size, texture->pPal, IndexedOpaque, true);
+}
+
+static void SequenceTextures(goldsrc::model_t *model)
+{
+    // mirrors Mod_LoadTextures animation chaining
+    for (int i = 0; i < model->numtextures; i++)
+    {
+        goldsrc::texture_t *texture = model->textures[i];
+        if (texture->name[0] != '+' || texture->anim_next)
+        {
+            continue;
+        }
+
+        goldsrc::texture_t *anims[10]{};
+        goldsrc::texture_t *altanims[10]{};
+        int max = 0, altmax = 0;
+
+        for (int j = i; j < model->numtextures; j++)
+        {
+            goldsrc::texture_t *other = model->textures[j];
+            if (other->name[0] != '+' || Q_strcasecmp(other->name + 2, texture->name + 2))
+            {
+                continue;
+            }
+
+            int num = toupper(other->name[1]);
+            if (num >= '0' && num <= '9')
+            {
+                num -= '0';
+                anims[num] = other;
+                max = Q_max(max, num + 1);
+            }
+            else if (num >= 'A' && num <= 'J')
+            {
+                num -= 'A';
+                altanims[num] = other;
+                altmax = Q_max(altmax, num + 1);
+            }
+        }
+
+        for (int j = 0; j < max; j++)
+        {
+            if (!anims[j])
+            {
+                platformError("Missing frame %d of %s", j, texture->name);
+            }
+
+            anims[j]->anim_total = max * 10;
+            anims[j]->anim_min = j * 10;
+            anims[j]->anim_max = (j + 1) * 10;
+            anims[j]->anim_next = anims[(j + 1) % max];
+            anims[j]->alternate_anims = altmax ? altanims[0] : nullptr;
+        }
+
+        for (int j = 0; j < altmax; j++)
+        {
+            if (!altanims[j])
+            {
+                platformError("Missing frame %d of %s", j, texture->name);
+            }
+
+            altanims[j]->anim_total = altmax * 10;
+            altanims[j]->anim_min = j * 10;
+            altanims[j]->anim_max = (j + 1) * 10;
+            altanims[j]->anim_next = altanims[(j + 1) % altmax];
+            altanims[j]->alternate_anims = max ? anims[0] : nullptr;
+        }
+    }
+
+    // random tiling textures store the tile count in anim_total
+    for (int i = 0; i < model->numtextures; i++)
+    {
+        goldsrc::texture_t *texture = model->textures[i];
+        if (texture->name[0] != '-')
+        {
+            continue;
+        }
+
+        int count = 0;
+        for (char digit = '0'; digit <= '9'; digit++, count++)
+        {
+            char name[16];
+            Q_strcpy(name, texture->name);
+            name[1] = digit;
+
+            bool found = false;
+            for (int j = 0; j < model->numtextures && !found; j++)
+            {
+                found = !Q_strcasecmp(model->textures[j]->name, name);
+            }
+
+            if (!found)
+            {
+                break;
+            }
+        }
+
+        texture->anim_total = Q_max(count, 1);
+    }
+}
+
+static void LoadTextures(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+    const dlump_t &lump = context.header->lumps[LUMP_TEXTURES];
+    if (!lump.filelen)
+    {
+        return;
+    }
+
+    const dmiptexlump_t *miptexLump = reinterpret_cast<const dmiptexlump_t *>(context.base + lump.fileofs);
+
+    model->numtextures = miptexLump->nummiptex;
+    model->textures = Alloc<goldsrc::texture_t *>(model->numtextures);
+
+    for (int i = 0; i < model->numtextures; i++)
+    {
+        goldsrc::texture_t *texture = Alloc<goldsrc::texture_t>(1);
+        model->textures[i] = texture;
+
+        if (miptexLump->dataofs[i] == -1)
+        {
+            Q_strcpy(texture->name, "notexture");
+            LoadMissingTexture(texture);
+            continue;
+        }
+
+        const miptex_t *miptex = reinterpret_cast<const miptex_t *>(
+            reinterpret_cast<const byte *>(miptexLump) + miptexLump->dataofs[i]);
+
+        Q_strcpy_truncate(texture->name, miptex->name);
+
+        // offsets are zero if the texture lives in a wad
+        if (!miptex->offsets[0])
+        {
+            miptex = FindWadTexture(context, texture->name);
+        }
+
+        if (miptex)
+        {
+            LoadTextureData(texture, miptex);
+        }
+        else
+        {
+            printf("Texture %s not found\n", texture->name);
+            LoadMissingTexture(texture);
+        }
+    }
+
+    SequenceTextures(model);
+}
+
+static void LoadPlanes(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dplane_t *in = LumpData<dplane_t>(context, LUMP_PLANES, count);
+
+    model->numplanes = count;
+    model->planes = Alloc<goldsrc::mplane_t>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        goldsrc::mplane_t &out = model->planes[i];
+        out.normal = in[i].normal;
+        out.dist = in[i].dist;
+        out.type = static_cast<byte>(in[i].type);
+
+        int bits = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            if (in[i].normal[j] < 0)
+            {
+                bits |= 1 << j;
+            }
+        }
+
+        out.signbits = static_cast<byte>(bits);
+    }
+}
+
+static void LoadVertexes(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const Vector3 *in = LumpData<Vector3>(context, LUMP_VERTEXES, count);
+
+    model->numvertexes = count;
+    model->vertexes = Alloc<goldsrc::mvertex_t>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        model->vertexes[i].position = in[i];
+    }
+}
+
+static void LoadEdges(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dedge_t *in = LumpData<dedge_t>(context, LUMP_EDGES, count);
+
+    model->numedges = count;
+    model->edges = Alloc<goldsrc::medge_t>(count + 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        model->edges[i].v[0] = in[i].v[0];
+        model->edges[i].v[1] = in[i].v[1];
+    }
+}
+
+static void LoadSurfedges(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const int *in = LumpData<int>(context, LUMP_SURFEDGES, count);
+
+    model->numsurfedges = count;
+    model->surfedges = Alloc<int>(count);
+    memcpy(model->surfedges, in, sizeof(int) * count);
+}
+
+static void LoadLighting(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+    const dlump_t &lump = context.header->lumps[LUMP_LIGHTING];
+    if (!lump.filelen)
+    {
+        return;
+    }
+
+    byte *data = Alloc<byte>(lump.filelen);
+    memcpy(data, context.base + lump.fileofs, lump.filelen);
+    model->lightdata = reinterpret_cast<color24 *>(data);
+}
+
+static void LoadVisibility(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+    const dlump_t &lump = context.header->lumps[LUMP_VISIBILITY];
+    if (!lump.filelen)
+    {
+        return;
+    }
+
+    model->visdata = Alloc<byte>(lump.filelen);
+    memcpy(model->visdata, context.base + lump.fileofs, lump.filelen);
+}
+
+static void LoadEntities(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+    const dlump_t &lump = context.header->lumps[LUMP_ENTITIES];
+
+    model->entities = Alloc<char>(lump.filelen + 1);
+    memcpy(model->entities, context.base + lump.fileofs, lump.filelen);
+}
+
+static void LoadTexinfo(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dtexinfo_t *in = LumpData<dtexinfo_t>(context, LUMP_TEXINFO, count);
+
+    model->numtexinfo = count;
+    model->texinfo = Alloc<goldsrc::mtexinfo_t>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        goldsrc::mtexinfo_t &out = model->texinfo[i];
+        out.vec_s = in[i].vecs[0];
+        out.dist_s = in[i].vecs[0][3];
+        out.vec_t = in[i].vecs[1];
+        out.dist_t = in[i].vecs[1][3];
+        out.flags = in[i].flags;
+
+        int miptex = in[i].miptex;
+        if (miptex < 0 || miptex >= model->numtextures)
+        {
+            platformError("Bad texinfo miptex %d in %s", miptex, model->name);
+        }
+
+        out.texture = model->textures[miptex];
+    }
+}
+
+static void CalcSurfaceExtents(const goldsrc::model_t *model, goldsrc::msurface_t *surface)
+{
+    float mins[2] = { 999999, 999999 };
+    float maxs[2] = { -99999, -99999 };
+
+    const goldsrc::mtexinfo_t *texinfo = surface->texinfo;
+
+    for (int i = 0; i < surface->numedges; i++)
+    {
+        int edge = model->surfedges[surface->firstedge + i];
+
+        const goldsrc::mvertex_t *vertex;
+        if (edge >= 0)
+        {
+            vertex = &model->vertexes[model->edges[edge].v[0]];
+        }
+        else
+        {
+            vertex = &model->vertexes[model->edges[-edge].v[1]];
+        }
+
+        // double precision like the engine so the lightmap sizes agree with the compiler
+        double s = DotDouble(vertex->position, texinfo->vec_s) + texinfo->dist_s;
+        double t = DotDouble(vertex->position, texinfo->vec_t) + texinfo->dist_t;
+
+        mins[0] = Q_min(mins[0], static_cast<float>(s));
+        maxs[0] = Q_max(maxs[0], static_cast<float>(s));
+        mins[1] = Q_min(mins[1], static_cast<float>(t));
+        maxs[1] = Q_max(maxs[1], static_cast<float>(t));
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        int bmin = static_cast<int>(floorf(mins[i] / 16));
+        int bmax = static_cast<int>(ceilf(maxs[i] / 16));
+
+        surface->texturemins[i] = static_cast<short>(bmin * 16);
+        surface->extents[i] = static_cast<short>((bmax - bmin) * 16);
+    }
+}
+
+static int TextureSurfaceFlags(const char *name)
+{
+    // FIXME: the engine also keys some of this off of texinfo flags
+    if (!strncasecmp(name, "sky", 3))
+    {
+        return SURF_SKY;
+    }
+
+    if (name[0] == '!' || !strncasecmp(name, "laser", 5) || !strncasecmp(name, "water", 5))
+    {
+        return SURF_WATER;
+    }
+
+    if (!strncasecmp(name, "scroll", 6))
+    {
+        return SURF_SCROLL;
+    }
+
+    return 0;
+}
+
+static void LoadFaces(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dface_t *in = LumpData<dface_t>(context, LUMP_FACES, count);
+
+    model->numsurfaces = count;
+    model->surfaces = Alloc<goldsrc::msurface_t>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        goldsrc::msurface_t &out = model->surfaces[i];
+
+        out.firstedge = in[i].firstedge;
+        out.numedges = in[i].numedges;
+        out.plane = &model->planes[in[i].planenum];
+        out.texinfo = &model->texinfo[in[i].texinfo];
+
+        if (in[i].side)
+        {
+            out.flags |= SURF_BACK;
+        }
+
+        CalcSurfaceExtents(model, &out);
+
+        memcpy(out.styles, in[i].styles, sizeof(out.styles));
+
+        if (in[i].lightofs != -1 && model->lightdata)
+        {
+            out.samples = reinterpret_cast<color24 *>(reinterpret_cast<byte *>(model->lightdata) + in[i].lightofs);
+        }
+
+        out.flags |= TextureSurfaceFlags(out.texinfo->texture->name);
+    }
+}
+
+static void LoadMarksurfaces(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const unsigned short *in = LumpData<unsigned short>(context, LUMP_MARKSURFACES, count);
+
+    model->nummarksurfaces = count;
+    model->marksurfaces = Alloc<goldsrc::msurface_t *>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (in[i] >= model->numsurfaces)
+        {
+            platformError("Bad marksurface %d in %s", in[i], model->name);
+        }
+
+        model->marksurfaces[i] = &model->surfaces[in[i]];
+    }
+}
+
+static void LoadLeafs(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dleaf_t *in = LumpData<dleaf_t>(context, LUMP_LEAFS, count);
+
+    // one extra zeroed leaf so the renderer's leaf count guesswork stops here,
+    // CONTENTS_EMPTY is -1 so contents 0 can never be mistaken for a leaf
+    model->numleafs = count;
+    model->leafs = Alloc<goldsrc::mleaf_t>(count + 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        goldsrc::mleaf_t &out = model->leafs[i];
+
+        out.contents = in[i].contents;
+
+        for (int j = 0; j < 3; j++)
+        {
+            out.mins.Get(j) = in[i].mins[j];
+            out.maxs.Get(j) = in[i].maxs[j];
+        }
+
+        out.firstmarksurface = model->marksurfaces + in[i].firstmarksurface;
+        out.nummarksurfaces = in[i].nummarksurfaces;
+
+        if (in[i].visofs != -1 && model->visdata)
+        {
+            out.compressed_vis = model->visdata + in[i].visofs;
+        }
+
+        memcpy(out.ambient_sound_level, in[i].ambient_level, sizeof(out.ambient_sound_level));
+    }
+}
+
+static void SetParent(goldsrc::mnode_t *node, goldsrc::mnode_t *parent)
+{
+    node->parent = parent;
+
+    if (node->contents < 0)
+    {
+        return;
+    }
+
+    SetParent(node->children[0], node);
+    SetParent(node->children[1], node);
+}
+
+static void LoadNodes(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const dnode_t *in = LumpData<dnode_t>(context, LUMP_NODES, count);
+
+    model->numnodes = count;
+    model->nodes = Alloc<goldsrc::mnode_t>(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        goldsrc::mnode_t &out = model->nodes[i];
+
+        for (int j = 0; j < 3; j++)
+        {
+            out.mins.Get(j) = in[i].mins[j];
+            out.maxs.Get(j) = in[i].maxs[j];
+        }
+
+        out.plane = &model->planes[in[i].planenum];
+        out.firstsurface = in[i].firstface;
+        out.numsurfaces = in[i].numfaces;
+
+        for (int j = 0; j < 2; j++)
+        {
+            int child = in[i].children[j];
+            if (child >= 0)
+            {
+                out.children[j] = &model->nodes[child];
+            }
+            else
+            {
+                out.children[j] = reinterpret_cast<goldsrc::mnode_t *>(&model->leafs[-1 - child]);
+            }
+        }
+    }
+
+    SetParent(model->nodes, nullptr);
+}
+
+static void LoadSubmodels(BspContext &context)
+{
+    goldsrc::model_t *model = context.model;
+
+    int count;
+    const goldsrc::dmodel_t *in = LumpData<goldsrc::dmodel_t>(context, LUMP_MODELS, count);
+
+    if (!count)
+    {
+        platformError("No models in %s", model->name);
+    }
+
+    model->numsubmodels = count;
+    model->submodels = Alloc<goldsrc::dmodel_t>(count);
+    memcpy(model->submodels, in, sizeof(goldsrc::dmodel_t) * count);
+}
+
+static void SetupBrushModel(goldsrc::model_t *model, const goldsrc::dmodel_t &submodel)
+{
+    model->type = goldsrc::mod_brush;
+    model->firstmodelsurface = submodel.firstface;
+    model->nummodelsurfaces = submodel.numfaces;
+    model->mins = submodel.mins;
+    model->maxs = submodel.maxs;
+    model->radius = RadiusFromBounds(model->mins, model->maxs);
+}
+
+static void SetupInlineModels(goldsrc::model_t *world)
+{
+    // the world is *0, the rest get precached right after it
+    SetupBrushModel(world, world->submodels[0]);
+
+    // Mod_LoadBrushModel stomps this, the renderer knows to expect it
+    world->numleafs = world->submodels[0].visleafs;
+
+    for (int i = 1; i < world->numsubmodels; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "*%d", i);
+
+        goldsrc::model_t *model = NewModel(name);
+        char nameCopy[64];
+        Q_strcpy(nameCopy, model->name);
+
+        *model = *world;
+        Q_strcpy(model->name, nameCopy);
+        SetupBrushModel(model, world->submodels[i]);
+        model->numleafs = world->submodels[i].visleafs;
+    }
+}
+
+model_t *hostLoadWorld(const char *path)
+{
+    int length;
+    byte *data = hostLoadFile(path, &length);
+    if (!data)
+    {
+        platformError("Could not load %s", path);
+    }
+
+    const dheader_t *header = reinterpret_cast<const dheader_t *>(data);
+    if (length < static_cast<int>(sizeof(*header)) || header->version != BspVersion)
+    {
+        platformError("%s is not a version %d bsp", path, BspVersion);
+    }
+
+    if (s_models[WorldModelIndex])
+    {
+        platformError("A level is already loaded");
+    }
+
+    goldsrc::model_t *model = Alloc<goldsrc::model_t>(1);
+    Q_strcpy_truncate(model->name, path);
+
+    BspContext context{};
+    context.base = data;
+    context.header = header;
+    context.model = model;
+
+    LoadEntities(context);
+    LoadWads(context, model->entities);
+    LoadVertexes(context);
+    LoadEdges(context);
+    LoadSurfedges(context);
+    LoadTextures(context);
+    LoadLighting(context);
+    LoadPlanes(context);
+    LoadTexinfo(context);
+    LoadFaces(context);
+    LoadMarksurfaces(context);
+    LoadVisibility(context);
+    LoadLeafs(context);
+    LoadNodes(context);
+    LoadSubmodels(context);
+
+    SetupInlineModels(model);
+
+    // only now the renderer gets to see it
+    s_models[WorldModelIndex] = model;
+
+    for (WadFile &wad : context.wads)
+    {
+        hostFreeFile(wad.data);
+    }
+
+    hostFreeFile(data);
+
+    return reinterpret_cast<model_t *>(model);
+}
+
+/************************************************/
+/* sprites
+ */
+
+struct dsprite_t
+{
+    int ident;
+    int version;
+    int type;
+    int texFormat;
+    float boundingradius;
+    int width;
+    int height;
+    int numframes;
+    float beamlength;
+    int synctype;
+};
+
+struct dspriteframe_t
+{
+    int origin[2];
+    int width;
+    int height;
+};
+
+enum
+{
+    SPR_NORMAL,
+    SPR_ADDITIVE,
+    SPR_INDEXALPHA,
+    SPR_ALPHTEST
+};
+
+static bool LoadSprite(goldsrc::model_t *model, const byte *data, int length)
+{
+    const dsprite_t *header = reinterpret_cast<const dsprite_t *>(data);
+    if (length < static_cast<int>(sizeof(*header)) || memcmp(&header->ident, "IDSP", 4) || header->version != 2)
+    {
+        return false;
+    }
+
+    const byte *cursor = data + sizeof(*header);
+
+    int paletteSize = *reinterpret_cast<const short *>(cursor);
+    const byte *palette = cursor + 2;
+    cursor += 2 + paletteSize * 3;
+
+    // palette might be shorter than 256 colors
+    byte fullPalette[256 * 3]{};
+    memcpy(fullPalette, palette, Q_min(paletteSize, 256) * 3);
+
+    int numframes = Q_max(header->numframes, 1);
+
+    size_t spriteSize = sizeof(goldsrc::msprite_t) + (numframes - 1) * sizeof(goldsrc::mspriteframedesc_t);
+    goldsrc::msprite_t *sprite = static_cast<goldsrc::msprite_t *>(calloc(1, spriteSize));
+    sprite->type = static_cast<short>(header->type);
+    sprite->texFormat = static_cast<short>(header->texFormat);
+    sprite->maxwidth = header->width;
+    sprite->maxheight = header->height;
+    sprite->numframes = numframes;
+    sprite->beamlength = header->beamlength;
+
+    IndexedTextureMode mode = IndexedOpaque;
+    if (header->texFormat == SPR_ALPHTEST)
+    {
+        mode = IndexedMasked;
+    }
+    else if (header->texFormat == SPR_INDEXALPHA)
+    {
+        mode = IndexedAlpha;
+    }
+
+    for (int i = 0; i < header->numframes; i++)
+    {
+        int frameType = *reinterpret_cast<const int *>(cursor);
+        cursor += sizeof(int);
+
+        if (frameType != goldsrc::SPR_SINGLE)
+        {
+            // FIXME: frame groups, nothing in cstrike uses them
+            printf("%s: sprite frame groups not supported\n", model->name);
+            sprite->numframes = i;
+            break;
+        }
+
+        const dspriteframe_t *frameHeader = reinterpret_cast<const dspriteframe_t *>(cursor);
+        const byte *pixels = cursor + sizeof(*frameHeader);
+        cursor = pixels + frameHeader->width * frameHeader->height;
+
+        goldsrc::mspriteframe_t *frame = Alloc<goldsrc::mspriteframe_t>(1);
+        frame->width = frameHeader->width;
+        frame->height = frameHeader->height;
+        frame->up = static_cast<float>(frameHeader->origin[1]);
+        frame->down = static_cast<float>(frameHeader->origin[1] - frameHeader->height);
+        frame->left = static_cast<float>(frameHeader->origin[0]);
+        frame->right = static_cast<float>(frameHeader->width + frameHeader->origin[0]);
+        frame->gl_texturenum = UploadIndexedTexture(pixels, frame->width, frame->height, fullPalette, mode, false);
+
+        sprite->frames[i].type = goldsrc::SPR_SINGLE;
+        sprite->frames[i].frameptr = frame;
+    }
+
+    model->type = goldsrc::mod_sprite;
+    model->numframes = sprite->numframes;
+    model->mins = { -header->width * 0.5f, -header->width * 0.5f, -header->height * 0.5f };
+    model->maxs = { header->width * 0.5f, header->width * 0.5f, header->height * 0.5f };
+    model->radius = RadiusFromBounds(model->mins, model->maxs);
+    model->cache.data = sprite;
+    return true;
+}
+
+static void LoadPlaceholderSprite(goldsrc::model_t *model)
+{
+    // a single white pixel stands in for sprites that aren't on disk
+    static const byte s_pixel = 0;
+    static const byte s_palette[3] = { 255, 255, 255 };
+
+    goldsrc::mspriteframe_t *frame = Alloc<goldsrc::mspriteframe_t>(1);
+    frame->width = 1;
+    frame->height = 1;
+    frame->up = 0.5f;
+    frame->down = -0.5f;
+    frame->left = -0.5f;
+    frame->right = 0.5f;
+    frame->gl_texturenum = UploadIndexedTexture(&s_pixel, 1, 1, s_palette, IndexedOpaque, false);
+
+    goldsrc::msprite_t *sprite = Alloc<goldsrc::msprite_t>(1);
+    sprite->numframes = 1;
+    sprite->frames[0].type = goldsrc::SPR_SINGLE;
+    sprite->frames[0].frameptr = frame;
+
+    model->type = goldsrc::mod_sprite;
+    model->numframes = 1;
+    model->cache.data = sprite;
+}
+
+/************************************************/
+/* studio models
+ */
+
+void hostUploadStudioTextures(studiohdr_t *header)
+{
+    mstudiotexture_t *textures = reinterpret_cast<mstudiotexture_t *>(reinterpret_cast<byte *>(header) + header->textureindex);
+
+    for (int i = 0; i < header->numtextures; i++)
+    {
+        mstudiotexture_t &texture = textures[i];
+
+        const byte *pixels = reinterpret_cast<byte *>(header) + texture.index;
+        const byte *palette = pixels + texture.width * texture.height;
+
+        IndexedTextureMode mode = (texture.flags & STUDIO_NF_MASKED) ? IndexedMasked : IndexedOpaque;
+        bool mipmapped = !(texture.flags & STUDIO_NF_NOMIPS);
+
+        // the engine replaces the data offset with the gl texture name
+        texture.index = UploadIndexedTexture(pixels, texture.width, texture.height, palette, mode, mipmapped);
+    }
+}
+
+constexpr int StudioVersion = 10;
+
+static bool LoadStudioModel(goldsrc::model_t *model, byte *data, int length)
+{
+    studiohdr_t *header = reinterpret_cast<studiohdr_t *>(data);
+    if (length < static_cast<int>(sizeof(*header)) || memcmp(&header->id, "IDST", 4) || header->version != StudioVersion)
+    {
+        return false;
+    }
+
+    hostUploadStudioTextures(header);
+
+    model->type = goldsrc::mod_studio;
+    model->numframes = 1;
+    model->mins = header->bbmin;
+    model->maxs = header->bbmax;
+
+    if (VectorIsZero(model->mins) && VectorIsZero(model->maxs))
+    {
+        model->mins = header->min;
+        model->maxs = header->max;
+    }
+
+    model->radius = RadiusFromBounds(model->mins, model->maxs);
+    model->cache.data = header;
+    return true;
+}
+
+static bool HasExtension(const char *name, const char *extension)
+{
+    size_t nameLength = strlen(name);
+    size_t extensionLength = strlen(extension);
+    return nameLength > extensionLength && !Q_strcasecmp(name + nameLength - extensionLength, extension);
+}
+
+model_t *hostModelForName(const char *name, bool crashIfMissing)
+{
+    for (int i = 1; i < s_modelCount; i++)
+    {
+        if (s_models[i] && !Q_strcasecmp(s_models[i]->name, name))
+        {
+            return reinterpret_cast<model_t *>(s_models[i]);
+        }
+    }
+
+    if (name[0] == '*')
+    {
+        // inline models are created along with the world
+        return nullptr;
+    }
+
+    int length;
+    byte *data = hostLoadFile(name, &length);
+
+    goldsrc::model_t *model = NewModel(name);
+
+    if (HasExtension(name, ".spr"))
+    {
+        if (!data || !LoadSprite(model, data, length))
+        {
+            // the renderer wants a few sprites that a stripped down game dir might not have
+            printf("Could not load sprite %s, using a placeholder\n", name);
+            LoadPlaceholderSprite(model);
+        }
+
+        hostFreeFile(data);
+    }
+    else if (HasExtension(name, ".mdl"))
+    {
+        // studio data stays resident, it is the cache
+        if (!data || !LoadStudioModel(model, data, length))
+        {
+            if (crashIfMissing)
+            {
+                platformError("Could not load studio model %s", name);
+            }
+
+            // forget about it, nothing can draw it anyway
+            s_models[--s_modelCount] = nullptr;
+            hostFreeFile(data);
+            free(model);
+            return nullptr;
+        }
+    }
+    else
+    {
+        platformError("Unsupported model type %s", name);
+    }
+
+    return reinterpret_cast<model_t *>(model);
+}
+
+/************************************************/
+/* entities
+ */
+
+using EntityKeys = std::unordered_map<std::string, std::string>;
+
+static const char *ParseToken(const char *data, char (&token)[256])
+{
+    token[0] = '\0';
+
+    while (*data && isspace(static_cast<unsigned char>(*data)))
+    {
+        data++;
+    }
+
+    if (!*data)
+    {
+        return nullptr;
+    }
+
+    if (*data == '{' || *data == '}')
+    {
+        token[0] = *data;
+        token[1] = '\0';
+        return data + 1;
+    }
+
+    if (*data != '"')
+    {
+        platformError("Bad entity lump");
+    }
+
+    data++;
+
+    size_t length = 0;
+    while (*data && *data != '"')
+    {
+        if (length < sizeof(token) - 1)
+        {
+            token[length++] = *data;
+        }
+
+        data++;
+    }
+
+    token[length] = '\0';
+    return *data ? data + 1 : data;
+}
+
+static Vector3 ParseVector(const EntityKeys &keys, const char *key)
+{
+    Vector3 result{ 0, 0, 0 };
+
+    auto it = keys.find(key);
+    if (it != keys.end())
+    {
+        sscanf(it->second.c_str(), "%f %f %f", &result.x, &result.y, &result.z);
+    }
+
+    return result;
+}
+
+static int ParseInt(const EntityKeys &keys, const char *key, int fallback)
+{
+    auto it = keys.find(key);
+    return (it != keys.end()) ? atoi(it->second.c_str()) : fallback;
+}
+
+static float ParseFloat(const EntityKeys &keys, const char *key, float fallback)
+{
+    auto it = keys.find(key);
+    return (it != keys.end()) ? static_cast<float>(atof(it->second.c_str())) : fallback;
+}
+
+static void SpawnWorldspawn(const EntityKeys &keys)
+{
+    auto sky = keys.find("skyname");
+    if (sky != keys.end())
+    {
+        Q_strcpy_truncate(g_hostClient.movevars.skyName, sky->second.c_str());
+    }
+}
+
+static void SpawnLightEnvironment(const EntityKeys &keys)
+{
+    // what the game dll turns into sv_skycolor and sv_skyvec
+    auto light = keys.find("_light");
+    if (light == keys.end())
+    {
+        return;
+    }
+
+    int r = 0, g = 0, b = 0, intensity = 0;
+    int parsed = sscanf(light->second.c_str(), "%d %d %d %d", &r, &g, &b, &intensity);
+    if (parsed == 1)
+    {
+        g = b = r;
+    }
+
+    if (parsed == 4)
+    {
+        r = r * intensity / 255;
+        g = g * intensity / 255;
+        b = b * intensity / 255;
+    }
+
+    movevars_t &movevars = g_hostClient.movevars;
+    movevars.skycolor_r = static_cast<float>(r);
+    movevars.skycolor_g = static_cast<float>(g);
+    movevars.skycolor_b = static_cast<float>(b);
+
+    Vector3 angles = ParseVector(keys, "angles");
+    angles.x = ParseFloat(keys, "pitch", angles.x);
+
+    Vector3 forward;
+    AngleVectors({ -angles.x, angles.y, angles.z }, &forward, nullptr, nullptr);
+    movevars.skyvec_x = forward.x;
+    movevars.skyvec_y = forward.y;
+    movevars.skyvec_z = forward.z;
+}
+
+static cl_entity_t *NewEntity(model_t *model)
+{
+    HostClientState &client = g_hostClient;
+    if (client.numentities == HostMaxEntities)
+    {
+        return nullptr;
+    }
+
+    int index = client.numentities++;
+    cl_entity_t *entity = &client.entities[index];
+    memset(entity, 0, sizeof(*entity));
+
+    entity->index = index;
+    entity->model = model;
+    entity->curstate.number = index;
+    entity->curstate.modelindex = hostModelIndex(model);
+    entity->curstate.renderamt = 255;
+    entity->curstate.framerate = 1;
+    return entity;
+}
+
+static void SpawnEntity(const EntityKeys &keys)
+{
+    auto classname = keys.find("classname");
+    if (classname == keys.end())
+    {
+        return;
+    }
+
+    const std::string &name = classname->second;
+
+    if (name == "worldspawn")
+    {
+        SpawnWorldspawn(keys);
+        return;
+    }
+
+    if (name == "light_environment")
+    {
+        SpawnLightEnvironment(keys);
+        return;
+    }
+
+    Vector3 origin = ParseVector(keys, "origin");
+    Vector3 angles = ParseVector(keys, "angles");
+    if (keys.count("angle"))
+    {
+        angles = { 0, ParseFloat(keys, "angle", 0), 0 };
+    }
+
+    if (name == "info_player_start"
+        || name == "info_player_deathmatch"
+        || name == "info_player_terrorist"
+        || name == "info_player_counterterrorist"
+        || name == "info_vip_start")
+    {
+        // eye height of a standing player
+        g_hostSpawnPoints.push_back({ origin + Vector3{ 0, 0, 28 }, angles });
+        return;
+    }
+
+    auto modelKey = keys.find("model");
+    if (modelKey == keys.end())
+    {
+        return;
+    }
+
+    const char *modelName = modelKey->second.c_str();
+
+    // brush entities like triggers are invisible once the game dll has spawned them
+    if (!strncmp(name.c_str(), "trigger_", 8) || name == "func_buyzone" || name == "func_bomb_target"
+        || name == "func_hostage_rescue" || name == "func_ladder" || name == "func_vip_safetyzone"
+        || name == "func_escapezone")
+    {
+        return;
+    }
+
+    model_t *model = hostModelForName(modelName, false);
+    if (!model)
+    {
+        return;
+    }
+
+    cl_entity_t *entity = NewEntity(model);
+    if (!entity)
+    {
+        return;
+    }
+
+    entity->origin = origin;
+    entity->angles = angles;
+    entity->curstate.origin = origin;
+    entity->curstate.angles = angles;
+    entity->curstate.rendermode = ParseInt(keys, "rendermode", kRenderNormal);
+    entity->curstate.renderamt = ParseInt(keys, "renderamt", 255);
+    entity->curstate.renderfx = ParseInt(keys, "renderfx", kRenderFxNone);
+    entity->curstate.scale = ParseFloat(keys, "scale", 0);
+    entity->curstate.skin = ParseInt(keys, "skin", 0);
+    entity->curstate.body = ParseInt(keys, "body", 0);
+    entity->curstate.sequence = ParseInt(keys, "sequence", 0);
+    entity->curstate.framerate = ParseFloat(keys, "framerate", 1);
+
+    Vector3 color = ParseVector(keys, "rendercolor");
+    entity->curstate.rendercolor.r = static_cast<byte>(color.x);
+    entity->curstate.rendercolor.g = static_cast<byte>(color.y);
+    entity->curstate.rendercolor.b = static_cast<byte>(color.z);
+}
+
+static void SpawnProps(model_t *world)
+{
+    if (!g_hostOptions.propModel || g_hostOptions.propCount <= 0)
+    {
+        return;
+    }
+
+    model_t *model = hostModelForName(g_hostOptions.propModel, true);
+
+    // spread them out in rows around the spawn points
+    Vector3 fallback = (world->mins + world->maxs) * 0.5f;
+    int spawnCount = static_cast<int>(g_hostSpawnPoints.size());
+
+    for (int i = 0; i < g_hostOptions.propCount; i++)
+    {
+        cl_entity_t *entity = NewEntity(model);
+        if (!entity)
+        {
+            printf("Entity limit reached, spawned %d props\n", i);
+            break;
+        }
+
+        Vector3 base = spawnCount ? g_hostSpawnPoints[i % spawnCount].origin : fallback;
+        int slot = spawnCount ? (i / spawnCount) : i;
+
+        Vector3 origin = base + Vector3{ 64.0f + (slot % 8) * 48.0f, (slot / 8) * 48.0f, -28.0f };
+        Vector3 angles{ 0, static_cast<float>((i * 37) % 360), 0 };
+
+        entity->origin = origin;
+        entity->angles = angles;
+        entity->curstate.origin = origin;
+        entity->curstate.angles = angles;
+    }
+}
+
+void hostSpawnEntities(model_t *world)
+{
+    // entity 0 is the world
+    NewEntity(world);
+
+    const char *data = world->entities;
+    char token[256];
+
+    while ((data = ParseToken(data, token)))
+    {
+        if (strcmp(token, "{"))
+        {
+            platformError("Bad entity lump, expected {");
+        }
+
+        EntityKeys keys;
+
+        while (true)
+        {
+            data = ParseToken(data, token);
+            if (!data)
+            {
+                platformError("Bad entity lump, unexpected end");
+            }
+
+            if (!strcmp(token, "}"))
+            {
+                break;
+            }
+
+            std::string key = token;
+
+            data = ParseToken(data, token);
+            if (!data)
+            {
+                platformError("Bad entity lump, unexpected end");
+            }
+
+            keys[key] = token;
+        }
+
+        SpawnEntity(keys);
+    }
+
+    SpawnProps(world);
+}
+
+}
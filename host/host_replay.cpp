@@ -0,0 +1,248 @@
+// feeds frames recorded with gl3_capture_start back into the renderer
+#include "stdafx.h"
+#include "host.h"
+#include "capture.h"
+#include "particle.h"
+
+namespace Render
+{
+
+static CaptureReader s_reader;
+static CaptureFrame s_frame;
+
+// capture model index to our models, filled in as names show up
+static std::vector<model_t *> s_models;
+
+// entities that can't go in their own slot (temp entities mostly)
+static cl_entity_t s_extraEntities[CaptureMaxEntities];
+
+// entity slots used last frame, cleared before the next one
+static std::vector<int> s_usedSlots;
+static std::vector<bool> s_slotUsed;
+
+model_t *hostReplayOpen(const char *path)
+{
+    if (!captureOpen(s_reader, path))
+    {
+        platformError("Could not open capture %s", path);
+    }
+
+    model_t *world = hostLoadWorld(s_reader.header.worldName);
+
+    HostClientState &client = g_hostClient;
+    client.numentities = HostMaxEntities;
+    client.entities[0].model = world;
+
+    s_slotUsed.assign(HostMaxEntities, false);
+    return world;
+}
+
+static model_t *CaptureModel(int index)
+{
+    if (index < 0 || index >= static_cast<int>(s_reader.modelNames.size()))
+    {
+        return nullptr;
+    }
+
+    // names are added in order so the list only ever grows at the end
+    while (static_cast<int>(s_models.size()) <= index)
+    {
+        const std::string &name = s_reader.modelNames[s_models.size()];
+        s_models.push_back(hostModelForName(name.c_str(), false));
+    }
+
+    return s_models[index];
+}
+
+bool hostReplayRead()
+{
+    if (!captureReadFrame(s_reader, s_frame))
+    {
+        return false;
+    }
+
+    const CaptureView &view = s_frame.view;
+
+    HostClientState &client = g_hostClient;
+    client.oldtime = view.oldtime;
+    client.time = view.time;
+    client.framecount++;
+
+    movevars_t &movevars = client.movevars;
+    movevars.zmax = view.zmax;
+    movevars.gravity = view.gravity;
+    Q_strcpy(movevars.skyName, view.skyName);
+    movevars.skycolor_r = view.skyColor.x;
+    movevars.skycolor_g = view.skyColor.y;
+    movevars.skycolor_b = view.skyColor.z;
+    movevars.skyvec_x = view.skyVec.x;
+    movevars.skyvec_y = view.skyVec.y;
+    movevars.skyvec_z = view.skyVec.z;
+
+    for (int i = 0; i < MAX_LIGHTSTYLES; i++)
+    {
+        hostSetLightstyle(i, s_frame.lightstyles[i].data);
+    }
+
+    memset(g_dlights, 0, sizeof(dlight_t) * MAX_DLIGHTS);
+    memset(g_elights, 0, sizeof(dlight_t) * MAX_ELIGHTS);
+
+    for (const CaptureLight &light : s_frame.dlights)
+    {
+        if (light.index >= 0 && light.index < MAX_DLIGHTS)
+        {
+            g_dlights[light.index] = light.light;
+        }
+    }
+
+    for (const CaptureLight &light : s_frame.elights)
+    {
+        if (light.index >= 0 && light.index < MAX_ELIGHTS)
+        {
+            g_elights[light.index] = light.light;
+        }
+    }
+
+    return true;
+}
+
+void hostReplayRewind()
+{
+    captureRewind(s_reader);
+
+    // the capture lists the names again
+    s_models.clear();
+}
+
+static void RestoreEntity(cl_entity_t *entity, const CaptureEntity &in)
+{
+    entity->index = in.index;
+    entity->player = in.player;
+    entity->model = CaptureModel(in.model);
+
+    entity->origin = in.origin;
+    entity->angles = in.angles;
+    memcpy(entity->attachment, in.attachment, sizeof(entity->attachment));
+
+    entity_state_t &state = entity->curstate;
+    state.number = in.index;
+    state.modelindex = hostModelIndex(entity->model);
+    state.origin = in.stateOrigin;
+    state.angles = in.stateAngles;
+    state.rendermode = in.rendermode;
+    state.renderamt = in.renderamt;
+    state.renderfx = in.renderfx;
+    state.rendercolor = in.rendercolor;
+    memcpy(state.controller, in.controller, sizeof(state.controller));
+    memcpy(state.blending, in.blending, sizeof(state.blending));
+    state.skin = in.skin;
+    state.body = in.body;
+    state.sequence = in.sequence;
+    state.effects = in.effects;
+    state.frame = in.frame;
+    state.framerate = in.framerate;
+    state.scale = in.scale;
+    state.animtime = in.animtime;
+}
+
+static void RestoreParticles(const std::vector<CaptureParticle> &particles, bool tracers)
+{
+    // allocation pushes to the front so go backwards to keep the order
+    for (auto it = particles.rbegin(); it != particles.rend(); ++it)
+    {
+        particle_t *particle = tracers ? particleAllocateTracer() : particleAllocate();
+        if (!particle)
+        {
+            break;
+        }
+
+        particle->org = it->org;
+        particle->vel = it->vel;
+        particle->color = it->color;
+        particle->packedColor = it->packedColor;
+        particle->ramp = it->ramp;
+        particle->die = it->die;
+        particle->type = static_cast<ptype_t>(it->type);
+        particle->deathfunc = nullptr;
+        particle->callback = nullptr;
+    }
+}
+
+void hostReplayAddEntities()
+{
+    HostClientState &client = g_hostClient;
+
+    for (int slot : s_usedSlots)
+    {
+        memset(&client.entities[slot], 0, sizeof(cl_entity_t));
+        s_slotUsed[slot] = false;
+    }
+
+    s_usedSlots.clear();
+
+    int extraCount = 0;
+
+    for (const CaptureEntity &in : s_frame.entities)
+    {
+        // keep entities in their own slot so GetEntityByIndex finds them for attachments
+        cl_entity_t *entity;
+        if (in.index > 0 && in.index < HostMaxEntities && !s_slotUsed[in.index])
+        {
+            entity = &client.entities[in.index];
+            s_slotUsed[in.index] = true;
+            s_usedSlots.push_back(in.index);
+        }
+        else
+        {
+            entity = &s_extraEntities[extraCount++];
+            memset(entity, 0, sizeof(*entity));
+        }
+
+        RestoreEntity(entity, in);
+
+        if (entity->model || in.type == ET_BEAM)
+        {
+            AddEntity(in.type, entity);
+        }
+    }
+
+    cl_entity_t &viewent = client.viewent;
+    memset(&viewent, 0, sizeof(viewent));
+
+    if (s_frame.hasViewmodel)
+    {
+        RestoreEntity(&viewent, s_frame.viewmodel);
+
+        // internalUpdateViewmodelAnimation reads these
+        client.weaponstarttime = s_frame.viewmodel.animtime;
+        client.weaponsequence = s_frame.viewmodel.sequence;
+    }
+
+    particleClear();
+    RestoreParticles(s_frame.particles, false);
+    RestoreParticles(s_frame.tracers, true);
+}
+
+void hostReplaySetupView(ref_params_t &refParams, Params &params)
+{
+    const CaptureView &view = s_frame.view;
+
+    memset(&refParams, 0, sizeof(refParams));
+    memcpy(refParams.vieworg, &view.vieworg, sizeof(refParams.vieworg));
+    memcpy(refParams.viewangles, &view.viewangles, sizeof(refParams.viewangles));
+    memcpy(refParams.crosshairangle, &view.crosshairangle, sizeof(refParams.crosshairangle));
+    memcpy(refParams.viewport, view.viewport, sizeof(refParams.viewport));
+    refParams.time = static_cast<float>(view.time);
+    refParams.frametime = static_cast<float>(view.time - view.oldtime);
+    refParams.waterlevel = view.waterlevel;
+    refParams.onlyClientDraw = view.onlyClientDraw;
+    refParams.hardware = 1;
+    refParams.movevars = &g_hostClient.movevars;
+    refParams.max_entities = HostMaxEntities;
+
+    params.fov = view.fov;
+    params.viewModelFov = view.viewModelFov;
+    params.refParams = &refParams;
+}
+
+}
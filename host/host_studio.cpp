@@ -0,0 +1,400 @@
+// engine_studio_api_t stand-in and a minimal client studio renderer
+#include "stdafx.h"
+#include "host.h"
+
+namespace Render
+{
+
+// the table the renderer hooks in place, calls must go through it
+static engine_studio_api_t *s_studio;
+
+static r_studio_interface_t s_interface;
+
+static Matrix3x4 s_rotationMatrix;
+static Matrix3x4 s_boneTransform[MAXSTUDIOBONES];
+static Matrix3x4 s_lightTransform[MAXSTUDIOBONES];
+
+static int s_forceFaceFlags;
+static int s_modelCounters[2];
+
+static void *Mem_Calloc(int number, size_t size)
+{
+    return calloc(number, size);
+}
+
+static void *Cache_Check(cache_user_t *cache)
+{
+    // nothing is ever evicted
+    return cache->data;
+}
+
+static void LoadCacheFile(char *, cache_user_t *)
+{
+}
+
+static model_t *Mod_ForName(const char *name, int crashIfMissing)
+{
+    return hostModelForName(name, crashIfMissing != 0);
+}
+
+static void *Mod_Extradata(model_t *model)
+{
+    return model ? model->cache.data : nullptr;
+}
+
+static cl_entity_t *GetCurrentEntity()
+{
+    return currententity;
+}
+
+static player_info_t *PlayerInfo(int)
+{
+    return nullptr;
+}
+
+static entity_state_t *GetPlayerState(int index)
+{
+    // the host never spawns players but don't crash if one sneaks in
+    index = Q_clamp(index + 1, 0, HostMaxEntities - 1);
+    return &g_hostClient.entities[index].curstate;
+}
+
+static cl_entity_t *GetViewEntity()
+{
+    return &g_hostClient.viewent;
+}
+
+static void GetTimes(int *framecount, double *current, double *old)
+{
+    *framecount = g_hostClient.framecount;
+    *current = g_hostClient.time;
+    *old = g_hostClient.oldtime;
+}
+
+static cvar_t *GetCvar(const char *name)
+{
+    return g_engfuncs.pfnGetCvarPointer(name);
+}
+
+static void GetViewInfo(float *origin, float *upv, float *rightv, float *vpnv)
+{
+    memcpy(origin, &r_origin, sizeof(r_origin));
+    memcpy(upv, &vup, sizeof(vup));
+    memcpy(rightv, &vright, sizeof(vright));
+    memcpy(vpnv, &vpn, sizeof(vpn));
+}
+
+static model_t *GetChromeSprite()
+{
+    return nullptr;
+}
+
+static void GetModelCounters(int **s, int **a)
+{
+    *s = &s_modelCounters[0];
+    *a = &s_modelCounters[1];
+}
+
+static void GetAliasScale(float *x, float *y)
+{
+    *x = 1.0f;
+    *y = 1.0f;
+}
+
+static float ****StudioGetBoneTransform()
+{
+    return reinterpret_cast<float ****>(s_boneTransform);
+}
+
+static float ****StudioGetLightTransform()
+{
+    return reinterpret_cast<float ****>(s_lightTransform);
+}
+
+static float ***StudioGetAliasTransform()
+{
+    return nullptr;
+}
+
+static float ***StudioGetRotationMatrix()
+{
+    return reinterpret_cast<float ***>(&s_rotationMatrix);
+}
+
+static void StudioNoop()
+{
+}
+
+static void StudioSetupSkin(void *, int)
+{
+}
+
+static void StudioSetRemapColors(int, int)
+{
+}
+
+static model_t *SetupPlayerModel(int)
+{
+    return nullptr;
+}
+
+static int GetForceFaceFlags()
+{
+    return s_forceFaceFlags;
+}
+
+static void SetForceFaceFlags(int flags)
+{
+    s_forceFaceFlags = flags;
+}
+
+static void StudioSetHeader(void *)
+{
+}
+
+static void SetRenderModel(model_t *)
+{
+}
+
+static void SetupRenderer(int)
+{
+}
+
+static int IsHardware()
+{
+    // 1 is opengl
+    return 1;
+}
+
+static void GL_SetRenderMode(int)
+{
+}
+
+static void StudioSetRenderamt(int)
+{
+}
+
+static void StudioSetCullState(int)
+{
+}
+
+static void StudioRenderShadow(int, float *, float *, float *, float *)
+{
+}
+
+// the renderer only replaces the parts below, the rest is up to the engine
+static void StudioSetupModel(int, void **, void **)
+{
+}
+
+static int StudioCheckBBox()
+{
+    return 1;
+}
+
+static void StudioDynamicLight(cl_entity_t *, alight_t *)
+{
+}
+
+static void StudioEntityLight(alight_t *)
+{
+}
+
+static void StudioSetupLighting(alight_t *)
+{
+}
+
+static Matrix3x4 ConcatTransforms(const Matrix3x4 &a, const Matrix3x4 &b)
+{
+    Matrix3x4 result;
+    result.m00 = a.m00 * b.m00 + a.m01 * b.m10 + a.m02 * b.m20;
+    result.m01 = a.m00 * b.m01 + a.m01 * b.m11 + a.m02 * b.m21;
+    result.m02 = a.m00 * b.m02 + a.m01 * b.m12 + a.m02 * b.m22;
+    result.m03 = a.m00 * b.m03 + a.m01 * b.m13 + a.m02 * b.m23 + a.m03;
+    result.m10 = a.m10 * b.m00 + a.m11 * b.m10 + a.m12 * b.m20;
+    result.m11 = a.m10 * b.m01 + a.m11 * b.m11 + a.m12 * b.m21;
+    result.m12 = a.m10 * b.m02 + a.m11 * b.m12 + a.m12 * b.m22;
+    result.m13 = a.m10 * b.m03 + a.m11 * b.m13 + a.m12 * b.m23 + a.m13;
+    result.m20 = a.m20 * b.m00 + a.m21 * b.m10 + a.m22 * b.m20;
+    result.m21 = a.m20 * b.m01 + a.m21 * b.m11 + a.m22 * b.m21;
+    result.m22 = a.m20 * b.m02 + a.m21 * b.m12 + a.m22 * b.m22;
+    result.m23 = a.m20 * b.m03 + a.m21 * b.m13 + a.m22 * b.m23 + a.m23;
+    return result;
+}
+
+// AngleQuaternion + QuaternionMatrix from the sdk, angles are radians
+static Matrix3x4 BoneMatrix(const float *value)
+{
+    float sy, cy, sp, cp, sr, cr;
+    SinCos(value[5] * 0.5f, sy, cy);
+    SinCos(value[4] * 0.5f, sp, cp);
+    SinCos(value[3] * 0.5f, sr, cr);
+
+    float x = sr * cp * cy - cr * sp * sy;
+    float y = cr * sp * cy + sr * cp * sy;
+    float z = cr * cp * sy - sr * sp * cy;
+    float w = cr * cp * cy + sr * sp * sy;
+
+    Matrix3x4 result;
+    result.m00 = 1.0f - 2.0f * y * y - 2.0f * z * z;
+    result.m10 = 2.0f * x * y + 2.0f * w * z;
+    result.m20 = 2.0f * x * z - 2.0f * w * y;
+
+    result.m01 = 2.0f * x * y - 2.0f * w * z;
+    result.m11 = 1.0f - 2.0f * x * x - 2.0f * z * z;
+    result.m21 = 2.0f * y * z + 2.0f * w * x;
+
+    result.m02 = 2.0f * x * z + 2.0f * w * y;
+    result.m12 = 2.0f * y * z - 2.0f * w * x;
+    result.m22 = 1.0f - 2.0f * x * x - 2.0f * y * y;
+
+    result.m03 = value[0];
+    result.m13 = value[1];
+    result.m23 = value[2];
+    return result;
+}
+
+static void SetupTransforms(cl_entity_t *entity, studiohdr_t *header)
+{
+    // studio models have their pitch flipped
+    Vector3 angles = entity->angles;
+    angles.x = -angles.x;
+    s_rotationMatrix = ModelMatrix3x4(entity->origin, angles);
+
+    // FIXME: bind pose only, the host doesn't decode animations
+    const mstudiobone_t *bones = reinterpret_cast<mstudiobone_t *>(reinterpret_cast<byte *>(header) + header->boneindex);
+    int numbones = Q_min(header->numbones, MAXSTUDIOBONES);
+
+    for (int i = 0; i < numbones; i++)
+    {
+        Matrix3x4 local = BoneMatrix(bones[i].value);
+        int parent = bones[i].parent;
+
+        if (parent == -1)
+        {
+            s_boneTransform[i] = ConcatTransforms(s_rotationMatrix, local);
+        }
+        else
+        {
+            s_boneTransform[i] = ConcatTransforms(s_boneTransform[parent], local);
+        }
+
+        s_lightTransform[i] = s_boneTransform[i];
+    }
+}
+
+// the relevant bits of CStudioModelRenderer::StudioDrawModel, in the same order
+static int StudioDrawModel(int flags)
+{
+    cl_entity_t *entity = s_studio->GetCurrentEntity();
+    model_t *model = entity->model;
+
+    studiohdr_t *header = static_cast<studiohdr_t *>(s_studio->Mod_Extradata(model));
+    if (!header)
+    {
+        return 0;
+    }
+
+    s_studio->StudioSetHeader(header);
+    s_studio->SetRenderModel(model);
+
+    if ((flags & STUDIO_RENDER) && !s_studio->StudioCheckBBox())
+    {
+        return 0;
+    }
+
+    SetupTransforms(entity, header);
+
+    if (!(flags & STUDIO_RENDER))
+    {
+        return 1;
+    }
+
+    alight_t lighting;
+    Vector3 direction;
+    lighting.plightvec = &direction.x;
+
+    s_studio->StudioDynamicLight(entity, &lighting);
+    s_studio->StudioEntityLight(&lighting);
+    s_studio->StudioSetupLighting(&lighting);
+
+    s_studio->SetupRenderer(entity->curstate.rendermode);
+
+    for (int i = 0; i < header->numbodyparts; i++)
+    {
+        void *bodypart;
+        void *submodel;
+        s_studio->StudioSetupModel(i, &bodypart, &submodel);
+        s_studio->GL_SetRenderMode(entity->curstate.rendermode);
+        s_studio->StudioDrawPoints();
+    }
+
+    s_studio->RestoreRenderer();
+    return 1;
+}
+
+static int StudioDrawPlayer(int flags, entity_state_t *)
+{
+    return StudioDrawModel(flags);
+}
+
+void hostStudioInit(engine_studio_api_t *studio, r_studio_interface_t **pinterface)
+{
+    memset(studio, 0, sizeof(*studio));
+
+    studio->Mem_Calloc = Mem_Calloc;
+    studio->Cache_Check = Cache_Check;
+    studio->LoadCacheFile = LoadCacheFile;
+    studio->Mod_ForName = Mod_ForName;
+    studio->Mod_Extradata = Mod_Extradata;
+    studio->GetModelByIndex = hostModelByIndex;
+    studio->GetCurrentEntity = GetCurrentEntity;
+    studio->PlayerInfo = PlayerInfo;
+    studio->GetPlayerState = GetPlayerState;
+    studio->GetViewEntity = GetViewEntity;
+    studio->GetTimes = GetTimes;
+    studio->GetCvar = GetCvar;
+    studio->GetViewInfo = GetViewInfo;
+    studio->GetChromeSprite = GetChromeSprite;
+    studio->GetModelCounters = GetModelCounters;
+    studio->GetAliasScale = GetAliasScale;
+    studio->StudioGetBoneTransform = StudioGetBoneTransform;
+    studio->StudioGetLightTransform = StudioGetLightTransform;
+    studio->StudioGetAliasTransform = StudioGetAliasTransform;
+    studio->StudioGetRotationMatrix = StudioGetRotationMatrix;
+    studio->StudioSetupModel = StudioSetupModel;
+    studio->StudioCheckBBox = StudioCheckBBox;
+    studio->StudioDynamicLight = StudioDynamicLight;
+    studio->StudioEntityLight = StudioEntityLight;
+    studio->StudioSetupLighting = StudioSetupLighting;
+    studio->StudioDrawPoints = StudioNoop;
+    studio->StudioDrawHulls = StudioNoop;
+    studio->StudioDrawAbsBBox = StudioNoop;
+    studio->StudioDrawBones = StudioNoop;
+    studio->StudioSetupSkin = StudioSetupSkin;
+    studio->StudioSetRemapColors = StudioSetRemapColors;
+    studio->SetupPlayerModel = SetupPlayerModel;
+    studio->StudioClientEvents = StudioNoop;
+    studio->GetForceFaceFlags = GetForceFaceFlags;
+    studio->SetForceFaceFlags = SetForceFaceFlags;
+    studio->StudioSetHeader = StudioSetHeader;
+    studio->SetRenderModel = SetRenderModel;
+    studio->SetupRenderer = SetupRenderer;
+    studio->RestoreRenderer = StudioNoop;
+    studio->SetChromeOrigin = StudioNoop;
+    studio->IsHardware = IsHardware;
+    studio->GL_StudioDrawShadow = StudioNoop;
+    studio->GL_SetRenderMode = GL_SetRenderMode;
+    studio->StudioSetRenderamt = StudioSetRenderamt;
+    studio->StudioSetCullState = StudioSetCullState;
+    studio->StudioRenderShadow = StudioRenderShadow;
+
+    s_studio = studio;
+
+    s_interface.version = STUDIO_INTERFACE_VERSION;
+    s_interface.StudioDrawModel = StudioDrawModel;
+    s_interface.StudioDrawPlayer = StudioDrawPlayer;
+    *pinterface = &s_interface;
+}
+
+}
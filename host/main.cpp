@@ -0,0 +1,397 @@
+// render_host - runs the renderer against a map without the game
+//
+// usage: render_host -map de_dust2 [-game cstrike] [-basedir path] [-frames n]
+//                    [-width w] [-height h] [-prop models/foo.mdl -count n] [-budget ms]
+//        render_host -replay capture.gl3 [-loops n] [-game cstrike] [-basedir path]
+#include "stdafx.h"
+#include "host.h"
+#include "profile.h"
+#include "job.h"
+#include "levelprep.h"
+#include "dynamicbuffer.h"
+
+using namespace Render;
+
+// the client dll hooks the renderer expects to find, see loader.cpp
+extern "C" int HUD_AddEntity(int type, cl_entity_s *entity, const char *)
+{
+    return !Render::AddEntity(type, entity);
+}
+
+extern "C" void HUD_DrawNormalTriangles()
+{
+}
+
+extern "C" void HUD_DrawTransparentTriangles()
+{
+}
+
+// seconds per simulated frame, fixed so runs are repeatable
+constexpr double FrameTime = 0.01;
+
+// frames spent looking around each spawn point
+constexpr int FramesPerSpawn = 100;
+
+static cl_enginefunc_t s_engfuncs;
+static engine_studio_api_t s_studio;
+static r_studio_interface_t *s_pinterface;
+
+static void Usage()
+{
+    printf("usage: render_host -map <name> [-game <dir>] [-basedir <path>] [-frames <n>]\n"
+           "                   [-width <w>] [-height <h>] [-fov <degrees>] [-prop <model> -count <n>]\n"
+           "                   [-budget <ms>]\n"
+           "       render_host -replay <capture> [-loops <n>] [-game <dir>] [-basedir <path>]\n"
+           "                   [-width <w>] [-height <h>] [-budget <ms>]\n");
+    exit(1);
+}
+
+static void ParseArgs(int argc, char **argv)
+{
+    HostOptions &options = g_hostOptions;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+        if (!value)
+        {
+            Usage();
+        }
+
+        if (!strcmp(arg, "-map"))
+            options.mapName = value;
+        else if (!strcmp(arg, "-game"))
+            options.gameDir = value;
+        else if (!strcmp(arg, "-basedir"))
+            options.baseDir = value;
+        else if (!strcmp(arg, "-frames"))
+            options.frames = Q_max(atoi(value), 1);
+        else if (!strcmp(arg, "-width"))
+            options.width = Q_max(atoi(value), 1);
+        else if (!strcmp(arg, "-height"))
+            options.height = Q_max(atoi(value), 1);
+        else if (!strcmp(arg, "-fov"))
+            options.fov = Q_clamp(static_cast<float>(atof(value)), 10.0f, 150.0f);
+        else if (!strcmp(arg, "-prop"))
+            options.propModel = value;
+        else if (!strcmp(arg, "-count"))
+            options.propCount = Q_max(atoi(value), 0);
+        else if (!strcmp(arg, "-replay"))
+            options.replayPath = value;
+        else if (!strcmp(arg, "-loops"))
+            options.replayLoops = Q_max(atoi(value), 1);
+        else if (!strcmp(arg, "-budget"))
+            options.loadBudget = Q_max(static_cast<float>(atof(value)), 0.0f);
+        else
+            Usage();
+
+        i++;
+    }
+
+    if (!options.mapName && !options.replayPath)
+    {
+        Usage();
+    }
+}
+
+// slowly turn around at each spawn point in turn
+static void SetupView(int frame, model_t *world, ref_params_t &refParams)
+{
+    Vector3 origin = (world->mins + world->maxs) * 0.5f;
+    Vector3 angles{ 0, 0, 0 };
+
+    if (!g_hostSpawnPoints.empty())
+    {
+        const HostSpawnPoint &spawn = g_hostSpawnPoints[(frame / FramesPerSpawn) % g_hostSpawnPoints.size()];
+        origin = spawn.origin;
+        angles = spawn.angles;
+    }
+
+    angles.x = 0;
+    angles.y += (frame % FramesPerSpawn) * (360.0f / FramesPerSpawn);
+
+    Vector3 forward, right, up;
+    AngleVectors(angles, &forward, &right, &up);
+
+    memset(&refParams, 0, sizeof(refParams));
+    memcpy(refParams.vieworg, &origin, sizeof(refParams.vieworg));
+    memcpy(refParams.viewangles, &angles, sizeof(refParams.viewangles));
+    memcpy(refParams.forward, &forward, sizeof(refParams.forward));
+    memcpy(refParams.right, &right, sizeof(refParams.right));
+    memcpy(refParams.up, &up, sizeof(refParams.up));
+    refParams.time = static_cast<float>(g_hostClient.time);
+    refParams.frametime = static_cast<float>(FrameTime);
+    refParams.hardware = 1;
+    refParams.movevars = &g_hostClient.movevars;
+    refParams.viewport[2] = g_hostOptions.width;
+    refParams.viewport[3] = g_hostOptions.height;
+    refParams.max_entities = HostMaxEntities;
+}
+
+static double RunFrame(int frame, model_t *world)
+{
+    HostClientState &client = g_hostClient;
+    client.oldtime = client.time;
+    client.time += FrameTime;
+    client.framecount++;
+
+    ref_params_t refParams;
+    SetupView(frame, world, refParams);
+
+    Params params;
+    params.fov = g_hostOptions.fov;
+    params.viewModelFov = g_hostOptions.fov;
+    params.refParams = &refParams;
+
+    double start = hostAbsoluteTime();
+
+    BeginFrame();
+
+    // entity 0 is the world, the engine doesn't pass it through HUD_AddEntity either
+    for (int i = 1; i < client.numentities; i++)
+    {
+        AddEntity(ET_NORMAL, &client.entities[i]);
+    }
+
+    RenderScene(params);
+
+    // we want the time the gpu took too
+    glFinish();
+
+    return hostAbsoluteTime() - start;
+}
+
+// expects hostReplayRead to have been called for this frame
+static double RunReplayFrame()
+{
+    ref_params_t refParams;
+    Params params;
+    hostReplaySetupView(refParams, params);
+
+    double start = hostAbsoluteTime();
+
+    BeginFrame();
+    hostReplayAddEntities();
+    RenderScene(params);
+    glFinish();
+
+    return hostAbsoluteTime() - start;
+}
+
+// renderer's own cpu timings for the frame that just finished
+struct PassTimes
+{
+    std::vector<double> times[ProfilePassCount];
+
+    void Add()
+    {
+        for (int i = 0; i < ProfilePassCount; i++)
+        {
+            times[i].push_back(profilePassTime(static_cast<ProfilePass>(i)));
+        }
+    }
+};
+
+static void Report(const char *name, std::vector<double> &times)
+{
+    if (times.empty())
+    {
+        return;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    double total = 0;
+    for (double time : times)
+    {
+        total += time;
+    }
+
+    size_t p99 = Q_min(times.size() - 1, static_cast<size_t>(times.size() * 0.99));
+
+    printf("%-12s min %8.3f ms  avg %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+        name,
+        times.front() * 1000.0,
+        total / times.size() * 1000.0,
+        times[p99] * 1000.0,
+        times.back() * 1000.0);
+}
+
+static void ReportPasses(PassTimes &passes)
+{
+    printf("cpu time per pass:\n");
+
+    for (int i = 0; i < ProfilePassCount; i++)
+    {
+        Report(profilePassName(static_cast<ProfilePass>(i)), passes.times[i]);
+    }
+}
+
+static void ReportLevelPrep(double time, int frames)
+{
+    const LevelPrepStats &stats = levelPrepStats();
+
+    printf("level prep   %8.3f ms over %d frames, %d studio models\n", time * 1000.0, frames, stats.studioModels);
+
+    for (int i = 0; i < LevelPrepStageCount; i++)
+    {
+        printf("  %-12s %8.3f ms\n", levelPrepStageName(static_cast<LevelPrepStage>(i)), stats.times[i] * 1000.0);
+    }
+}
+
+// peak usage of the per frame buffers, for tuning their starting sizes
+static void ReportDynamicBuffers()
+{
+    printf("dynamic buffers:\n");
+
+    for (int i = 0; i < DynamicBufferCount; i++)
+    {
+        DynamicBufferType type = static_cast<DynamicBufferType>(i);
+        const DynamicBufferStats &stats = dynamicBufferStats(type);
+
+        printf("  %-12s %6d KB  peak %6d KB  %d frames overflowed\n", dynamicBufferName(type), stats.size / 1024, stats.peak / 1024, stats.overflowFrames);
+    }
+}
+
+static void RunReplay()
+{
+    const HostOptions &options = g_hostOptions;
+
+    double loadStart = hostAbsoluteTime();
+    model_t *world = hostReplayOpen(options.replayPath);
+    double loadEnd = hostAbsoluteTime();
+
+    if (!hostReplayRead())
+    {
+        platformError("%s has no frames", options.replayPath);
+    }
+
+    printf("%s: replaying %s\n", options.replayPath, world->name);
+
+    // the first frame picks up the level change, the same frame is run until the prep is done
+    double prepTime = 0;
+    int prepFrames = 0;
+
+    do
+    {
+        prepTime += RunReplayFrame();
+        prepFrames++;
+    } while (levelPrepActive());
+
+    std::vector<double> frameTimes;
+    PassTimes passes;
+
+    // the first frame of the first loop has been run already
+    int warmup = options.warmupFrames;
+
+    for (int loop = 0; loop < options.replayLoops; loop++)
+    {
+        if (loop > 0)
+        {
+            hostReplayRewind();
+        }
+
+        while (hostReplayRead())
+        {
+            double time = RunReplayFrame();
+
+            if (warmup > 0)
+            {
+                warmup--;
+                continue;
+            }
+
+            frameTimes.push_back(time);
+            passes.Add();
+        }
+    }
+
+    printf("level load   %8.3f ms\n", (loadEnd - loadStart) * 1000.0);
+    ReportLevelPrep(prepTime, prepFrames);
+    Report("frame", frameTimes);
+    ReportPasses(passes);
+    ReportDynamicBuffers();
+}
+
+int main(int argc, char **argv)
+{
+    ParseArgs(argc, argv);
+
+    const HostOptions &options = g_hostOptions;
+
+    // same order the engine and client dll do it in
+    hostEngineInit(&s_engfuncs);
+    ModifyEngfuncs(&s_engfuncs);
+
+    hostContextInit(options.width, options.height);
+
+    hostStudioInit(&s_studio, &s_pinterface);
+    Initialize(&s_studio, &s_pinterface);
+
+    if (options.loadBudget >= 0)
+    {
+        g_engfuncs.pfnGetCvarPointer("gl3_load_budget")->value = options.loadBudget;
+    }
+
+    if (options.replayPath)
+    {
+        RunReplay();
+        jobShutdown();
+        hostContextShutdown();
+        return 0;
+    }
+
+    char worldPath[128];
+    snprintf(worldPath, sizeof(worldPath), "maps/%s.bsp", options.mapName);
+
+    double loadStart = hostAbsoluteTime();
+
+    model_t *world = hostLoadWorld(worldPath);
+    hostSpawnEntities(world);
+
+    double loadEnd = hostAbsoluteTime();
+
+    printf("%s: %d models, %d entities, %d spawn points\n",
+        options.mapName,
+        world->numsubmodels,
+        g_hostClient.numentities,
+        static_cast<int>(g_hostSpawnPoints.size()));
+
+    // the first frame picks up the level change, the renderer's level prep is spread
+    // over frames by gl3_load_budget and the engine would be drawing in the meantime
+    double prepTime = 0;
+    int prepFrames = 0;
+
+    do
+    {
+        prepTime += RunFrame(0, world);
+        prepFrames++;
+    } while (levelPrepActive());
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(options.frames);
+
+    PassTimes passes;
+
+    for (int i = 1; i <= options.warmupFrames + options.frames; i++)
+    {
+        double time = RunFrame(i, world);
+        if (i > options.warmupFrames)
+        {
+            frameTimes.push_back(time);
+            passes.Add();
+        }
+    }
+
+    printf("level load   %8.3f ms\n", (loadEnd - loadStart) * 1000.0);
+    ReportLevelPrep(prepTime, prepFrames);
+    Report("frame", frameTimes);
+    ReportPasses(passes);
+    ReportDynamicBuffers();
+
+    jobShutdown();
+    hostContextShutdown();
+    return 0;
+}
@@ -9,6 +9,10 @@
 #include "skybox.h"
 #include "water.h"
 #include "internal.h"
+#include "profile.h"
+#include "job.h"
+#include "levelprep.h"
+#include "worldcache.h"
 
 namespace Render
 {
@@ -66,9 +70,25 @@ gl3_worldmodel_t g_worldmodel_static;
 #define MAX_SURFACES 32768
 static uint32_t s_surfaceVisBits[MAX_SURFACES / 32];
 
-static int s_indexCount;
-static int s_indexLastDraw;
-static BufferSpanT<uint16_t> s_indexSpan;
+// world surfaces the last traversal found, replayed as long as the view stays put
+struct VisibleSurfaceCache
+{
+    bool valid;
+    int pvsFrame;
+    int origin[3]; // in 1/8 units
+    Vector3 angles;
+    Matrix4 projectionMatrix;
+
+    int surfaceCount;
+    int surfaces[MAX_SURFACES]; // in traversal order
+};
+
+static VisibleSurfaceCache s_visCache;
+
+// visible index ranges in the static index buffer for the texture being drawn
+static int s_drawCount;
+static GLsizei s_drawCounts[MAX_SURFACES];
+static GLsizei s_drawOffsets[MAX_SURFACES];
 
 // this is so dumb
 static bool s_hasWaterSurfaces = false;
@@ -80,88 +100,283 @@ void brushInit()
     shaderRegister(s_shaderUnlit, "unlit", s_vertexAttribs, s_uniforms);
 }
 
-static void BuildLightmapAndVertexBuffer(model_t *model)
+// cpu side of the world buffers, built on a worker and uploaded on the main thread
+struct WorldBuild
 {
-    TempMemoryScope temp;
+    model_t *engineModel;
+    WorldCacheFile cacheFile;
+    bool fromCache;
+
+    std::vector<gl3_brushvert_t> vertices;
+    std::vector<Color32> lightmap;
+    std::vector<uint16_t> indices;
+    double buildTime;
+};
+
+static WorldBuild s_worldBuild;
+
+// triangulates every surface once, grouped by texture so visible neighbours can be merged into one range
+static void BuildIndexBuffer(std::vector<uint16_t> &indices)
+{
+    int numtextures = g_worldmodel->numtextures;
+    std::vector<int> textureFirstIndex(numtextures + 1);
+
+    for (int i = 0; i < g_worldmodel->numsurfaces; i++)
+    {
+        gl3_surface_t &surface = g_worldmodel->surfaces[i];
+        if (surface.numverts >= 3)
+        {
+            int textureIndex = static_cast<int>(surface.texture - g_worldmodel->textures);
+            textureFirstIndex[textureIndex + 1] += (surface.numverts - 2) * 3;
+        }
+    }
 
-    int num_verts;
-    gl3_brushvert_t *vertex_buffer = internalBuildVertexBuffer(model, g_worldmodel, num_verts, temp);
+    for (int i = 0; i < numtextures; i++)
+    {
+        textureFirstIndex[i + 1] += textureFirstIndex[i];
+    }
 
-    // lightmap building modifies the lightmap texcoords, so do it here before the vertex data gets uploaded
-    g_worldmodel->lightmap_texture = lightmapCreateAtlas(g_worldmodel, vertex_buffer);
+    int numindices = textureFirstIndex[numtextures];
+    indices.assign(numindices, 0);
+
+    for (int i = 0; i < g_worldmodel->numsurfaces; i++)
+    {
+        gl3_surface_t &surface = g_worldmodel->surfaces[i];
+        if (surface.numverts < 3)
+        {
+            continue;
+        }
+
+        int textureIndex = static_cast<int>(surface.texture - g_worldmodel->textures);
+        surface.firstindex = textureFirstIndex[textureIndex];
+
+        int numtris = surface.numverts - 2;
+        textureFirstIndex[textureIndex] += numtris * 3;
+
+        uint16_t *dest = &indices[surface.firstindex];
+        uint16_t firstvert = static_cast<uint16_t>(surface.firstvert);
+        uint16_t current = firstvert + 1;
+
+        for (int j = 0; j < numtris; j++)
+        {
+            dest[0] = firstvert;
+            dest[1] = current;
+            dest[2] = current + 1;
+            current++;
+            dest += 3;
+        }
+    }
+}
+
+static void FreeWorldBsp(void *)
+{
+    worldCacheFreeBsp(s_worldBuild.cacheFile);
+}
+
+static void UploadWorldVertices(void *)
+{
+    std::vector<gl3_brushvert_t> &vertices = s_worldBuild.vertices;
+
+    if (s_worldBuild.fromCache)
+    {
+        g_engfuncs.Con_Printf("Loaded %s from %s\n", s_worldBuild.engineModel->name, s_worldBuild.cacheFile.path);
+    }
 
     glGenBuffers(1, &g_worldmodel->vertex_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, g_worldmodel->vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(*vertex_buffer) * num_verts, vertex_buffer, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+    std::vector<gl3_brushvert_t>().swap(vertices);
 }
 
-void brushLoadWorldModel(model_t *engineModel)
+static void UploadWorldLightmap(void *)
 {
-    memset(g_worldmodel, 0, sizeof(*g_worldmodel));
-    internalLoadBrushModel(engineModel, g_worldmodel);
-    BuildLightmapAndVertexBuffer(engineModel);
+    g_worldmodel->lightmap_texture = lightmapUploadAtlas(g_worldmodel, s_worldBuild.lightmap);
+    std::vector<Color32>().swap(s_worldBuild.lightmap);
 }
 
-void brushFreeWorldModel()
+static void UploadWorldIndices(void *)
 {
-    // if these are zero, opengl will do nothing
-    glDeleteBuffers(1, &g_worldmodel->vertex_buffer);
-    glDeleteTextures(1, &g_worldmodel->lightmap_texture);
+    std::vector<uint16_t> &indices = s_worldBuild.indices;
+
+    // uploaded through the array buffer binding so we don't touch vertex array state
+    if (!indices.empty())
+    {
+        glGenBuffers(1, &g_worldmodel->index_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, g_worldmodel->index_buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
+    }
+
+    std::vector<uint16_t>().swap(indices);
+
+    // last one queued, the worker's time is final by now
+    levelPrepAddTime(LevelPrepWorldBuild, s_worldBuild.buildTime);
 }
 
-static void MapIndexBuffer(int maxIndices)
+// the counter passed to brushLoadWorldModel
+static JobCounter *s_worldCounter;
+
+static void BuildWorldJob(void *, int, int)
 {
-    GL3_ASSERT(!s_indexCount);
-    GL3_ASSERT(!s_indexLastDraw);
+    double start = profileSeconds();
+
+    WorldCacheFile &cacheFile = s_worldBuild.cacheFile;
+    uint64_t hash = worldCacheHash(cacheFile);
+
+    // the engine has to free it
+    jobQueueMainThread(FreeWorldBsp, nullptr, s_worldCounter);
 
-    s_indexSpan = dynamicIndexDataBegin<uint16_t>(maxIndices);
+    s_worldBuild.fromCache = worldCacheLoad(cacheFile, hash, g_worldmodel, s_worldBuild.vertices, s_worldBuild.lightmap);
 
-    commandBindIndexBuffer(s_indexSpan.buffer);
+    if (!s_worldBuild.fromCache)
+    {
+        internalBuildVertexBuffer(s_worldBuild.engineModel, g_worldmodel, s_worldBuild.vertices);
+
+        // lightmap building modifies the lightmap texcoords, so do it here before the vertex data gets uploaded
+        lightmapBuildAtlas(g_worldmodel, s_worldBuild.vertices.data(), s_worldBuild.lightmap);
+
+        worldCacheSave(cacheFile, hash, g_worldmodel, s_worldBuild.vertices, s_worldBuild.lightmap);
+    }
+
+    BuildIndexBuffer(s_worldBuild.indices);
+
+    s_worldBuild.buildTime = profileSeconds() - start;
+
+    // three uploads so the frame budget can split them up
+    jobQueueMainThread(UploadWorldVertices, nullptr, s_worldCounter);
+    jobQueueMainThread(UploadWorldLightmap, nullptr, s_worldCounter);
+    jobQueueMainThread(UploadWorldIndices, nullptr, s_worldCounter);
 }
 
-static void UnmapIndexBuffer()
+static int FlattenNode(gl3_node_t *node, int depth)
 {
-    dynamicIndexDataEnd<uint16_t>(s_indexCount);
-    s_indexCount = 0;
-    s_indexLastDraw = 0;
+    if (!node->has_visible_surfaces)
+    {
+        return -1;
+    }
+
+    int index = g_worldmodel->numflatnodes++;
+    node->flatnode = index;
+    g_worldmodel->flatdepth = Q_max(g_worldmodel->flatdepth, depth);
+
+    gl3_flatnode_t &flat = g_worldmodel->flatnodes[index];
+    flat.center = node->center;
+    flat.extents = node->extents;
+
+    if (node->contents < 0)
+    {
+        flat.leaf = static_cast<int>(reinterpret_cast<gl3_leaf_t *>(node) - g_worldmodel->leafs);
+        flat.children[0] = -1;
+        flat.children[1] = -1;
+        return index;
+    }
+
+    flat.leaf = -1;
+    flat.normal = node->plane->normal;
+    flat.dist = node->plane->dist;
+    flat.firstsurface = node->firstsurface;
+    flat.numsurfaces = node->numsurfaces;
+
+    int front = FlattenNode(node->children[0], depth + 1);
+    int back = FlattenNode(node->children[1], depth + 1);
+
+    g_worldmodel->flatnodes[index].children[0] = front;
+    g_worldmodel->flatnodes[index].children[1] = back;
+    return index;
 }
 
-static void DrawIndexBuffer(int baseVertex)
+static void BuildFlatNodes()
 {
-    int indexCount = s_indexCount - s_indexLastDraw;
-    if (!indexCount)
+    for (int i = 0; i < g_worldmodel->numnodes; i++)
     {
-        return;
+        g_worldmodel->nodes[i].flatnode = -1;
     }
 
-    GL3_ASSERT(indexCount > 0);
+    for (int i = 0; i < g_worldmodel->numleafs_total; i++)
+    {
+        g_worldmodel->leafs[i].flatnode = -1;
+    }
+
+    g_worldmodel->flatnodes = memoryLevelAlloc<gl3_flatnode_t>(g_worldmodel->numnodes + g_worldmodel->numleafs_total);
+    g_worldmodel->numflatnodes = 0;
+    g_worldmodel->flatdepth = 0;
+
+    FlattenNode(g_worldmodel->nodes, 1);
+}
+
+void brushLoadWorldModel(model_t *engineModel, JobCounter &counter)
+{
+    s_visCache.valid = false;
+
+    double start = profileSeconds();
 
-    int byteOffset = s_indexSpan.byteOffset + (s_indexLastDraw * sizeof(uint16_t));
+    // engine calls and level allocations stay on this thread
+    memset(g_worldmodel, 0, sizeof(*g_worldmodel));
+    internalLoadBrushModel(engineModel, g_worldmodel);
+    BuildFlatNodes();
 
-    commandDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, byteOffset, baseVertex);
+    // the bsp gets hashed on the worker
+    worldCacheOpen(s_worldBuild.cacheFile, engineModel);
 
-    s_indexLastDraw = s_indexCount;
+    levelPrepAddTime(LevelPrepConvert, profileSeconds() - start);
+
+    s_worldBuild.engineModel = engineModel;
+    s_worldCounter = &counter;
+    jobAdd(&counter, BuildWorldJob, nullptr);
 }
 
-static void AddSurfaceToIndexBuffer(gl3_surface_t *surface)
+void brushFreeWorldModel()
 {
-    // can overflow due to decal indices, but unlikely...
-    int numtris = surface->numverts - 2;
+    commandFreeBuffer(g_worldmodel->vertex_buffer);
+    commandFreeBuffer(g_worldmodel->index_buffer);
 
-    uint16_t *dest = &s_indexSpan.data[s_indexCount];
-    s_indexCount += (numtris * 3);
+    // if these are zero, opengl will do nothing
+    glDeleteBuffers(1, &g_worldmodel->vertex_buffer);
+    glDeleteBuffers(1, &g_worldmodel->index_buffer);
+    glDeleteTextures(1, &g_worldmodel->lightmap_texture);
+}
 
-    uint16_t firstvert = static_cast<uint16_t>(surface->firstvert);
-    uint16_t current = firstvert + 1;
+static void AddSurfaceToDraw(const gl3_surface_t *surface)
+{
+    GL3_ASSERT(surface->numverts >= 3);
+
+    GLsizei count = (surface->numverts - 2) * 3;
+    GLsizei offset = surface->firstindex * sizeof(uint16_t);
 
-    for (int i = 0; i < numtris; i++)
+    // extend the last range if this surface follows it in the index buffer
+    if (s_drawCount)
     {
-        dest[0] = firstvert;
-        dest[1] = current;
-        dest[2] = current + 1;
-        current++;
-        dest += 3;
+        GLsizei &lastCount = s_drawCounts[s_drawCount - 1];
+        if (s_drawOffsets[s_drawCount - 1] + lastCount * static_cast<GLsizei>(sizeof(uint16_t)) == offset)
+        {
+            lastCount += count;
+            return;
+        }
     }
+
+    GL3_ASSERT(s_drawCount < MAX_SURFACES);
+    s_drawCounts[s_drawCount] = count;
+    s_drawOffsets[s_drawCount] = offset;
+    s_drawCount++;
+}
+
+static void DrawSurfaceRanges(int baseVertex)
+{
+    if (!s_drawCount)
+    {
+        return;
+    }
+
+    if (s_drawCount == 1)
+    {
+        commandDrawElementsBaseVertex(GL_TRIANGLES, s_drawCounts[0], GL_UNSIGNED_SHORT, s_drawOffsets[0], baseVertex);
+    }
+    else
+    {
+        commandMultiDrawElementsBaseVertex(GL_TRIANGLES, s_drawCounts, GL_UNSIGNED_SHORT, s_drawOffsets, s_drawCount, baseVertex);
+    }
+
+    s_drawCount = 0;
 }
 
 static gl3_texture_t *TextureAnimation(cl_entity_t *entity, gl3_texture_t *texture)
@@ -203,79 +418,181 @@ static void AddSurface_NoDecals(gl3_surface_t *surface)
     texture->drawsurfaces[texture->numdrawsurfaces++] = surface;
 }
 
-void TraverseTree_r(gl3_node_t *node)
+// all four frustum planes
+constexpr int ClipMaskAll = (1 << 4) - 1;
+
+struct TraverseItem
 {
-    if (node->pvsframe != g_pvsFrame)
-    {
-        return;
-    }
+    int node;
+    int clipMask; // -1 to add the node's own surfaces
+};
+
+static void AddLeafSurfaces(const gl3_flatnode_t &node)
+{
+    gl3_leaf_t *leaf = &g_worldmodel->leafs[node.leaf];
+    GL3_ASSERT(leaf->has_visible_surfaces);
 
-    // shouldn't be visiting nodes with no visible surfaces, and solid leaves are not drawn
-    GL3_ASSERT(node->has_visible_surfaces);
-    GL3_ASSERT(node->contents != CONTENTS_SOLID);
+    int *begin = leaf->firstmarksurface;
+    int *end = begin + leaf->nummarksurfaces;
 
-    if (g_state.viewFrustum.CullBox(node->center, node->extents))
+    for (int *mark = begin; mark < end; mark++)
     {
-        return;
+        int i = *mark;
+        s_surfaceVisBits[i >> 5] |= (1 << (i & 31));
     }
+}
 
-    if (node->contents < 0)
-    {
-        gl3_leaf_t *leaf = (gl3_leaf_t *)node;
-        GL3_ASSERT(leaf->has_visible_surfaces);
+static void AddNodeSurfaces(const gl3_flatnode_t &node)
+{
+    int side = Dot(node.normal, g_state.viewOrigin) < node.dist;
+    int sideFlag = side ? SURF_BACK : 0;
 
-        int *begin = leaf->firstmarksurface;
-        int *end = begin + leaf->nummarksurfaces;
+    int begin = node.firstsurface;
+    int end = begin + node.numsurfaces;
+
+    for (int i = begin; i < end; i++)
+    {
+        if (!(s_surfaceVisBits[i >> 5] & (1 << (i & 31))))
+        {
+            continue;
+        }
 
-        for (int *mark = begin; mark < end; mark++)
+        gl3_surface_t *surface = &g_worldmodel->surfaces[i];
+        if ((surface->flags & SURF_BACK) != sideFlag)
         {
-            int i = *mark;
-            s_surfaceVisBits[i >> 5] |= (1 << (i & 31));
+            continue;
         }
 
+        AddSurface_NoDecals(surface);
+        internalSurfaceDecals(g_worldmodel, i);
+
+        s_visCache.surfaces[s_visCache.surfaceCount++] = i;
+    }
+}
+
+// same order as a recursive front to back walk: front child, the node's surfaces, back child
+static void TraverseTree()
+{
+    if (!g_worldmodel->numflatnodes)
+    {
         return;
     }
 
-    gl3_plane_t *plane = node->plane;
-    int side = Dot(plane->normal, g_state.viewOrigin) < plane->dist;
-    int sideFlag = side ? SURF_BACK : 0;
+    const gl3_flatnode_t *nodes = g_worldmodel->flatnodes;
 
-    TraverseTree_r(node->children[side]);
+    // each level can leave a back child and the node's surfaces behind
+    TempMemoryScope scope;
+    TraverseItem *stack = scope.Alloc<TraverseItem>(g_worldmodel->flatdepth * 2 + 1);
+    int stackSize = 0;
 
-    int begin = node->firstsurface;
-    int end = begin + node->numsurfaces;
+    stack[stackSize++] = { 0, ClipMaskAll };
 
-    for (int i = begin; i < end; i++)
+    while (stackSize)
     {
-        if (!(s_surfaceVisBits[i >> 5] & (1 << (i & 31))))
+        TraverseItem item = stack[--stackSize];
+        const gl3_flatnode_t &node = nodes[item.node];
+
+        if (item.clipMask == -1)
         {
+            AddNodeSurfaces(node);
             continue;
         }
 
-        gl3_surface_t *surface = &g_worldmodel->surfaces[i];
-        if ((surface->flags & SURF_BACK) != sideFlag)
+        if (node.pvsframe != g_pvsFrame)
         {
             continue;
         }
 
-        AddSurface_NoDecals(surface);
-        internalSurfaceDecals(g_worldmodel, i);
+        // children of nodes fully inside a plane don't need to test it again
+        int clipMask = item.clipMask;
+        if (clipMask)
+        {
+            clipMask = g_state.viewFrustum.ClipBox(node.center, node.extents, clipMask);
+            if (clipMask == -1)
+            {
+                continue;
+            }
+        }
+
+        if (node.leaf != -1)
+        {
+            AddLeafSurfaces(node);
+            continue;
+        }
+
+        int side = Dot(node.normal, g_state.viewOrigin) < node.dist;
+        int front = node.children[side];
+        int back = node.children[!side];
+
+        if (back != -1)
+        {
+            stack[stackSize++] = { back, clipMask };
+        }
+
+        stack[stackSize++] = { item.node, -1 };
+
+        if (front != -1)
+        {
+            stack[stackSize++] = { front, clipMask };
+        }
     }
+}
 
-    TraverseTree_r(node->children[!side]);
+// moving less than the quantization step can only change which side of a plane
+// we're on when the view is right up against it, close enough
+static bool VisibleSurfaceCacheHit()
+{
+    VisibleSurfaceCache &cache = s_visCache;
+
+    int origin[3];
+    for (int i = 0; i < 3; i++)
+    {
+        origin[i] = static_cast<int>(floorf(g_state.viewOrigin.Get(i) * 8.0f));
+    }
+
+    bool hit = cache.valid
+        && cache.pvsFrame == g_pvsFrame
+        && !memcmp(cache.origin, origin, sizeof(origin))
+        && !memcmp(&cache.angles, &g_state.viewAngles, sizeof(cache.angles))
+        && !memcmp(&cache.projectionMatrix, &g_state.projectionMatrix, sizeof(cache.projectionMatrix));
+
+    if (!hit)
+    {
+        cache.valid = true;
+        cache.pvsFrame = g_pvsFrame;
+        memcpy(cache.origin, origin, sizeof(origin));
+        cache.angles = g_state.viewAngles;
+        cache.projectionMatrix = g_state.projectionMatrix;
+        cache.surfaceCount = 0;
+    }
+
+    return hit;
 }
 
 static void LinkLeaves()
 {
     pvsUpdate(g_state.viewOrigin);
 
+    GL3_ASSERT(!s_multiStyle);
+
+    if (VisibleSurfaceCacheHit())
+    {
+        // decals still get picked up every frame since they can come and go on their own
+        for (int j = 0; j < s_visCache.surfaceCount; j++)
+        {
+            int i = s_visCache.surfaces[j];
+            AddSurface_NoDecals(&g_worldmodel->surfaces[i]);
+            internalSurfaceDecals(g_worldmodel, i);
+        }
+
+        return;
+    }
+
     // would rather do this than store g_state.frameCount in gl3_surface_t
     GL3_ASSERT(g_worldmodel->numsurfaces < MAX_SURFACES);
     memset(s_surfaceVisBits, 0, (g_worldmodel->numsurfaces + 7) / 8);
 
-    //int clipFlags = (1 << 4) - 1;
-    GL3_ASSERT(!s_multiStyle);
-    TraverseTree_r(g_worldmodel->nodes);
+    TraverseTree();
 }
 
 static float ScrollAmount(cl_entity_t *entity, gl3_texture_t *texture)
@@ -309,8 +626,8 @@ static float ScrollAmount(cl_entity_t *entity, gl3_texture_t *texture)
 
 static void DrawSurfaces(cl_entity_t *entity, GLint scrollUniformLocation, GLuint textureOverride)
 {
-    // index buffer is dynamic
     commandBindVertexBuffer(g_worldmodel->vertex_buffer, g_brushVertexFormat);
+    commandBindIndexBuffer(g_worldmodel->index_buffer);
 
     float prevScroll = 0;
     commandUniform1f(scrollUniformLocation, prevScroll);
@@ -345,7 +662,6 @@ static void DrawSurfaces(cl_entity_t *entity, GLint scrollUniformLocation, GLuin
         float scroll = ScrollAmount(entity, texture);
         if (scroll != prevScroll)
         {
-            DrawIndexBuffer(texture->basevertex);
             prevScroll = scroll;
             commandUniform1f(scrollUniformLocation, prevScroll);
         }
@@ -359,10 +675,10 @@ static void DrawSurfaces(cl_entity_t *entity, GLint scrollUniformLocation, GLuin
         for (int j = 0; j < texture->numdrawsurfaces; j++)
         {
             gl3_surface_t *surface = texture->drawsurfaces[j];
-            AddSurfaceToIndexBuffer(surface);
+            AddSurfaceToDraw(surface);
         }
 
-        DrawIndexBuffer(texture->basevertex);
+        DrawSurfaceRanges(texture->basevertex);
 
         texture->numdrawsurfaces = 0;
     }
@@ -370,8 +686,9 @@ static void DrawSurfaces(cl_entity_t *entity, GLint scrollUniformLocation, GLuin
 
 static void DrawWaterSurfaces(cl_entity_t *entity, GLuint textureOverride)
 {
-    // restore the vertex buffer since drawing decals might have changed it
+    // restore the buffers since drawing decals might have changed them
     commandBindVertexBuffer(g_worldmodel->vertex_buffer, g_brushVertexFormat);
+    commandBindIndexBuffer(g_worldmodel->index_buffer);
 
     if (textureOverride)
     {
@@ -407,10 +724,10 @@ static void DrawWaterSurfaces(cl_entity_t *entity, GLuint textureOverride)
         for (int j = 0; j < texture->numdrawsurfaces; j++)
         {
             gl3_surface_t *surface = texture->drawsurfaces[j];
-            AddSurfaceToIndexBuffer(surface);
+            AddSurfaceToDraw(surface);
         }
 
-        DrawIndexBuffer(texture->basevertex);
+        DrawSurfaceRanges(texture->basevertex);
 
         texture->numdrawsurfaces = 0;
     }
@@ -432,8 +749,9 @@ static void DrawSkySurfaces()
         return;
     }
 
-    // restore the vertex buffer since drawing decals might have changed it
+    // restore the buffers since drawing decals might have changed them
     commandBindVertexBuffer(g_worldmodel->vertex_buffer, g_brushVertexFormat);
+    commandBindIndexBuffer(g_worldmodel->index_buffer);
 
     for (int i = 0; i < g_worldmodel->numtextures; i++)
     {
@@ -451,10 +769,10 @@ static void DrawSkySurfaces()
         for (int j = 0; j < texture->numdrawsurfaces; j++)
         {
             gl3_surface_t *surface = texture->drawsurfaces[j];
-            AddSurfaceToIndexBuffer(surface);
+            AddSurfaceToDraw(surface);
         }
 
-        DrawIndexBuffer(texture->basevertex);
+        DrawSurfaceRanges(texture->basevertex);
 
         texture->numdrawsurfaces = 0;
     }
@@ -489,10 +807,8 @@ static void DrawAllSurfaces(cl_entity_t *entity, bool lightmapped, bool alphaTes
 
     DrawSurfaces(entity, shader->u_scroll, textureOverride);
 
-    // decal indices are stuffed into the same index buffer
-    GL3_ASSERT(s_indexCount == s_indexLastDraw);
-    s_indexCount = decalDrawAll(s_indexSpan.data, s_indexSpan.byteOffset, s_indexCount);
-    s_indexLastDraw = s_indexCount;
+    // decals are the only thing left that needs dynamic indices
+    decalDrawAll();
 
     if (s_hasWaterSurfaces)
     {
@@ -507,7 +823,7 @@ static void DrawAllSurfaces(cl_entity_t *entity, bool lightmapped, bool alphaTes
     }
 }
 
-static void BrushModelCenterExtents(cl_entity_t *entity, Vector3 &center, Vector3 &extents)
+void brushEntityBounds(cl_entity_t *entity, Vector3 &center, Vector3 &extents)
 {
     model_t *model = entity->model;
 
@@ -538,13 +854,6 @@ static float BrushModelMinz(cl_entity_t *entity)
     }
 }
 
-static bool CullBrushModel(cl_entity_t *entity)
-{
-    Vector3 center, extents;
-    BrushModelCenterExtents(entity, center, extents);
-    return g_state.viewFrustum.CullBox(center, extents);
-}
-
 static void LinkAndDrawBrushModel(cl_entity_t *entity, bool lightmapped, bool alphaTest)
 {
     // FIXME: this is assuming all brush models are inline models
@@ -618,7 +927,10 @@ static void LinkAndDrawWorldModel()
     SetupConstantBuffer(nullptr, { 1, 1, 1, 1 });
 
     // setup texturechains, water chain and decals
-    LinkLeaves();
+    {
+        ProfileScope scope{ ProfileLinkLeaves };
+        LinkLeaves();
+    }
 
     // no associated entity, lightmapped, not alpha tested, no texture override
     DrawAllSurfaces(nullptr, true, false, 0);
@@ -633,20 +945,13 @@ void brushDrawSolids(
     // lightmap only used for solid brush entities
     commandBindTexture(1, GL_TEXTURE_2D, g_worldmodel->lightmap_texture);
 
-    MapIndexBuffer(g_worldmodel->max_index_count);
-
     // draw fully opaque stuff
     {
         LinkAndDrawWorldModel();
 
+        // entities have been frustum culled by entitySortQueue
         for (int i = 0; i < entityCount; i++)
         {
-            // FIXME: could cull earlier...
-            if (CullBrushModel(entities[i]))
-            {
-                continue;
-            }
-
             SetupConstantBuffer(entities[i], { 1, 1, 1, 1 });
             LinkAndDrawBrushModel(entities[i], true, false);
         }
@@ -656,18 +961,10 @@ void brushDrawSolids(
     {
         for (int i = 0; i < alphaEntityCount; i++)
         {
-            // FIXME: could cull earlier...
-            if (CullBrushModel(alphaEntities[i]))
-            {
-                continue;
-            }
-
             SetupConstantBuffer(alphaEntities[i], { 1, 1, 1, 1 });
             LinkAndDrawBrushModel(alphaEntities[i], true, true);
         }
     }
-
-    UnmapIndexBuffer();
 }
 
 // for translucent brush entities: determines render color, sets blending
@@ -716,22 +1013,12 @@ static void SetBlendingAndGetColor(cl_entity_t *entity, Vector4 &renderColor, fl
 
 void brushDrawTranslucent(cl_entity_t *entity, float blend)
 {
-    // FIXME: could cull earlier...
-    if (CullBrushModel(entity))
-    {
-        return;
-    }
-
     Vector4 renderColor;
     SetBlendingAndGetColor(entity, renderColor, blend);
     SetupConstantBuffer(entity, renderColor);
 
-    MapIndexBuffer(g_worldmodel->max_submodel_index_count);
-
     // not lightmapped or alpha tested
     LinkAndDrawBrushModel(entity, false, false);
-
-    UnmapIndexBuffer();
 }
 
 void brushEndTranslucents()
@@ -24,6 +24,7 @@ enum
 };
 
 struct gl3_surface_t;
+struct JobCounter;
 
 struct gl3_plane_t
 {
@@ -59,6 +60,7 @@ struct gl3_node_t
     Vector3 extents;
     gl3_node_t *parent;
     bool has_visible_surfaces;
+    int flatnode; // index to gl3_worldmodel_t::flatnodes, -1 if not in there
 
     gl3_plane_t *plane;
     gl3_node_t *children[2];
@@ -75,12 +77,30 @@ struct gl3_leaf_t
     Vector3 extents;
     gl3_node_t *parent;
     bool has_visible_surfaces;
+    int flatnode; // index to gl3_worldmodel_t::flatnodes, -1 if not in there
 
     byte *compressed_vis;
     int *firstmarksurface;
     int nummarksurfaces;
 };
 
+// the visible parts of the world tree laid out depth first for the surface walk,
+// the front child of a node is the next element. sized to a cache line
+struct alignas(16) gl3_flatnode_t
+{
+    Vector3 center;
+    int pvsframe;
+    Vector3 extents;
+    int leaf; // index to gl3_worldmodel_t::leafs, -1 for nodes
+
+    // node only from here on
+    Vector3 normal;
+    float dist;
+    int children[2]; // -1 if the child has nothing to draw
+    int firstsurface;
+    int numsurfaces;
+};
+
 struct gl3_surface_t
 {
     int flags;
@@ -88,6 +108,7 @@ struct gl3_surface_t
 
     int firstvert;
     int numverts;
+    int firstindex; // in gl3_worldmodel_t::index_buffer
 
     gl3_plane_t *plane;
 };
@@ -122,13 +143,27 @@ inline uint16_t PACK_U16(float flt)
 
 struct gl3_brushvert_t
 {
-    // lightmap width is stored in a_position.w
-    Vector4 position;
+    Vector3 position;
     Vector2 texCoord;
     uint16_t lightmapTexCoord[2];
+
+    // the top two bits of each hold two bits of the lightmap width, see brushPackLightmapWidth
     uint8_t styles[4];
 };
 
+// styles are below MAX_LIGHTSTYLES (64) so each has two bits to spare, which fits the
+// surface's lightmap width in luxels. the shader needs it to find the other styles in the atlas
+inline void brushPackLightmapWidth(uint8_t (&styles)[4], int width)
+{
+    static_assert(MAX_LIGHTSTYLES == 64, "styles no longer have bits to spare");
+    GL3_ASSERT(width >= 0 && width < 256);
+
+    for (int i = 0; i < 4; i++)
+    {
+        styles[i] = static_cast<uint8_t>((styles[i] & 63) | (((width >> (i * 2)) & 3) << 6));
+    }
+}
+
 struct gl3_worldmodel_t
 {
     // engine equivalent of this model
@@ -145,6 +180,10 @@ struct gl3_worldmodel_t
     int numnodes;
     gl3_node_t *nodes;
 
+    int numflatnodes;
+    gl3_flatnode_t *flatnodes;
+    int flatdepth; // deepest path through flatnodes
+
     int numsurfaces;
     gl3_surface_t *surfaces;
     gl3_fatsurface_t *fatsurfaces;
@@ -157,15 +196,12 @@ struct gl3_worldmodel_t
 
     GLuint vertex_buffer;
 
+    // every surface triangulated, indices relative to the texture's basevertex
+    GLuint index_buffer;
+
     // lightmap atlas size added for decals...
     GLuint lightmap_texture;
     int lightmap_width, lightmap_height;
-
-    // max amount of indices world geometry and all inline models may have
-    int max_index_count;
-
-    // max amount of indices a single inline model may have
-    int max_submodel_index_count;
 };
 
 // for sky and friends
@@ -174,11 +210,16 @@ extern const VertexFormat g_brushVertexFormat;
 extern gl3_worldmodel_t g_worldmodel_static;
 #define g_worldmodel (&(g_worldmodel_static))
 
-void brushLoadWorldModel(model_t *engineModel);
+// converts the engine model here and builds the buffers on the job system,
+// the world can't be drawn until the counter is done
+void brushLoadWorldModel(model_t *engineModel, JobCounter &counter);
 void brushFreeWorldModel();
 
 void brushInit();
 
+// world bounds of an inline model entity, for culling
+void brushEntityBounds(cl_entity_t *entity, Vector3 &center, Vector3 &extents);
+
 void brushDrawSolids(
     cl_entity_t **entities,
     int entityCount,
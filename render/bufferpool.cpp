@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "bufferpool.h"
+
+namespace Render
+{
+
+void bufferPoolInit(BufferPool &pool, GLenum target, unsigned elementSize, unsigned blockSize)
+{
+    pool.target = target;
+    pool.elementSize = elementSize;
+    pool.blockSize = blockSize;
+    pool.blocks.clear();
+}
+
+static bool AllocFromBlock(BufferPoolBlock &block, unsigned count, unsigned &offset)
+{
+    for (size_t i = 0; i < block.freeRanges.size(); i++)
+    {
+        BufferPoolRange &range = block.freeRanges[i];
+        if (range.count < count)
+        {
+            continue;
+        }
+
+        offset = range.offset;
+        range.offset += count;
+        range.count -= count;
+
+        if (!range.count)
+        {
+            block.freeRanges.erase(block.freeRanges.begin() + i);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+GLuint bufferPoolAlloc(BufferPool &pool, unsigned count, unsigned &offset)
+{
+    // empty models still need a valid buffer to bind
+    count = Q_max(count, 1u);
+
+    for (BufferPoolBlock &block : pool.blocks)
+    {
+        if (AllocFromBlock(block, count, offset))
+        {
+            return block.buffer;
+        }
+    }
+
+    pool.blocks.emplace_back();
+    BufferPoolBlock &block = pool.blocks.back();
+    block.size = Q_max(count, pool.blockSize);
+    block.freeRanges.push_back({ 0, block.size });
+
+    glGenBuffers(1, &block.buffer);
+    glBindBuffer(pool.target, block.buffer);
+    glBufferData(pool.target, static_cast<GLsizeiptr>(block.size) * pool.elementSize, nullptr, GL_STATIC_DRAW);
+
+    bool allocated = AllocFromBlock(block, count, offset);
+    GL3_ASSERT(allocated);
+    (void)allocated;
+
+    return block.buffer;
+}
+
+void bufferPoolFree(BufferPool &pool, GLuint buffer, unsigned offset, unsigned count)
+{
+    count = Q_max(count, 1u);
+
+    for (BufferPoolBlock &block : pool.blocks)
+    {
+        if (block.buffer != buffer)
+        {
+            continue;
+        }
+
+        GL3_ASSERT(offset + count <= block.size);
+
+        std::vector<BufferPoolRange> &ranges = block.freeRanges;
+        auto next = std::lower_bound(ranges.begin(), ranges.end(), offset,
+            [](const BufferPoolRange &range, unsigned value) { return range.offset < value; });
+
+        // merge with the neighbours so the list stays short
+        bool mergePrev = next != ranges.begin() && (next - 1)->offset + (next - 1)->count == offset;
+        bool mergeNext = next != ranges.end() && offset + count == next->offset;
+
+        if (mergePrev && mergeNext)
+        {
+            (next - 1)->count += count + next->count;
+            ranges.erase(next);
+        }
+        else if (mergePrev)
+        {
+            (next - 1)->count += count;
+        }
+        else if (mergeNext)
+        {
+            next->offset = offset;
+            next->count += count;
+        }
+        else
+        {
+            ranges.insert(next, { offset, count });
+        }
+
+        return;
+    }
+
+    GL3_ASSERT(false);
+}
+
+void bufferPoolUpload(const BufferPool &pool, GLuint buffer, unsigned offset, unsigned count, const void *data)
+{
+    if (!count)
+    {
+        return;
+    }
+
+    glBindBuffer(pool.target, buffer);
+    glBufferSubData(pool.target,
+        static_cast<GLintptr>(offset) * pool.elementSize,
+        static_cast<GLsizeiptr>(count) * pool.elementSize,
+        data);
+}
+
+}
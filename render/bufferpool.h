@@ -0,0 +1,44 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+namespace Render
+{
+
+// suballocates static geometry from a few large gl buffers so draws of different
+// models don't have to rebind anything. first fit over a sorted free list, the
+// allocations are few and long lived so nothing smarter is needed
+
+struct BufferPoolRange
+{
+    unsigned offset; // in elements
+    unsigned count;
+};
+
+struct BufferPoolBlock
+{
+    GLuint buffer;
+    unsigned size; // in elements
+    std::vector<BufferPoolRange> freeRanges; // sorted by offset, never adjacent
+};
+
+struct BufferPool
+{
+    GLenum target;
+    unsigned elementSize;
+    unsigned blockSize; // elements per block unless an allocation needs more
+    std::vector<BufferPoolBlock> blocks;
+};
+
+void bufferPoolInit(BufferPool &pool, GLenum target, unsigned elementSize, unsigned blockSize);
+
+// returns the buffer the range went to, adds a block if none of them has room
+GLuint bufferPoolAlloc(BufferPool &pool, unsigned count, unsigned &offset);
+
+void bufferPoolFree(BufferPool &pool, GLuint buffer, unsigned offset, unsigned count);
+
+// binds the buffer to the pool's target and writes the range
+void bufferPoolUpload(const BufferPool &pool, GLuint buffer, unsigned offset, unsigned count, const void *data);
+
+}
+
+#endif
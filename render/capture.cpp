@@ -0,0 +1,471 @@
+#include "stdafx.h"
+#include "capture.h"
+#include "entity.h"
+#include "particle.h"
+
+namespace Render
+{
+
+static struct
+{
+    FILE *file;
+    int frameCount;
+
+    // model names are written the first time a model shows up
+    std::unordered_map<const model_t *, int> modelIndices;
+
+    // what was written last, only changes get written
+    Lightstyle lightstyles[MAX_LIGHTSTYLES];
+
+    std::vector<byte> buffer;
+} s_writer;
+
+template<typename T>
+static void Write(const T &value)
+{
+    const byte *data = reinterpret_cast<const byte *>(&value);
+    s_writer.buffer.insert(s_writer.buffer.end(), data, data + sizeof(T));
+}
+
+static void WriteString(const char *string, size_t length)
+{
+    GL3_ASSERT(length <= UINT8_MAX);
+    Write(static_cast<uint8_t>(length));
+    s_writer.buffer.insert(s_writer.buffer.end(), string, string + length);
+}
+
+static int16_t CaptureModelIndex(const model_t *model, std::vector<const model_t *> &newModels)
+{
+    if (!model)
+    {
+        return -1;
+    }
+
+    auto it = s_writer.modelIndices.find(model);
+    if (it != s_writer.modelIndices.end())
+    {
+        return static_cast<int16_t>(it->second);
+    }
+
+    int index = static_cast<int>(s_writer.modelIndices.size());
+    s_writer.modelIndices[model] = index;
+    newModels.push_back(model);
+    return static_cast<int16_t>(index);
+}
+
+static void FillEntity(CaptureEntity &out, int type, cl_entity_t *entity, std::vector<const model_t *> &newModels)
+{
+    memset(&out, 0, sizeof(out));
+
+    out.model = CaptureModelIndex(entity->model, newModels);
+    out.type = static_cast<uint8_t>(type);
+    out.player = static_cast<uint8_t>(entity->player);
+    out.index = entity->index;
+
+    out.origin = entity->origin;
+    out.angles = entity->angles;
+    memcpy(out.attachment, entity->attachment, sizeof(out.attachment));
+
+    const entity_state_t &state = entity->curstate;
+    out.stateOrigin = state.origin;
+    out.stateAngles = state.angles;
+    out.rendermode = state.rendermode;
+    out.renderamt = state.renderamt;
+    out.renderfx = state.renderfx;
+    out.rendercolor = state.rendercolor;
+    memcpy(out.controller, state.controller, sizeof(out.controller));
+    memcpy(out.blending, state.blending, sizeof(out.blending));
+    out.skin = state.skin;
+    out.body = state.body;
+    out.sequence = state.sequence;
+    out.effects = state.effects;
+    out.frame = state.frame;
+    out.framerate = state.framerate;
+    out.scale = state.scale;
+    out.animtime = state.animtime;
+}
+
+static void FillParticle(CaptureParticle &out, const particle_t *particle)
+{
+    out.org = particle->org;
+    out.vel = particle->vel;
+    out.color = particle->color;
+    out.packedColor = particle->packedColor;
+    out.ramp = particle->ramp;
+    out.die = particle->die;
+    out.type = particle->type;
+}
+
+static void CollectLights(dlight_t *lights, int count, float time, std::vector<CaptureLight> &result)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const dlight_t &light = lights[i];
+        if (light.radius < 0.01f || light.die < time)
+        {
+            continue;
+        }
+
+        result.push_back({ i, light });
+    }
+}
+
+static void CollectParticles(const particle_t *head, std::vector<CaptureParticle> &result)
+{
+    for (const particle_t *particle = head; particle; particle = particle->next)
+    {
+        if (result.size() == CaptureMaxParticles)
+        {
+            break;
+        }
+
+        CaptureParticle temp;
+        FillParticle(temp, particle);
+        result.push_back(temp);
+    }
+}
+
+static void CaptureStart()
+{
+    if (g_engfuncs.Cmd_Argc() != 2)
+    {
+        g_engfuncs.Con_Printf("usage: gl3_capture_start <file>\n");
+        return;
+    }
+
+    model_t *world = g_engineStudio.GetModelByIndex(1);
+    if (!world)
+    {
+        g_engfuncs.Con_Printf("Can't capture without a level\n");
+        return;
+    }
+
+    captureStop();
+
+    const char *path = g_engfuncs.Cmd_Argv(1);
+    s_writer.file = fopen(path, "wb");
+    if (!s_writer.file)
+    {
+        g_engfuncs.Con_Printf("Could not open %s for writing\n", path);
+        return;
+    }
+
+    CaptureHeader header{};
+    header.magic = CaptureMagic;
+    header.version = CaptureVersion;
+    Q_strcpy_truncate(header.worldName, world->name);
+    fwrite(&header, sizeof(header), 1, s_writer.file);
+
+    s_writer.frameCount = 0;
+    s_writer.modelIndices.clear();
+
+    // force all lightstyles to be written on the first frame
+    for (Lightstyle &style : s_writer.lightstyles)
+    {
+        style.size = -1;
+    }
+
+    g_engfuncs.Con_Printf("Capturing frames to %s\n", path);
+}
+
+void captureStop()
+{
+    if (!s_writer.file)
+    {
+        return;
+    }
+
+    fclose(s_writer.file);
+    s_writer.file = nullptr;
+
+    g_engfuncs.Con_Printf("Captured %d frames\n", s_writer.frameCount);
+}
+
+void captureInit()
+{
+    g_engfuncs.pfnAddCommand("gl3_capture_start", CaptureStart);
+    g_engfuncs.pfnAddCommand("gl3_capture_stop", captureStop);
+}
+
+void captureFrame(const Params &params)
+{
+    if (!s_writer.file)
+    {
+        return;
+    }
+
+    const ref_params_t *refParams = params.refParams;
+    const movevars_t *movevars = refParams->movevars;
+
+    float time = g_engfuncs.GetClientTime();
+
+    CaptureView view{};
+    view.time = time;
+    view.oldtime = g_engfuncs.hudGetClientOldTime();
+    view.fov = params.fov;
+    view.viewModelFov = params.viewModelFov;
+    view.vieworg = refParams->vieworg;
+    view.viewangles = refParams->viewangles;
+    view.crosshairangle = refParams->crosshairangle;
+    memcpy(view.viewport, refParams->viewport, sizeof(view.viewport));
+    view.waterlevel = refParams->waterlevel;
+    view.onlyClientDraw = refParams->onlyClientDraw;
+    view.zmax = movevars->zmax;
+    view.gravity = movevars->gravity;
+    Q_strcpy(view.skyName, movevars->skyName);
+    view.skyColor = { movevars->skycolor_r, movevars->skycolor_g, movevars->skycolor_b };
+    view.skyVec = { movevars->skyvec_x, movevars->skyvec_y, movevars->skyvec_z };
+
+    for (int i = 0; i < MAX_LIGHTSTYLES; i++)
+    {
+        const Lightstyle &style = platformLightstyleString(i);
+        Lightstyle &previous = s_writer.lightstyles[i];
+
+        if (style.size != previous.size || memcmp(style.data, previous.data, Q_min(style.size, 64)))
+        {
+            view.lightstyleMask |= 1ull << i;
+            previous = style;
+        }
+    }
+
+    std::vector<CaptureLight> dlights, elights;
+    CollectLights(g_dlights, MAX_DLIGHTS, time, dlights);
+    CollectLights(g_elights, MAX_ELIGHTS, time, elights);
+
+    std::vector<const model_t *> newModels;
+
+    static cl_entity_t *s_entities[CaptureMaxEntities];
+    static int s_types[CaptureMaxEntities];
+    int entityCount = entityGetAdded(s_entities, s_types, CaptureMaxEntities);
+
+    std::vector<CaptureEntity> entities(entityCount);
+    for (int i = 0; i < entityCount; i++)
+    {
+        FillEntity(entities[i], s_types[i], s_entities[i], newModels);
+    }
+
+    CaptureEntity viewmodel;
+    cl_entity_t *viewent = g_engfuncs.GetViewModel();
+    view.hasViewmodel = viewent->model ? 1 : 0;
+    if (view.hasViewmodel)
+    {
+        FillEntity(viewmodel, ET_NORMAL, viewent, newModels);
+    }
+
+    std::vector<CaptureParticle> particles, tracers;
+    CollectParticles(particleGetActive(false), particles);
+    CollectParticles(particleGetActive(true), tracers);
+
+    view.newModelCount = static_cast<uint16_t>(newModels.size());
+    view.dlightCount = static_cast<uint16_t>(dlights.size());
+    view.elightCount = static_cast<uint16_t>(elights.size());
+    view.entityCount = static_cast<uint16_t>(entities.size());
+    view.particleCount = static_cast<uint16_t>(particles.size());
+    view.tracerCount = static_cast<uint16_t>(tracers.size());
+
+    s_writer.buffer.clear();
+    Write(view);
+
+    for (const model_t *model : newModels)
+    {
+        WriteString(model->name, strnlen(model->name, sizeof(model->name)));
+    }
+
+    for (int i = 0; i < MAX_LIGHTSTYLES; i++)
+    {
+        if (view.lightstyleMask & (1ull << i))
+        {
+            const Lightstyle &style = s_writer.lightstyles[i];
+            WriteString(style.data, Q_clamp(style.size, 0, 64));
+        }
+    }
+
+    for (const CaptureLight &light : dlights)
+        Write(light);
+
+    for (const CaptureLight &light : elights)
+        Write(light);
+
+    for (const CaptureEntity &entity : entities)
+        Write(entity);
+
+    for (const CaptureParticle &particle : particles)
+        Write(particle);
+
+    for (const CaptureParticle &particle : tracers)
+        Write(particle);
+
+    if (view.hasViewmodel)
+    {
+        Write(viewmodel);
+    }
+
+    // patch in the final size
+    uint32_t size = static_cast<uint32_t>(s_writer.buffer.size());
+    memcpy(s_writer.buffer.data(), &size, sizeof(size));
+
+    if (fwrite(s_writer.buffer.data(), size, 1, s_writer.file) != 1)
+    {
+        g_engfuncs.Con_Printf("Capture write failed\n");
+        captureStop();
+        return;
+    }
+
+    s_writer.frameCount++;
+}
+
+/************************************************/
+/* reading
+ */
+
+struct ReadCursor
+{
+    const byte *data;
+    const byte *end;
+};
+
+template<typename T>
+static bool Read(ReadCursor &cursor, T &value)
+{
+    if (cursor.end - cursor.data < static_cast<ptrdiff_t>(sizeof(T)))
+    {
+        return false;
+    }
+
+    memcpy(&value, cursor.data, sizeof(T));
+    cursor.data += sizeof(T);
+    return true;
+}
+
+template<typename T>
+static bool ReadArray(ReadCursor &cursor, std::vector<T> &values, int count)
+{
+    values.resize(count);
+
+    for (T &value : values)
+    {
+        if (!Read(cursor, value))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ReadString(ReadCursor &cursor, char *dest, size_t destSize, size_t &length)
+{
+    uint8_t temp;
+    if (!Read(cursor, temp) || cursor.end - cursor.data < temp || temp >= destSize)
+    {
+        return false;
+    }
+
+    length = temp;
+    memcpy(dest, cursor.data, length);
+    dest[length] = '\0';
+    cursor.data += length;
+    return true;
+}
+
+bool captureOpen(CaptureReader &reader, const char *path)
+{
+    reader.file = fopen(path, "rb");
+    if (!reader.file)
+    {
+        return false;
+    }
+
+    if (fread(&reader.header, sizeof(reader.header), 1, reader.file) != 1
+        || reader.header.magic != CaptureMagic
+        || reader.header.version != CaptureVersion)
+    {
+        captureClose(reader);
+        return false;
+    }
+
+    reader.header.worldName[sizeof(reader.header.worldName) - 1] = '\0';
+    reader.modelNames.clear();
+    return true;
+}
+
+bool captureReadFrame(CaptureReader &reader, CaptureFrame &frame)
+{
+    CaptureView &view = frame.view;
+    if (fread(&view, sizeof(view), 1, reader.file) != 1 || view.size < sizeof(view))
+    {
+        return false;
+    }
+
+    reader.buffer.resize(view.size - sizeof(view));
+    if (!reader.buffer.empty() && fread(reader.buffer.data(), reader.buffer.size(), 1, reader.file) != 1)
+    {
+        return false;
+    }
+
+    ReadCursor cursor{ reader.buffer.data(), reader.buffer.data() + reader.buffer.size() };
+
+    for (int i = 0; i < view.newModelCount; i++)
+    {
+        char name[64];
+        size_t length;
+        if (!ReadString(cursor, name, sizeof(name), length))
+        {
+            return false;
+        }
+
+        reader.modelNames.emplace_back(name, length);
+    }
+
+    // changed lightstyles, frame keeps the rest from the previous read
+    for (int i = 0; i < MAX_LIGHTSTYLES; i++)
+    {
+        if (view.lightstyleMask & (1ull << i))
+        {
+            Lightstyle &style = frame.lightstyles[i];
+            size_t length;
+            if (!ReadString(cursor, style.data, sizeof(style.data), length))
+            {
+                return false;
+            }
+
+            style.size = static_cast<int>(length);
+        }
+    }
+
+    if (!ReadArray(cursor, frame.dlights, view.dlightCount)
+        || !ReadArray(cursor, frame.elights, view.elightCount)
+        || !ReadArray(cursor, frame.entities, view.entityCount)
+        || !ReadArray(cursor, frame.particles, view.particleCount)
+        || !ReadArray(cursor, frame.tracers, view.tracerCount))
+    {
+        return false;
+    }
+
+    frame.hasViewmodel = view.hasViewmodel != 0;
+    if (frame.hasViewmodel && !Read(cursor, frame.viewmodel))
+    {
+        return false;
+    }
+
+    return cursor.data == cursor.end;
+}
+
+void captureRewind(CaptureReader &reader)
+{
+    fseek(reader.file, sizeof(CaptureHeader), SEEK_SET);
+
+    // model names get written again from the start
+    reader.modelNames.clear();
+}
+
+void captureClose(CaptureReader &reader)
+{
+    if (reader.file)
+    {
+        fclose(reader.file);
+        reader.file = nullptr;
+    }
+}
+
+}
@@ -0,0 +1,156 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+namespace Render
+{
+
+// frame capture: everything RenderScene consumes from the engine gets written
+// to a file each frame so it can be fed back in by render_host -replay
+// the file layout is plain structs, so captures only work on the same architecture
+
+constexpr uint32_t CaptureMagic = 0x43334c47; // GL3C
+constexpr int CaptureVersion = 1;
+
+constexpr int CaptureMaxEntities = 2048;
+constexpr int CaptureMaxParticles = 2048;
+
+struct CaptureHeader
+{
+    uint32_t magic;
+    int version;
+    char worldName[64];
+};
+
+// written at the start of each frame
+struct CaptureView
+{
+    uint32_t size; // size of the whole frame record including this
+
+    double time;
+    double oldtime;
+
+    float fov;
+    float viewModelFov;
+
+    Vector3 vieworg;
+    Vector3 viewangles;
+    Vector3 crosshairangle;
+    int viewport[4];
+    int waterlevel;
+    int onlyClientDraw;
+
+    // the movevars we care about
+    float zmax;
+    float gravity;
+    char skyName[32];
+    Vector3 skyColor;
+    Vector3 skyVec;
+
+    // lightstyles that changed since the last frame follow
+    uint64_t lightstyleMask;
+
+    // counts for the variable length parts, in this order
+    uint16_t newModelCount;
+    uint16_t dlightCount;
+    uint16_t elightCount;
+    uint16_t entityCount;
+    uint16_t particleCount;
+    uint16_t tracerCount;
+    uint16_t hasViewmodel;
+};
+
+struct CaptureEntity
+{
+    int16_t model; // index to the capture's model name list, -1 if none
+    uint8_t type; // ET_NORMAL, ET_BEAM...
+    uint8_t player;
+    int index;
+
+    Vector3 origin;
+    Vector3 angles;
+    Vector3 attachment[4];
+
+    // curstate
+    Vector3 stateOrigin;
+    Vector3 stateAngles;
+    int rendermode;
+    int renderamt;
+    int renderfx;
+    color24 rendercolor;
+    byte controller[4];
+    byte blending[2];
+    int skin;
+    int body;
+    int sequence;
+    int effects;
+    float frame;
+    float framerate;
+    float scale;
+    float animtime;
+};
+
+struct CaptureLight
+{
+    int index;
+    dlight_t light;
+};
+
+struct CaptureParticle
+{
+    Vector3 org;
+    Vector3 vel;
+    short color;
+    short packedColor;
+    float ramp;
+    float die;
+    int type;
+};
+
+// one frame read back from a capture, arrays are only valid until the next read
+struct CaptureFrame
+{
+    CaptureView view;
+
+    Lightstyle lightstyles[MAX_LIGHTSTYLES];
+
+    std::vector<CaptureLight> dlights;
+    std::vector<CaptureLight> elights;
+    std::vector<CaptureEntity> entities;
+    std::vector<CaptureParticle> particles;
+    std::vector<CaptureParticle> tracers;
+
+    bool hasViewmodel;
+    CaptureEntity viewmodel;
+};
+
+struct CaptureReader
+{
+    FILE *file;
+    CaptureHeader header;
+    std::vector<std::string> modelNames;
+    std::vector<byte> buffer;
+};
+
+// registers gl3_capture_start and gl3_capture_stop
+void captureInit();
+
+// called from RenderScene, writes out the frame if a capture is running
+void captureFrame(const Params &params);
+
+// captures can't span levels
+void captureStop();
+
+// returns false if the file can't be opened or isn't a capture
+bool captureOpen(CaptureReader &reader, const char *path);
+
+// returns false at the end of the file
+bool captureReadFrame(CaptureReader &reader, CaptureFrame &frame);
+
+// back to the first frame
+void captureRewind(CaptureReader &reader);
+
+void captureClose(CaptureReader &reader);
+
+}
+
+#endif
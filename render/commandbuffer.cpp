@@ -14,6 +14,9 @@ enum Command
     CmdBindUniformBuffer0,
     CmdBindUniformBuffer1,
     CmdBindUniformBuffer2,
+    CmdBindUniformBuffer3,
+    CmdBindUniformBuffer4,
+    CmdBindUniformBuffer5,
 
     CmdBindTexture2D,
     CmdBindTextureCubeMap,
@@ -22,13 +25,14 @@ enum Command
     CmdDepthMask,
 
     CmdDrawElementsBaseVertex,
+    CmdMultiDrawElementsBaseVertex,
+    CmdDrawElementsInstancedBaseVertex,
 
     CmdPolygonOffset,
     CmdUniform1f,
     CmdUniform1i,
     CmdUseProgram,
-    CmdBindVertexBuffer,
-    CmdBindIndexBuffer,
+    CmdBindVertexArray,
 
     CmdBlendEnable,
     CmdCullFaceEnable,
@@ -41,8 +45,29 @@ enum Command
     CmdCount
 };
 
+// state the peephole pass tracks, a command setting one is dead if another one
+// sets it again before a draw reads it
+enum StateSlot
+{
+    SlotBlend,
+    SlotBlendFunc,
+    SlotCullFace,
+    SlotDepthTest,
+    SlotDepthFunc,
+    SlotDepthMask,
+    SlotPolygonOffset,
+    SlotProgram,
+    SlotVertexArray,
+    SlotUniformBuffer, // one per binding
+    SlotTexture2D = SlotUniformBuffer + MaxUniformBufferBindings, // one per unit
+    SlotTextureCubeMap = SlotTexture2D + MaxTextureUnits,
+    SlotCount = SlotTextureCubeMap + MaxTextureUnits
+};
+
 ShadowState g_shadowState;
 
+static cvar_t *gl3_command_optimize;
+
 static bool s_recording;
 
 static size_t s_readOffset;
@@ -50,8 +75,53 @@ static size_t s_size;
 static size_t s_capacity;
 static uint32_t *s_buffer;
 
+// vertex array objects for every vertex buffer, format and index buffer combination
+// that has been drawn with, created the first time commandExecute binds them
+struct VertexArrayKey
+{
+    GLuint vertexBuffer;
+    const VertexFormat *format;
+    GLuint indexBuffer;
+
+    bool operator==(const VertexArrayKey &other) const
+    {
+        return vertexBuffer == other.vertexBuffer && format == other.format && indexBuffer == other.indexBuffer;
+    }
+};
+
+struct VertexArrayKeyHash
+{
+    size_t operator()(const VertexArrayKey &key) const
+    {
+        return static_cast<size_t>(HashBytes64(HashSeed64, &key, sizeof(key)));
+    }
+};
+
+struct VertexArray
+{
+    VertexArrayKey key;
+    GLuint handle; // 0 until first bound
+};
+
+// the command buffer refers to these by index so they can't move while recording
+static std::vector<VertexArray> s_vertexArrays;
+static std::vector<int> s_freeVertexArrays;
+static std::unordered_map<VertexArrayKey, int, VertexArrayKeyHash> s_vertexArrayIndices;
+
+// the buffer bindings changed since the last draw
+static bool s_vertexArrayDirty;
+
+// glMultiDrawElementsBaseVertex wants pointers and a basevertex per draw, expanded at execute time
+static std::vector<const void *> s_multiDrawOffsets;
+static std::vector<GLint> s_multiDrawBaseVertices;
+
+// commandOptimize marks the commands it drops by their first word
+static std::vector<uint8_t> s_deadCommands;
+
 void commandInit()
 {
+    gl3_command_optimize = g_engfuncs.pfnRegisterVariable("gl3_command_optimize", "1", 0);
+
     s_capacity = InitialBufferCapacity;
     s_buffer = static_cast<uint32_t *>(malloc(s_capacity * sizeof(uint32_t)));
     if (!s_buffer)
@@ -85,6 +155,7 @@ void commandRecord()
 
     // state reset
     g_shadowState = ShadowState{};
+    s_vertexArrayDirty = true;
 }
 
 template<class To, class From>
@@ -129,6 +200,291 @@ static bool IsFinished()
     return s_readOffset == s_size;
 }
 
+// leaves it bound
+static void CreateVertexArray(VertexArray &vertexArray)
+{
+    const VertexArrayKey &key = vertexArray.key;
+    Span<const VertexAttrib> vertexAttribs = key.format->attribs;
+    int vertexStride = key.format->stride;
+
+    GL3_ASSERT(vertexAttribs.size() <= MaxVertexAttribs);
+
+    glGenVertexArrays(1, &vertexArray.handle);
+    glBindVertexArray(vertexArray.handle);
+
+    // the element array binding is vertex array state, the array buffer one isn't
+    glBindBuffer(GL_ARRAY_BUFFER, key.vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, key.indexBuffer);
+
+    // new vertex arrays start with every attrib disabled
+    for (int i = 0; i < vertexAttribs.size(); i++)
+    {
+        const VertexAttrib &attrib = vertexAttribs[i];
+
+        glEnableVertexAttribArray(i);
+        glVertexAttribPointer(i, attrib.size, attrib.type, attrib.normalized, vertexStride, reinterpret_cast<void *>(static_cast<intptr_t>(attrib.offset)));
+    }
+}
+
+// in words, including the command itself
+static size_t CommandSize(const uint32_t *command)
+{
+    switch (*command)
+    {
+    case CmdBlendEnable:
+    case CmdCullFaceEnable:
+    case CmdDepthTestEnable:
+    case CmdBlendDisable:
+    case CmdCullFaceDisable:
+    case CmdDepthTestDisable:
+        return 1;
+
+    case CmdActiveTexture:
+    case CmdBindTexture2D:
+    case CmdBindTextureCubeMap:
+    case CmdDepthFunc:
+    case CmdDepthMask:
+    case CmdUseProgram:
+    case CmdBindVertexArray:
+        return 2;
+
+    case CmdBlendFunc:
+    case CmdPolygonOffset:
+    case CmdUniform1f:
+    case CmdUniform1i:
+        return 3;
+
+    case CmdBindUniformBuffer0:
+    case CmdBindUniformBuffer1:
+    case CmdBindUniformBuffer2:
+    case CmdBindUniformBuffer3:
+    case CmdBindUniformBuffer4:
+    case CmdBindUniformBuffer5:
+    case CmdDrawElementsBaseVertex:
+        return 4;
+
+    case CmdDrawElementsInstancedBaseVertex:
+        return 5;
+
+    case CmdMultiDrawElementsBaseVertex:
+        // drawcount, basevertex, then the counts and offsets
+        return 3 + command[1] * 2;
+
+    default:
+        GL3_ASSERT(false);
+        return 1;
+    }
+}
+
+// -1 if the command doesn't set any tracked state
+static int CommandSlot(const uint32_t *command, GLuint textureUnit)
+{
+    switch (*command)
+    {
+    case CmdBlendEnable:
+    case CmdBlendDisable:
+        return SlotBlend;
+
+    case CmdCullFaceEnable:
+    case CmdCullFaceDisable:
+        return SlotCullFace;
+
+    case CmdDepthTestEnable:
+    case CmdDepthTestDisable:
+        return SlotDepthTest;
+
+    case CmdBlendFunc:
+        return SlotBlendFunc;
+
+    case CmdDepthFunc:
+        return SlotDepthFunc;
+
+    case CmdDepthMask:
+        return SlotDepthMask;
+
+    case CmdPolygonOffset:
+        return SlotPolygonOffset;
+
+    case CmdUseProgram:
+        return SlotProgram;
+
+    case CmdBindVertexArray:
+        return SlotVertexArray;
+
+    case CmdBindUniformBuffer0:
+    case CmdBindUniformBuffer1:
+    case CmdBindUniformBuffer2:
+    case CmdBindUniformBuffer3:
+    case CmdBindUniformBuffer4:
+    case CmdBindUniformBuffer5:
+        return SlotUniformBuffer + (*command - CmdBindUniformBuffer0);
+
+    case CmdBindTexture2D:
+        return SlotTexture2D + textureUnit;
+
+    case CmdBindTextureCubeMap:
+        return SlotTextureCubeMap + textureUnit;
+
+    default:
+        return -1;
+    }
+}
+
+static bool IsDraw(uint32_t command)
+{
+    return command == CmdDrawElementsBaseVertex
+        || command == CmdMultiDrawElementsBaseVertex
+        || command == CmdDrawElementsInstancedBaseVertex;
+}
+
+// marks state commands nobody reads: ones set again before the next draw, and ones
+// setting what a previous draw already had. returns how many were marked
+static int MarkDeadCommands()
+{
+    // the last command setting the slot since the last draw and the one the last draw used
+    size_t pending[SlotCount];
+    size_t current[SlotCount];
+    const size_t none = ~static_cast<size_t>(0);
+
+    for (int i = 0; i < SlotCount; i++)
+    {
+        pending[i] = none;
+        current[i] = none;
+    }
+
+    s_deadCommands.assign(s_size, 0);
+
+    int deadCount = 0;
+    GLuint textureUnit = 0;
+
+    for (size_t offset = 0; offset < s_size; offset += CommandSize(&s_buffer[offset]))
+    {
+        const uint32_t *command = &s_buffer[offset];
+
+        if (IsDraw(*command))
+        {
+            for (int i = 0; i < SlotCount; i++)
+            {
+                if (pending[i] != none)
+                {
+                    current[i] = pending[i];
+                    pending[i] = none;
+                }
+            }
+
+            continue;
+        }
+
+        if (*command == CmdActiveTexture)
+        {
+            textureUnit = command[1];
+            continue;
+        }
+
+        // uniforms go to the bound program so it has to stay
+        if (*command == CmdUniform1f || *command == CmdUniform1i)
+        {
+            if (pending[SlotProgram] != none)
+            {
+                current[SlotProgram] = pending[SlotProgram];
+                pending[SlotProgram] = none;
+            }
+
+            continue;
+        }
+
+        int slot = CommandSlot(command, textureUnit);
+        if (slot == -1)
+        {
+            continue;
+        }
+
+        if (pending[slot] != none)
+        {
+            s_deadCommands[pending[slot]] = 1;
+            pending[slot] = none;
+            deadCount++;
+        }
+
+        // back to what the last draw had, enable and disable have no arguments but differ in the command
+        size_t size = CommandSize(command);
+        if (current[slot] != none && !memcmp(&s_buffer[current[slot]], command, size * sizeof(uint32_t)))
+        {
+            s_deadCommands[offset] = 1;
+            deadCount++;
+            continue;
+        }
+
+        pending[slot] = offset;
+    }
+
+    return deadCount;
+}
+
+int commandOptimize()
+{
+    GL3_ASSERT(s_recording);
+    GL3_ASSERT(s_readOffset == 0);
+
+    if (!gl3_command_optimize->value)
+    {
+        return 0;
+    }
+
+    int removed = MarkDeadCommands();
+
+    // compact in place, draws that end up next to each other get merged if
+    // their index ranges are contiguous and they share the base vertex
+    size_t writeOffset = 0;
+    size_t lastDraw = ~static_cast<size_t>(0);
+
+    for (size_t offset = 0; offset < s_size;)
+    {
+        size_t size = CommandSize(&s_buffer[offset]);
+
+        if (s_deadCommands[offset])
+        {
+            offset += size;
+            continue;
+        }
+
+        const uint32_t *command = &s_buffer[offset];
+
+        if (*command == CmdDrawElementsBaseVertex && lastDraw == writeOffset - 4)
+        {
+            uint32_t *previous = &s_buffer[lastDraw];
+            GLsizei count = BitCast<GLsizei>(previous[1]);
+            GLsizei previousEnd = BitCast<GLsizei>(previous[2]) + count * static_cast<GLsizei>(sizeof(uint16_t));
+
+            if (BitCast<GLsizei>(command[2]) == previousEnd && command[3] == previous[3])
+            {
+                previous[1] = BitCast<uint32_t>(count + BitCast<GLsizei>(command[1]));
+                offset += size;
+                removed++;
+                continue;
+            }
+        }
+
+        if (*command == CmdDrawElementsBaseVertex)
+        {
+            lastDraw = writeOffset;
+        }
+
+        // the ranges can overlap, the write offset is never ahead
+        memmove(&s_buffer[writeOffset], command, size * sizeof(uint32_t));
+        writeOffset += size;
+        offset += size;
+    }
+
+    s_size = writeOffset;
+
+#ifdef SCHIZO_DEBUG
+    g_state.commandsRemoved = removed;
+#endif
+
+    return removed;
+}
+
 void commandExecute()
 {
     GL3_ASSERT(s_recording);
@@ -184,6 +540,33 @@ void commandExecute()
         }
         break;
 
+        case CmdBindUniformBuffer3:
+        {
+            GLuint buffer = ReadWord<GLuint>();
+            GLintptr offset = ReadWord<GLintptr>();
+            GLsizeiptr size = ReadWord<GLsizeiptr>();
+            glBindBufferRange(GL_UNIFORM_BUFFER, 3, buffer, offset, size);
+        }
+        break;
+
+        case CmdBindUniformBuffer4:
+        {
+            GLuint buffer = ReadWord<GLuint>();
+            GLintptr offset = ReadWord<GLintptr>();
+            GLsizeiptr size = ReadWord<GLsizeiptr>();
+            glBindBufferRange(GL_UNIFORM_BUFFER, 4, buffer, offset, size);
+        }
+        break;
+
+        case CmdBindUniformBuffer5:
+        {
+            GLuint buffer = ReadWord<GLuint>();
+            GLintptr offset = ReadWord<GLintptr>();
+            GLsizeiptr size = ReadWord<GLsizeiptr>();
+            glBindBufferRange(GL_UNIFORM_BUFFER, 5, buffer, offset, size);
+        }
+        break;
+
         case CmdBindTexture2D:
         {
             GLuint texture = ReadWord<GLuint>();
@@ -234,6 +617,45 @@ void commandExecute()
         }
         break;
 
+        case CmdMultiDrawElementsBaseVertex:
+        {
+            GLsizei drawcount = ReadWord<GLsizei>();
+            GLint basevertex = ReadWord<GLint>();
+
+            // counts are used straight from the command buffer
+            GL3_ASSERT(s_readOffset + drawcount <= s_size);
+            const GLsizei *counts = reinterpret_cast<const GLsizei *>(&s_buffer[s_readOffset]);
+            s_readOffset += drawcount;
+
+            s_multiDrawOffsets.resize(drawcount);
+            s_multiDrawBaseVertices.assign(drawcount, basevertex);
+
+            for (GLsizei i = 0; i < drawcount; i++)
+            {
+                GLsizei offset = ReadWord<GLsizei>();
+                s_multiDrawOffsets[i] = reinterpret_cast<const void *>(offset);
+            }
+
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, GL_UNSIGNED_SHORT, s_multiDrawOffsets.data(), drawcount, s_multiDrawBaseVertices.data());
+#ifdef SCHIZO_DEBUG
+            g_state.drawcallCount++;
+#endif
+        }
+        break;
+
+        case CmdDrawElementsInstancedBaseVertex:
+        {
+            GLsizei count = ReadWord<GLsizei>();
+            GLsizei offset = ReadWord<GLsizei>();
+            GLsizei instancecount = ReadWord<GLsizei>();
+            GLint basevertex = ReadWord<GLint>();
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, reinterpret_cast<const void *>(offset), instancecount, basevertex);
+#ifdef SCHIZO_DEBUG
+            g_state.drawcallCount++;
+#endif
+        }
+        break;
+
         case CmdPolygonOffset:
         {
             GLfloat factor = ReadWord<GLfloat>();
@@ -273,41 +695,22 @@ void commandExecute()
         }
         break;
 
-        case CmdBindVertexBuffer:
+        case CmdBindVertexArray:
         {
-            int i;
-
-            GLuint buffer = ReadWord<GLuint>();
-            const VertexFormat *format = ReadWord<const VertexFormat *>();
-            Span<const VertexAttrib> vertexAttribs = format->attribs;
-            int vertexStride = format->stride;
-
-            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            int index = ReadWord<int>();
+            VertexArray &vertexArray = s_vertexArrays[index];
 
-            for (i = 0; i < vertexAttribs.size(); i++)
+            if (vertexArray.handle)
             {
-                const VertexAttrib &attrib = vertexAttribs[i];
-
-                glEnableVertexAttribArray(i);
-                glVertexAttribPointer(i, attrib.size, attrib.type, attrib.normalized, vertexStride, reinterpret_cast<void *>(static_cast<intptr_t>(attrib.offset)));
+                glBindVertexArray(vertexArray.handle);
             }
-
-            GL3_ASSERT(i <= MaxVertexAttribs);
-
-            for (; i < MaxVertexAttribs; i++)
+            else
             {
-                glDisableVertexAttribArray(i);
+                CreateVertexArray(vertexArray);
             }
         }
         break;
 
-        case CmdBindIndexBuffer:
-        {
-            GLuint buffer = ReadWord<GLuint>();
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
-        }
-        break;
-
         case CmdBlendEnable:
         {
             glEnable(GL_BLEND);
@@ -354,6 +757,9 @@ void commandExecute()
         GL_ERRORS();
     }
 
+    // back to the default one, buffer uploads and the engine must not touch ours
+    glBindVertexArray(0);
+
 #ifdef SCHIZO_DEBUG
     g_state.commandBufferSize = s_size;
 #endif
@@ -365,7 +771,16 @@ void commandExecute()
 void commandBindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
 {
     GL3_ASSERT(s_recording);
-    GL3_ASSERT(index == 0 || index == 1 || index == 2);
+    GL3_ASSERT(index < MaxUniformBufferBindings);
+
+    // same range as before, happens a lot now that identical blocks share one
+    UniformBufferBinding &binding = g_shadowState.uniformBuffers[index];
+    if (binding.buffer == buffer && binding.offset == offset && binding.size == size)
+    {
+        return;
+    }
+
+    binding = { buffer, offset, size };
 
     WriteWord(CmdBindUniformBuffer0 + index);
     //WriteWord(index);
@@ -483,6 +898,46 @@ void commandDepthTest(GLboolean enable)
     }
 }
 
+// binds the vertex array for the current buffers before a draw
+static void FlushVertexArray()
+{
+    if (!s_vertexArrayDirty)
+    {
+        return;
+    }
+
+    GL3_ASSERT(g_shadowState.vertexFormat);
+    s_vertexArrayDirty = false;
+
+    VertexArrayKey key{ g_shadowState.vertexBuffer, g_shadowState.vertexFormat, g_shadowState.indexBuffer };
+
+    int index;
+    auto it = s_vertexArrayIndices.find(key);
+    if (it != s_vertexArrayIndices.end())
+    {
+        index = it->second;
+    }
+    else
+    {
+        if (!s_freeVertexArrays.empty())
+        {
+            index = s_freeVertexArrays.back();
+            s_freeVertexArrays.pop_back();
+        }
+        else
+        {
+            index = static_cast<int>(s_vertexArrays.size());
+            s_vertexArrays.push_back({});
+        }
+
+        s_vertexArrays[index] = { key, 0 };
+        s_vertexArrayIndices.emplace(key, index);
+    }
+
+    WriteWord(CmdBindVertexArray);
+    WriteWord(index);
+}
+
 void commandDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsizei offset, GLint basevertex)
 {
     GL3_ASSERT(s_recording);
@@ -490,6 +945,8 @@ void commandDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsi
     GL3_ASSERT(type == GL_UNSIGNED_SHORT);
     GL3_ASSERT(basevertex >= 0);
 
+    FlushVertexArray();
+
     WriteWord(CmdDrawElementsBaseVertex);
     //WriteWord(mode);
     WriteWord(count);
@@ -498,6 +955,48 @@ void commandDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsi
     WriteWord(basevertex);
 }
 
+void commandDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsizei offset, GLsizei instancecount, GLint basevertex)
+{
+    GL3_ASSERT(s_recording);
+    GL3_ASSERT(mode == GL_TRIANGLES);
+    GL3_ASSERT(type == GL_UNSIGNED_SHORT);
+    GL3_ASSERT(basevertex >= 0);
+    GL3_ASSERT(instancecount > 0);
+
+    FlushVertexArray();
+
+    WriteWord(CmdDrawElementsInstancedBaseVertex);
+    WriteWord(count);
+    WriteWord(offset);
+    WriteWord(instancecount);
+    WriteWord(basevertex);
+}
+
+void commandMultiDrawElementsBaseVertex(GLenum mode, const GLsizei *counts, GLenum type, const GLsizei *offsets, GLsizei drawcount, GLint basevertex)
+{
+    GL3_ASSERT(s_recording);
+    GL3_ASSERT(mode == GL_TRIANGLES);
+    GL3_ASSERT(type == GL_UNSIGNED_SHORT);
+    GL3_ASSERT(basevertex >= 0);
+    GL3_ASSERT(drawcount > 0);
+
+    FlushVertexArray();
+
+    WriteWord(CmdMultiDrawElementsBaseVertex);
+    WriteWord(drawcount);
+    WriteWord(basevertex);
+
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        WriteWord(counts[i]);
+    }
+
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        WriteWord(offsets[i]);
+    }
+}
+
 void commandPolygonOffset(GLfloat factor, GLfloat units)
 {
     GL3_ASSERT(s_recording);
@@ -566,8 +1065,7 @@ void commandBindIndexBuffer(GLuint buffer)
     if (g_shadowState.indexBuffer != buffer)
     {
         g_shadowState.indexBuffer = buffer;
-        WriteWord(CmdBindIndexBuffer);
-        WriteWord(buffer);
+        s_vertexArrayDirty = true;
     }
 }
 
@@ -577,9 +1075,38 @@ void commandBindVertexBuffer(GLuint buffer, const VertexFormat &format)
     {
         g_shadowState.vertexBuffer = buffer;
         g_shadowState.vertexFormat = &format;
-        WriteWord(CmdBindVertexBuffer);
-        WriteWord(buffer);
-        WriteWord(&format);
+        s_vertexArrayDirty = true;
+    }
+}
+
+void commandFreeBuffer(GLuint buffer)
+{
+    GL3_ASSERT(!s_recording);
+
+    if (!buffer)
+    {
+        return;
+    }
+
+    for (int i = 0; i < static_cast<int>(s_vertexArrays.size()); i++)
+    {
+        VertexArray &vertexArray = s_vertexArrays[i];
+        if (!vertexArray.key.format)
+        {
+            continue;
+        }
+
+        if (vertexArray.key.vertexBuffer != buffer && vertexArray.key.indexBuffer != buffer)
+        {
+            continue;
+        }
+
+        // a recycled buffer name would otherwise hit the stale vertex array
+        glDeleteVertexArrays(1, &vertexArray.handle);
+        s_vertexArrayIndices.erase(vertexArray.key);
+
+        vertexArray = {};
+        s_freeVertexArrays.push_back(i);
     }
 }
 
@@ -14,6 +14,16 @@ namespace Render
 
 constexpr unsigned MaxTextureUnits = 4;
 
+// see BindUniformBlocks in shader.cpp
+constexpr unsigned MaxUniformBufferBindings = 6;
+
+struct UniformBufferBinding
+{
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
 // shadowing state to reduce command buffer sizes, overhead is negligible
 // exposed in header for immediate.cpp (FIXME: does it really need this?)
 struct ShadowState
@@ -36,6 +46,8 @@ struct ShadowState
     GLuint texture2Ds[MaxTextureUnits]{};
     GLuint textureCubeMaps[MaxTextureUnits]{};
 
+    UniformBufferBinding uniformBuffers[MaxUniformBufferBindings]{};
+
     BaseShader *shader{};
 };
 
@@ -44,6 +56,11 @@ extern ShadowState g_shadowState;
 void commandInit();
 
 void commandRecord();
+
+// peephole pass over the recorded commands: drops state changes no draw reads and merges
+// draws with contiguous index ranges. call after recording, returns how many commands it removed
+int commandOptimize();
+
 void commandExecute();
 
 // blend state
@@ -64,9 +81,13 @@ void commandUseProgram(BaseShader *shader);
 void commandUniform1f(GLint location, GLfloat v0);
 void commandUniform1i(GLint location, GLint v0);
 
-// buffer bindings, vertex attributes and vertex buffer set together for convenience (latched state)
+// buffer bindings, vertex attributes and vertex buffer set together for convenience (latched state).
+// the next draw binds a cached vertex array object for the vertex buffer, format and index buffer
 void commandBindVertexBuffer(GLuint buffer, const VertexFormat &format);
 void commandBindIndexBuffer(GLuint buffer);
+
+// drops the cached vertex arrays that use the buffer, call before deleting it
+void commandFreeBuffer(GLuint buffer);
 void commandBindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
 
 // ActiveTexture and BindTexture combined for your convenience
@@ -75,6 +96,11 @@ void commandBindTexture(GLuint unit, GLenum target, GLuint texture);
 // the the draw calls
 void commandDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsizei offset, GLint basevertex);
 
+void commandDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, GLsizei offset, GLsizei instancecount, GLint basevertex);
+
+// counts and offsets are copied into the command buffer, all draws share basevertex
+void commandMultiDrawElementsBaseVertex(GLenum mode, const GLsizei *counts, GLenum type, const GLsizei *offsets, GLsizei drawcount, GLint basevertex);
+
 }
 
 #endif // COMMANDBUFFER_H
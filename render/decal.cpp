@@ -14,6 +14,9 @@ constexpr int MaxDecals = 512;
 // rough approximation, gets checked so we won't overflow
 constexpr int MaxDecalVertices = MaxDecals * 4;
 
+// each decal is a fan so it never has more than three indices per vertex
+static_assert(MaxDecalVertices * 3 <= MaxDecalIndices, "MaxDecalIndices is too small");
+
 struct DrawnDecal
 {
     GLuint texture;
@@ -65,13 +68,25 @@ void decalAdd(GLuint textureName, const gl3_brushvert_t *vertices, int vertexCou
     s_vertexCount += vertexCount;
 }
 
-int decalDrawAll(uint16_t *spanData, int spanOffsetBytes, int curIndexCount)
+void decalDrawAll()
 {
     if (!s_decalCount)
     {
-        return curIndexCount;
+        return;
+    }
+
+    // a span per brush model, sized for this one's decals
+    int totalIndexCount = 0;
+    for (int i = 0; i < s_decalCount; i++)
+    {
+        totalIndexCount += (s_decals[i].vertexCount - 2) * 3;
     }
 
+    GL3_ASSERT(totalIndexCount <= MaxDecalIndices);
+    BufferSpanT<uint16_t> indexSpan = dynamicIndexDataBegin<uint16_t>(totalIndexCount);
+    uint16_t *spanData = indexSpan.data;
+    int curIndexCount = 0;
+
     GL3_ASSERT((s_vertexSpan.byteOffset % sizeof(gl3_brushvert_t)) == 0);
     int baseVertex = s_vertexSpan.byteOffset / sizeof(gl3_brushvert_t);
 
@@ -79,6 +94,7 @@ int decalDrawAll(uint16_t *spanData, int spanOffsetBytes, int curIndexCount)
     s_vertexCount = 0;
 
     commandBindVertexBuffer(s_vertexSpan.buffer, g_brushVertexFormat);
+    commandBindIndexBuffer(indexSpan.buffer);
     s_vertexSpan.buffer = 0;
 
     commandBlendEnable(GL_TRUE);
@@ -91,7 +107,7 @@ int decalDrawAll(uint16_t *spanData, int spanOffsetBytes, int curIndexCount)
         const DrawnDecal *decal = &s_decals[i];
 
         const int indexCount = (decal->vertexCount - 2) * 3;
-        const int indexByteOffset = spanOffsetBytes + (curIndexCount * sizeof(uint16_t));
+        const int indexByteOffset = indexSpan.byteOffset + (curIndexCount * sizeof(uint16_t));
 
         const int vertexCount = decal->vertexCount;
         const int vertexOffset = decal->vertexOffset;
@@ -112,9 +128,8 @@ int decalDrawAll(uint16_t *spanData, int spanOffsetBytes, int curIndexCount)
     commandBlendEnable(GL_FALSE);
     commandDepthMask(GL_TRUE);
 
+    dynamicIndexDataEnd<uint16_t>(curIndexCount);
     s_decalCount = 0;
-
-    return curIndexCount;
 }
 
 }
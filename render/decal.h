@@ -13,9 +13,13 @@ void decalInit();
 // queue decals associated with this surface for rendering
 void decalAddFromSurface(gl3_worldmodel_t *model, gl3_surface_t *surface);
 
+// most indices decalDrawAll can write for one brush model
+constexpr int MaxDecalIndices = 512 * 4 * 3;
+
 // draw the queued decals, called for each brush model
 // relies on state set by the brush renderer (shaders, etc.)
-int decalDrawAll(uint16_t *spanData, int spanOffsetBytes, int curIndexCount);
+// the indices go to their own dynamic span, bound if there's anything to draw
+void decalDrawAll();
 
 // callback from internalSurfaceDecals
 void decalAdd(GLuint textureName, const gl3_brushvert_t *vertices, int vertexCount);
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "dynamicbuffer.h"
+#include "commandbuffer.h"
 
 namespace Render
 {
@@ -10,24 +11,99 @@ constexpr int BufferCount = 3;
 struct GLBuffer
 {
     GLuint handle;
+    int size;
+    int used; // bytes written this frame, set when the frame moves on from it
     uint8_t *mapped;
 };
 
 class DynamicBuffer
 {
     const GLenum m_target;
-    const int m_bufferSize;
+    const char *const m_name;
+    int m_bufferSize; // what the buffers get resized to when mapped
 
-    int m_offset{};
     GLBuffer m_buffers[BufferCount]{};
 
+    // chained after the main buffer when a frame runs out of space, freed once it's grown
+    std::vector<GLBuffer> m_overflow[BufferCount];
+
+    int m_chain{}; // 0 for the main buffer, otherwise m_overflow[m_chain - 1]
+    int m_offset{};
+    int m_highWater{}; // largest frame since the last grow
+
+    DynamicBufferStats m_stats{};
+
 #ifdef SCHIZO_DEBUG
     bool m_writingRegion{};
 #endif
 
+    GLBuffer &Current(int index)
+    {
+        return m_chain ? m_overflow[index][m_chain - 1] : m_buffers[index];
+    }
+
+    void Allocate(GLBuffer &buffer, int size)
+    {
+        if (!buffer.handle)
+        {
+            glGenBuffers(1, &buffer.handle);
+        }
+
+        glBindBuffer(m_target, buffer.handle);
+        glBufferData(m_target, size, nullptr, GL_STREAM_DRAW);
+        buffer.size = size;
+    }
+
+    void MapBuffer(GLBuffer &buffer)
+    {
+        GL3_ASSERT(!buffer.mapped);
+
+        glBindBuffer(m_target, buffer.handle);
+        void *mapped = glMapBufferRange(m_target, 0, buffer.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+        GL3_ASSERT(mapped);
+
+        buffer.mapped = static_cast<uint8_t *>(mapped);
+        buffer.used = 0;
+    }
+
+    void UnmapBuffer(GLBuffer &buffer)
+    {
+        GL3_ASSERT(buffer.mapped);
+
+        glBindBuffer(m_target, buffer.handle);
+        glFlushMappedBufferRange(m_target, 0, buffer.used);
+        glUnmapBuffer(m_target);
+        buffer.mapped = nullptr;
+    }
+
+    // the frame didn't fit, continue in the next buffer of the chain
+    void Chain(int index, int minSize)
+    {
+        Current(index).used = m_offset;
+
+        std::vector<GLBuffer> &overflow = m_overflow[index];
+        if (m_chain == static_cast<int>(overflow.size()))
+        {
+            overflow.push_back({});
+        }
+
+        m_chain++;
+        m_offset = 0;
+
+        GLBuffer &buffer = overflow[m_chain - 1];
+        int size = Q_max(m_bufferSize, minSize);
+        if (buffer.size < size)
+        {
+            Allocate(buffer, size);
+        }
+
+        MapBuffer(buffer);
+    }
+
 public:
-    DynamicBuffer(GLenum target, const int byteSize)
+    DynamicBuffer(GLenum target, const char *name, const int byteSize)
         : m_target{ target }
+        , m_name{ name }
         , m_bufferSize{ byteSize }
     {
     }
@@ -36,24 +112,43 @@ public:
     {
         for (GLBuffer &buffer : m_buffers)
         {
-            glGenBuffers(1, &buffer.handle);
-            glBindBuffer(m_target, buffer.handle);
-            glBufferData(m_target, m_bufferSize, nullptr, GL_STREAM_DRAW);
+            Allocate(buffer, m_bufferSize);
         }
+
+        m_stats.size = m_bufferSize;
     }
 
     void Map(int index)
     {
         GL3_ASSERT(index >= 0 && index < BufferCount);
+        GL3_ASSERT(m_chain == 0 && m_offset == 0);
+
+        // grow to fit the worst frame so far, the overflow buffers aren't needed after that
+        if (m_highWater > m_bufferSize)
+        {
+            while (m_bufferSize < m_highWater)
+            {
+                m_bufferSize *= 2;
+            }
+
+            m_stats.size = m_bufferSize;
+        }
+
         GLBuffer &buffer = m_buffers[index];
-        GL3_ASSERT(!buffer.mapped);
+        if (buffer.size < m_bufferSize)
+        {
+            Allocate(buffer, m_bufferSize);
 
-        glBindBuffer(m_target, buffer.handle);
-        void *mapped = glMapBufferRange(m_target, 0, m_bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
-        GL3_ASSERT(mapped);
+            for (GLBuffer &overflow : m_overflow[index])
+            {
+                commandFreeBuffer(overflow.handle);
+                glDeleteBuffers(1, &overflow.handle);
+            }
 
-        buffer.mapped = static_cast<uint8_t *>(mapped);
-        GL3_ASSERT(m_offset == 0);
+            m_overflow[index].clear();
+        }
+
+        MapBuffer(buffer);
     }
 
     void Unmap(int index)
@@ -67,31 +162,43 @@ public:
             }
         }
 
-        GLBuffer &buffer = m_buffers[index];
-        GL3_ASSERT(buffer.mapped);
+        Current(index).used = m_offset;
 
-        glBindBuffer(m_target, buffer.handle);
-        glFlushMappedBufferRange(m_target, 0, m_offset);
-        glUnmapBuffer(m_target);
-        buffer.mapped = nullptr;
+        int frameSize = 0;
+        for (int i = 0; i <= m_chain; i++)
+        {
+            GLBuffer &buffer = i ? m_overflow[index][i - 1] : m_buffers[index];
+            frameSize += buffer.used;
+            UnmapBuffer(buffer);
+        }
+
+        m_highWater = Q_max(m_highWater, frameSize);
+
+        m_stats.lastFrame = frameSize;
+        m_stats.peak = Q_max(m_stats.peak, frameSize);
+        if (m_chain)
+        {
+            m_stats.overflowFrames++;
+        }
 
 #ifdef SCHIZO_DEBUG
         switch (m_target)
         {
         case GL_ARRAY_BUFFER:
-            g_state.vertexBufferSize = m_offset;
+            g_state.vertexBufferSize = frameSize;
             break;
 
         case GL_ELEMENT_ARRAY_BUFFER:
-            g_state.indexBufferSize = m_offset;
+            g_state.indexBufferSize = frameSize;
             break;
 
         case GL_UNIFORM_BUFFER:
-            g_state.uniformBufferSize = m_offset;
+            g_state.uniformBufferSize = frameSize;
             break;
         }
 #endif
 
+        m_chain = 0;
         m_offset = 0;
     }
 
@@ -103,12 +210,12 @@ public:
 #endif
 
         m_offset = AlignUp(m_offset, alignment);
-        if (m_offset + maxSize > m_bufferSize)
+        if (m_offset + maxSize > Current(index).size)
         {
-            platformError("Dynamic GPU buffer overflow");
+            Chain(index, maxSize);
         }
 
-        GLBuffer &buffer = m_buffers[index];
+        GLBuffer &buffer = Current(index);
 
         BufferSpan span;
         span.buffer = buffer.handle;
@@ -118,7 +225,7 @@ public:
         return span;
     }
 
-    void EndRegion(int finalSize)
+    void EndRegion(int index, int finalSize)
     {
 #ifdef SCHIZO_DEBUG
         GL3_ASSERT(m_writingRegion);
@@ -126,9 +233,19 @@ public:
 #endif
 
         // m_offset was aligned by BeginRegion
-        GL3_ASSERT(m_offset + finalSize <= m_bufferSize);
+        GL3_ASSERT(m_offset + finalSize <= Current(index).size);
         m_offset += finalSize;
     }
+
+    const char *Name() const
+    {
+        return m_name;
+    }
+
+    const DynamicBufferStats &Stats() const
+    {
+        return m_stats;
+    }
 };
 
 // current index of the dynamic buffers, so [0, BufferCount[
@@ -136,12 +253,46 @@ static int s_bufferFrame;
 
 static int s_uniformBufferOffsetAlignment;
 
-static DynamicBuffer s_vertex{ GL_ARRAY_BUFFER, 1 << 19 };
-static DynamicBuffer s_index{ GL_ELEMENT_ARRAY_BUFFER, 1 << 19 };
-static DynamicBuffer s_uniform{ GL_UNIFORM_BUFFER, 1 << 19 };
+// starting sizes, they grow to fit the busiest frame. gl3_dynamic_buffers shows what they got to
+static DynamicBuffer s_vertex{ GL_ARRAY_BUFFER, "vertex", 1 << 19 };
+static DynamicBuffer s_index{ GL_ELEMENT_ARRAY_BUFFER, "index", 1 << 19 };
+static DynamicBuffer s_uniform{ GL_UNIFORM_BUFFER, "uniform", 1 << 19 };
+
+// in DynamicBufferType order
+static DynamicBuffer *const s_buffers[] = { &s_vertex, &s_index, &s_uniform };
+
+// uniform blocks uploaded this frame by content, lots of entities end up with the
+// same constants and can share a range. direct mapped, a collision replaces the entry
+constexpr int UniformCacheSize = 256;
+
+struct UniformCacheEntry
+{
+    uint64_t hash;
+    int size; // 0 if unused
+    BufferSpan span;
+};
+
+static UniformCacheEntry s_uniformCache[UniformCacheSize];
+
+static void DynamicBuffers()
+{
+    for (int i = 0; i < DynamicBufferCount; i++)
+    {
+        const DynamicBufferStats &stats = s_buffers[i]->Stats();
+
+        g_engfuncs.Con_Printf("%s: %d KB, last frame %d KB, peak %d KB, %d frames overflowed\n",
+            s_buffers[i]->Name(),
+            stats.size / 1024,
+            stats.lastFrame / 1024,
+            stats.peak / 1024,
+            stats.overflowFrames);
+    }
+}
 
 void dynamicBuffersInit()
 {
+    g_engfuncs.pfnAddCommand("gl3_dynamic_buffers", DynamicBuffers);
+
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &s_uniformBufferOffsetAlignment);
 
     s_vertex.Init();
@@ -154,6 +305,12 @@ void dynamicBuffersMap()
     s_vertex.Map(s_bufferFrame);
     s_index.Map(s_bufferFrame);
     s_uniform.Map(s_bufferFrame);
+
+    // the ranges are from the previous buffer
+    for (UniformCacheEntry &entry : s_uniformCache)
+    {
+        entry.size = 0;
+    }
 }
 
 void dynamicBuffersUnmap()
@@ -171,7 +328,7 @@ BufferSpan dynamicVertexDataBegin(int maxVertexCount, int vertexSize)
 
 void dynamicVertexDataEnd(int actualVertexCount, int vertexSize)
 {
-    s_vertex.EndRegion(actualVertexCount * vertexSize);
+    s_vertex.EndRegion(s_bufferFrame, actualVertexCount * vertexSize);
 }
 
 BufferSpan dynamicIndexDataBegin(int maxIndexCount, int indexSize)
@@ -181,15 +338,51 @@ BufferSpan dynamicIndexDataBegin(int maxIndexCount, int indexSize)
 
 void dynamicIndexDataEnd(int actualIndexCount, int indexSize)
 {
-    s_index.EndRegion(actualIndexCount * indexSize);
+    s_index.EndRegion(s_bufferFrame, actualIndexCount * indexSize);
 }
 
 BufferSpan dynamicUniformData(const void *data, int size)
 {
+    // the mapping is write only so the hash is all there is to compare
+    uint64_t hash = HashBytes64(HashSeed64, data, size);
+    UniformCacheEntry &entry = s_uniformCache[hash % UniformCacheSize];
+
+    if (entry.size == size && entry.hash == hash)
+    {
+        return entry.span;
+    }
+
     BufferSpan result = s_uniform.BeginRegion(s_bufferFrame, size, s_uniformBufferOffsetAlignment);
     memcpy(result.data, data, size);
-    s_uniform.EndRegion(size);
+    s_uniform.EndRegion(s_bufferFrame, size);
+
+    entry.hash = hash;
+    entry.size = size;
+    entry.span = result;
+
     return result;
 }
 
+BufferSpan dynamicUniformBegin(int size)
+{
+    return s_uniform.BeginRegion(s_bufferFrame, size, s_uniformBufferOffsetAlignment);
+}
+
+void dynamicUniformEnd(int size)
+{
+    s_uniform.EndRegion(s_bufferFrame, size);
+}
+
+const DynamicBufferStats &dynamicBufferStats(DynamicBufferType type)
+{
+    GL3_ASSERT(type >= 0 && type < DynamicBufferCount);
+    return s_buffers[type]->Stats();
+}
+
+const char *dynamicBufferName(DynamicBufferType type)
+{
+    GL3_ASSERT(type >= 0 && type < DynamicBufferCount);
+    return s_buffers[type]->Name();
+}
+
 }
@@ -13,19 +13,46 @@ struct BufferSpanT
 
 using BufferSpan = BufferSpanT<void>;
 
+enum DynamicBufferType
+{
+    DynamicVertex,
+    DynamicIndex,
+    DynamicUniform,
+    DynamicBufferCount
+};
+
+// the buffers grow to fit the busiest frame when they're next mapped, a frame
+// that doesn't fit continues in extra buffers chained after the main one
+struct DynamicBufferStats
+{
+    int size; // of each of the triple buffered buffers
+    int lastFrame; // bytes written
+    int peak; // most bytes written in a frame
+    int overflowFrames; // frames that needed the extra buffers
+};
+
 void dynamicBuffersInit();
 
 void dynamicBuffersMap();
 void dynamicBuffersUnmap();
 
+const DynamicBufferStats &dynamicBufferStats(DynamicBufferType type);
+const char *dynamicBufferName(DynamicBufferType type);
+
 BufferSpan dynamicVertexDataBegin(int maxVertexCount, int vertexSize);
 void dynamicVertexDataEnd(int actualVertexCount, int vertexSize);
 BufferSpan dynamicIndexDataBegin(int maxIndexCount, int indexSize);
 void dynamicIndexDataEnd(int actualIndexCount, int indexSize);
 
-// this can cause redundant copying, but is easier to use
+// this can cause redundant copying, but is easier to use. a block identical to one
+// uploaded earlier in the frame returns the same range, so don't write through span.data
 BufferSpan dynamicUniformData(const void *data, int size);
 
+// for writing the block straight into the buffer. these skip the sharing dynamicUniformData
+// does, and the mapping is write only so don't read back what was written
+BufferSpan dynamicUniformBegin(int size);
+void dynamicUniformEnd(int size);
+
 template<typename VertexType>
 BufferSpanT<VertexType> dynamicVertexDataBegin(int maxVertexCount)
 {
@@ -52,6 +79,19 @@ void dynamicIndexDataEnd(int actualIndexCount)
     dynamicIndexDataEnd(actualIndexCount, sizeof(IndexType));
 }
 
+template<typename BlockType>
+BufferSpanT<BlockType> dynamicUniformBegin(int count = 1)
+{
+    BufferSpan span = dynamicUniformBegin(count * static_cast<int>(sizeof(BlockType)));
+    return { span.buffer, span.byteOffset, static_cast<BlockType *>(span.data) };
+}
+
+template<typename BlockType>
+void dynamicUniformEnd(int count = 1)
+{
+    dynamicUniformEnd(count * static_cast<int>(sizeof(BlockType)));
+}
+
 }
 
 #endif
@@ -4,6 +4,7 @@
 #include "sprite.h"
 #include "brush.h"
 #include "internal.h"
+#include "studio_misc.h"
 #include "studio_render.h"
 #include "studio_proxy.h"
 
@@ -12,34 +13,56 @@ extern "C" int HUD_AddEntity(int, cl_entity_t *, const char *);
 namespace Render
 {
 
-constexpr int BucketSize = 512;
-
-enum BucketIndex
+// everything added in a frame goes in one queue, sorted so each pass is a contiguous
+// range and the draws within it are ordered to keep state changes down
+enum RenderPass
 {
-    BucketBrushSolid,
-    BucketBrushAlphaTest,
-    BucketStudioSolid,
-    BucketSpriteSolid,
-    BucketTranslucent,
-    BucketBeam,
-    BucketCount
+    PassBrushSolid,
+    PassBrushAlphaTest,
+    PassSpriteSolid,
+    PassStudioSolid,
+    PassTranslucent,
+    PassBeam,
+    PassCount,
+
+    // outside the view this time, sorts after everything else
+    PassCulled = 15
 };
 
-struct Bucket
+// key layout, most significant bits first:
+// solid:       pass:4 model:24 skin:4 depth:32 (front to back)
+// translucent: pass:4 ~depth:32 order:28 (back to front, ties in the order added)
+// beam:        pass:4 order:60
+constexpr int PassShift = 60;
+
+struct QueueItem
 {
-    int count;
-    cl_entity_t *entities[BucketSize];
+    uint64_t key;
+    cl_entity_t *entity;
+    RenderPass pass; // the pass it was added to, the key might say PassCulled
 };
 
-static Bucket s_buckets[BucketCount];
+static std::vector<QueueItem> s_queue;
+static std::vector<QueueItem> s_sortTemp;
 
-static void AddToBucket(BucketIndex index, cl_entity_t *entity)
+// entities in sorted order, passes index into this
+static std::vector<cl_entity_t *> s_sortedEntities;
+static int s_passBegin[PassCount + 1];
+
+static void AddToQueue(RenderPass pass, cl_entity_t *entity)
 {
-    Bucket &bucket = s_buckets[index];
-    if (bucket.count < BucketSize)
-    {
-        bucket.entities[bucket.count++] = entity;
-    }
+    s_queue.push_back({ static_cast<uint64_t>(pass) << PassShift, entity, pass });
+}
+
+static RenderPass KeyPass(uint64_t key)
+{
+    return static_cast<RenderPass>(key >> PassShift);
+}
+
+static cl_entity_t **PassEntities(RenderPass pass, int &count)
+{
+    count = s_passBegin[pass + 1] - s_passBegin[pass];
+    return s_sortedEntities.data() + s_passBegin[pass];
 }
 
 static float EntityDistanceSquared(cl_entity_t *entity, const Vector3 &point)
@@ -52,33 +75,276 @@ static float EntityDistanceSquared(cl_entity_t *entity, const Vector3 &point)
     return Dot(temp, temp);
 }
 
-static bool DistanceCompare(const cl_entity_t *const entity1, const cl_entity_t *const entity2)
+// positive floats compare the same as their bit patterns
+static uint32_t DepthBits(float distanceSquared)
+{
+    uint32_t bits;
+    memcpy(&bits, &distanceSquared, sizeof(bits));
+    return bits;
+}
+
+static uint64_t SortKey(const QueueItem &item, int order, const Vector3 &cameraPosition)
+{
+    RenderPass pass = item.pass;
+    uint64_t key = static_cast<uint64_t>(pass) << PassShift;
+
+    if (pass == PassBeam)
+    {
+        return key | static_cast<uint64_t>(order);
+    }
+
+    cl_entity_t *entity = item.entity;
+    uint64_t depth = DepthBits(EntityDistanceSquared(entity, cameraPosition));
+
+    if (pass == PassTranslucent)
+    {
+        return key | ((~depth & 0xffffffff) << 28) | (static_cast<uint64_t>(order) & 0x0fffffff);
+    }
+
+    // same model means same buffers and textures, skin picks between texture sets
+    uint64_t model = (reinterpret_cast<uintptr_t>(entity->model) >> 2) & 0xffffff;
+    uint64_t skin = entity->curstate.skin & 0xf;
+    return key | (model << 36) | (skin << 32) | depth;
+}
+
+static void InsertionSort(QueueItem *items, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        QueueItem item = items[i];
+
+        int j = i;
+        for (; j > 0 && items[j - 1].key > item.key; j--)
+        {
+            items[j] = items[j - 1];
+        }
+
+        items[j] = item;
+    }
+}
+
+// lsd radix sort on bytes, bytes that are the same for every key are skipped
+static void RadixSort(std::vector<QueueItem> &items, std::vector<QueueItem> &temp)
+{
+    int count = static_cast<int>(items.size());
+    temp.resize(count);
+
+    int histograms[8][256]{};
+
+    for (const QueueItem &item : items)
+    {
+        for (int digit = 0; digit < 8; digit++)
+        {
+            histograms[digit][(item.key >> (digit * 8)) & 0xff]++;
+        }
+    }
+
+    QueueItem *source = items.data();
+    QueueItem *dest = temp.data();
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        int *histogram = histograms[digit];
+        int shift = digit * 8;
+
+        if (histogram[(source[0].key >> shift) & 0xff] == count)
+        {
+            continue;
+        }
+
+        int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            int bucketCount = histogram[i];
+            histogram[i] = offset;
+            offset += bucketCount;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            dest[histogram[(source[i].key >> shift) & 0xff]++] = source[i];
+        }
+
+        std::swap(source, dest);
+    }
+
+    if (source != items.data())
+    {
+        memcpy(items.data(), source, count * sizeof(QueueItem));
+    }
+}
+
+static bool IsSorted(const std::vector<QueueItem> &items)
+{
+    for (size_t i = 1; i < items.size(); i++)
+    {
+        if (items[i - 1].key > items[i].key)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// boxes waiting to be culled, four at a time
+struct CullBatch
+{
+    int count;
+    int items[4];
+    alignas(16) float center[3][4];
+    alignas(16) float extents[3][4];
+};
+
+static void CullBatchFlush(CullBatch &batch)
+{
+    if (!batch.count)
+    {
+        return;
+    }
+
+    // unused lanes repeat the last box
+    for (int i = batch.count; i < 4; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            batch.center[j][i] = batch.center[j][batch.count - 1];
+            batch.extents[j][i] = batch.extents[j][batch.count - 1];
+        }
+    }
+
+    __m128 center[3], extents[3];
+    for (int j = 0; j < 3; j++)
+    {
+        center[j] = _mm_load_ps(batch.center[j]);
+        extents[j] = _mm_load_ps(batch.extents[j]);
+    }
+
+    int outside = g_state.viewFrustum.CullBoxes4(center, extents);
+
+    for (int i = 0; i < batch.count; i++)
+    {
+        if (outside & (1 << i))
+        {
+            s_queue[batch.items[i]].key = static_cast<uint64_t>(PassCulled) << PassShift;
+        }
+    }
+
+    batch.count = 0;
+}
+
+static bool EntityBounds(cl_entity_t *entity, Vector3 &center, Vector3 &extents)
+{
+    switch (entity->model->type)
+    {
+    case mod_brush:
+        brushEntityBounds(entity, center, extents);
+        return true;
+
+    case mod_studio:
+        return studioEntityBounds(entity, center, extents);
+
+    default:
+        // sprites are cheap to cull when drawn
+        return false;
+    }
+}
+
+// done here so off-screen studio models never get to the game's bone setup
+static void CullQueue()
 {
-    return entity1->syncbase > entity2->syncbase;
+    CullBatch batch;
+    batch.count = 0;
+
+    int count = static_cast<int>(s_queue.size());
+
+    for (int i = 0; i < count; i++)
+    {
+        QueueItem &item = s_queue[i];
+        if (item.pass == PassBeam)
+        {
+            continue;
+        }
+
+        Vector3 center, extents;
+        if (!EntityBounds(item.entity, center, extents))
+        {
+            continue;
+        }
+
+        int lane = batch.count++;
+        batch.items[lane] = i;
+
+        for (int j = 0; j < 3; j++)
+        {
+            batch.center[j][lane] = center.Get(j);
+            batch.extents[j][lane] = extents.Get(j);
+        }
+
+        if (batch.count == 4)
+        {
+            CullBatchFlush(batch);
+        }
+    }
+
+    CullBatchFlush(batch);
 }
 
-void entitySortTranslucents(const Vector3 &cameraPosition)
+void entitySortQueue(const Vector3 &cameraPosition)
 {
-    // sort translucent entities the same way the engine does
-    Bucket &bucket = s_buckets[BucketTranslucent];
+    int count = static_cast<int>(s_queue.size());
 
-    // fucked: store entity distance in syncbase
-    for (int i = 0; i < bucket.count; i++)
+    for (int i = 0; i < count; i++)
     {
-        cl_entity_t *entity = bucket.entities[i];
-        GL3_ASSERT(entity->syncbase == 0.0f);
-        entity->syncbase = EntityDistanceSquared(entity, cameraPosition);
+        QueueItem &item = s_queue[i];
+        item.key = SortKey(item, i, cameraPosition);
     }
 
-    std::sort(bucket.entities, bucket.entities + bucket.count, DistanceCompare);
+    CullQueue();
+
+    // an unchanged view with the same entities comes out in the same order, and the queue
+    // keeps the sorted order so later passes in the same frame hit this too
+    if (!IsSorted(s_queue))
+    {
+        if (count <= 32)
+        {
+            InsertionSort(s_queue.data(), count);
+        }
+        else
+        {
+            RadixSort(s_queue, s_sortTemp);
+        }
+    }
+
+    s_sortedEntities.resize(count);
+
+    int pass = 0;
+    s_passBegin[0] = 0;
+
+    int i = 0;
+    for (; i < count; i++)
+    {
+        const QueueItem &item = s_queue[i];
+
+        RenderPass itemPass = KeyPass(item.key);
+        if (itemPass == PassCulled)
+        {
+            // only culled ones left
+            break;
+        }
+
+        s_sortedEntities[i] = item.entity;
 
-#ifdef SCHIZO_DEBUG
-    for (int i = 0; i < bucket.count; i++)
+        while (pass < itemPass)
+        {
+            s_passBegin[++pass] = i;
+        }
+    }
+
+    while (pass < PassCount)
     {
-        cl_entity_t *entity = bucket.entities[i];
-        entity->syncbase = 0.0f;
+        s_passBegin[++pass] = i;
     }
-#endif
 }
 
 void entityDrawViewmodel(int drawFlags)
@@ -300,11 +566,12 @@ void entityDrawTranslucentEntities(const Vector3 &viewOrigin, const Vector3 &vie
 {
     const EntityHandlers *handler = nullptr;
 
-    Bucket &bucket = s_buckets[BucketTranslucent];
+    int count;
+    cl_entity_t **entities = PassEntities(PassTranslucent, count);
 
-    for (int i = 0; i < bucket.count; i++)
+    for (int i = 0; i < count; i++)
     {
-        cl_entity_t *entity = bucket.entities[i];
+        cl_entity_t *entity = entities[i];
 
         int renderamt = entityUpdateRenderAmt(entity, viewOrigin, viewForward);
         if (!renderamt)
@@ -342,36 +609,39 @@ void entityDrawTranslucentEntities(const Vector3 &viewOrigin, const Vector3 &vie
 
 void entityDrawSolidBrushes()
 {
-    Bucket &solid = s_buckets[BucketBrushSolid];
-    Bucket &alpha = s_buckets[BucketBrushAlphaTest];
-    brushDrawSolids(solid.entities, solid.count, alpha.entities, alpha.count);
+    int solidCount, alphaCount;
+    cl_entity_t **solid = PassEntities(PassBrushSolid, solidCount);
+    cl_entity_t **alpha = PassEntities(PassBrushAlphaTest, alphaCount);
+    brushDrawSolids(solid, solidCount, alpha, alphaCount);
 }
 
 void entityDrawSolidEntities()
 {
-    const Bucket &sprites = s_buckets[BucketSpriteSolid];
-    if (sprites.count)
+    int spriteCount;
+    cl_entity_t **sprites = PassEntities(PassSpriteSolid, spriteCount);
+    if (spriteCount)
     {
         spriteBegin(false);
 
-        for (int i = 0; i < sprites.count; i++)
+        for (int i = 0; i < spriteCount; i++)
         {
             // setting renderamt to 1 matches the engine
-            spriteDraw(sprites.entities[i], 1.0f);
+            spriteDraw(sprites[i], 1.0f);
         }
 
         spriteEnd();
     }
 
     // solid studio models might still enable blending thanks to czero, so draw them last
-    const Bucket &studios = s_buckets[BucketStudioSolid];
-    if (studios.count)
+    int studioCount;
+    cl_entity_t **studios = PassEntities(PassStudioSolid, studioCount);
+    if (studioCount)
     {
         studioBeginModels(false);
 
-        for (int i = 0; i < studios.count; i++)
+        for (int i = 0; i < studioCount; i++)
         {
-            studioProxyDrawEntity(STUDIO_RENDER | STUDIO_EVENTS, studios.entities[i], 1.0f);
+            studioProxyDrawEntity(STUDIO_RENDER | STUDIO_EVENTS, studios[i], 1.0f);
         }
 
         studioEndModels();
@@ -388,7 +658,7 @@ int AddEntity(int type, struct cl_entity_s *entity)
 
     if (type == ET_BEAM)
     {
-        AddToBucket(BucketBeam, entity);
+        AddToQueue(PassBeam, entity);
         return 1;
     }
 
@@ -406,7 +676,7 @@ int AddEntity(int type, struct cl_entity_s *entity)
         return 1;
     }
 
-    BucketIndex bucketIndex;
+    RenderPass pass;
 
     // check if it's translucent
     // all sprites are considered translucent (unless gl_spriteblend is 0)
@@ -415,12 +685,12 @@ int AddEntity(int type, struct cl_entity_s *entity)
         // alpha tested bruh models are not translucent so they're have they're own bucket
         if (model->type == mod_brush && entity->curstate.rendermode == kRenderTransAlpha)
         {
-            bucketIndex = BucketBrushAlphaTest;
+            pass = PassBrushAlphaTest;
         }
         else
         {
             // i guess
-            bucketIndex = BucketTranslucent;
+            pass = PassTranslucent;
         }
     }
     else
@@ -429,15 +699,15 @@ int AddEntity(int type, struct cl_entity_s *entity)
         switch (model->type)
         {
         case mod_brush:
-            bucketIndex = BucketBrushSolid;
+            pass = PassBrushSolid;
             break;
 
         case mod_studio:
-            bucketIndex = BucketStudioSolid;
+            pass = PassStudioSolid;
             break;
 
         case mod_sprite:
-            bucketIndex = BucketSpriteSolid;
+            pass = PassSpriteSolid;
             break;
 
         default:
@@ -446,7 +716,7 @@ int AddEntity(int type, struct cl_entity_s *entity)
         }
     }
 
-    AddToBucket(bucketIndex, entity);
+    AddToQueue(pass, entity);
     return 1;
 }
 
@@ -470,19 +740,30 @@ AddEntityCallback GetAddEntityCallback(AddEntityCallback original)
     return AddVisibleTempEntity;
 }
 
-void entityClearBuckets()
+void entityClearQueue()
 {
-    for (Bucket &bucket : s_buckets)
-    {
-        bucket.count = 0;
-    }
+    // keeps the capacity
+    s_queue.clear();
+    s_sortedEntities.clear();
+    memset(s_passBegin, 0, sizeof(s_passBegin));
 }
 
 cl_entity_t **entityGetBeams(int &count)
 {
-    Bucket &bucket = s_buckets[BucketBeam];
-    count = bucket.count;
-    return bucket.entities;
+    return PassEntities(PassBeam, count);
+}
+
+int entityGetAdded(cl_entity_t **entities, int *types, int maxCount)
+{
+    int count = Q_min(static_cast<int>(s_queue.size()), maxCount);
+
+    for (int i = 0; i < count; i++)
+    {
+        entities[i] = s_queue[i].entity;
+        types[i] = (s_queue[i].pass == PassBeam) ? ET_BEAM : ET_NORMAL;
+    }
+
+    return count;
 }
 
 }
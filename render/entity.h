@@ -4,8 +4,10 @@
 namespace Render
 {
 
-// sort translucent entities based on distance to viewer
-void entitySortTranslucents(const Vector3 &cameraPosition);
+// frustum cull and sort everything added this frame, solids front to back grouped
+// by model and translucents back to front like the engine does
+// needs the view frustum for this frame to be set up
+void entitySortQueue(const Vector3 &cameraPosition);
 
 // draw the world and solid brush entities
 void entityDrawSolidBrushes();
@@ -23,11 +25,14 @@ void entityDrawViewmodel(int drawFlags);
 int entityUpdateRenderAmt(cl_entity_t *entity, const Vector3 &origin, const Vector3 &forward);
 
 // clears all entities marked to draw this frame
-void entityClearBuckets();
+void entityClearQueue();
 
 // get beam entities added for this frame
 cl_entity_t **entityGetBeams(int &count);
 
+// every entity added this frame along with the type it was added as, for frame capture
+int entityGetAdded(cl_entity_t **entities, int *types, int maxCount);
+
 }
 
 #endif
@@ -31,9 +31,18 @@ struct LightmapSamples
     LightmapSample samples[MAXLIGHTMAPS];
 };
 
+// what studio model lighting samples below a point, see lightProbeTrace
+struct LightProbe
+{
+    LightmapSamples sample;
+    LightmapSamples intensity[4]; // 16 units off diagonally, for the light direction
+};
+
 // pulling data from the engine worldmodel
 bool internalLoadBrushModel(model_t *model, gl3_worldmodel_t *outModel);
-gl3_brushvert_t *internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *outModel, int &vertexCount, TempMemoryScope &temp);
+
+// doesn't touch gl or the engine, safe to run on a worker
+void internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *outModel, std::vector<gl3_brushvert_t> &vertices);
 
 // clips decals, calls decalAdd
 void internalSurfaceDecals(gl3_worldmodel_t *model, int surfaceIndex);
@@ -45,7 +54,9 @@ bool internalGetSpriteInfo(model_t *model, int frameIndex, SpriteInfo *result);
 
 // for studio model lighting...
 bool internalTraceLineToSky(model_t *model, const Vector3 &start, const Vector3 &end);
+bool internalTraceLineHitsSurface(model_t *model, const Vector3 &start, const Vector3 &end);
 LightmapSamples internalSampleLightmap( model_t *model, const Vector3 &start, const Vector3 &end);
+int internalPointContents(model_t *model, const Vector3 &point);
 
 // sets cl.weaponstarttime and cl.weaponsequence
 void internalUpdateViewmodelAnimation(cl_entity_t *viewmodel);
@@ -8,6 +8,7 @@
 #include "decalclip.h"
 #include "triapigl3.h"
 #include "decal.h"
+#include "job.h"
 
 // warning: this file sucks
 
@@ -763,65 +764,31 @@ bool internalLoadBrushModel(model_t *model, gl3_worldmodel_t *outModel)
         }
     }
 
-    // sigh, i guess we do this here: determine maximum amount of indices an inline model might have
-    for (int i = 0; i < src.numsubmodels; i++)
-    {
-        goldsrc::dmodel_t &submodel = src.submodels[i];
-        gl3_surface_t *begin = &outModel->surfaces[submodel.firstface];
-        gl3_surface_t *end = begin + submodel.numfaces;
-
-        int indexCount = 0;
-
-        for (gl3_surface_t *surface = begin; surface != end; surface++)
-        {
-            indexCount += (surface->numverts - 2) * 3;
-        }
-
-        outModel->max_submodel_index_count = Q_max(outModel->max_submodel_index_count, indexCount);
-    }
-
     return true;
 }
 
-gl3_brushvert_t *internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *outModel, int &vertexCount, TempMemoryScope &temp)
+struct VertexBufferBuild
 {
-    const goldsrc::model_t &engineModel = *reinterpret_cast<const goldsrc::model_t *>(model);
-
-    // count vertices in this model
-    int num_verts = 0;
-    int num_indices = 0;
-
-    // associate surfaces with textures
-    std::vector<std::vector<int>> textureSurfaceIndices;
-    textureSurfaceIndices.resize(outModel->numtextures);
-
-    for (int j = 0; j < engineModel.numsurfaces; j++)
-    {
-        const goldsrc::msurface_t *surface = GetSurface(&engineModel, j);
-        num_verts += surface->numedges;
-        num_indices += (surface->numedges - 2) * 3;
-
-        gl3_surface_t *dest = &outModel->surfaces[j];
-        gl3_texture_t *texture = dest->texture;
-        int textureIndex = texture - outModel->textures;
-        textureSurfaceIndices[textureIndex].push_back(j);
-    }
-
-    // this will be the maximum index count we could possibly draw
-    outModel->max_index_count = num_indices;
-
-    // temporary memory for vbo contents
-    gl3_brushvert_t *vertex_buffer = temp.Alloc<gl3_brushvert_t>(num_verts);
-
-    // same loop again for populating the vertex buffer
-    int vert_offset = 0;
+    const goldsrc::model_t *engineModel;
+    gl3_worldmodel_t *outModel;
+    gl3_brushvert_t *vertexBuffer;
+    const std::vector<std::vector<int>> *textureSurfaceIndices;
+};
+
+// textures own disjoint vertex ranges, so they can be filled in on any thread
+static void BuildTextureVertices(void *context, int begin, int end)
+{
+    const VertexBufferBuild &build = *static_cast<const VertexBufferBuild *>(context);
+    const goldsrc::model_t &engineModel = *build.engineModel;
+    gl3_worldmodel_t *outModel = build.outModel;
+    gl3_brushvert_t *vertex_buffer = build.vertexBuffer;
 
-    for (int texid = 0; texid < outModel->numtextures; texid++)
+    for (int texid = begin; texid < end; texid++)
     {
-        int basevertex = vert_offset;
-        outModel->textures[texid].basevertex = basevertex;
+        int basevertex = outModel->textures[texid].basevertex;
+        int vert_offset = basevertex;
 
-        std::vector<int> &surfids = textureSurfaceIndices[texid];
+        const std::vector<int> &surfids = (*build.textureSurfaceIndices)[texid];
         for (int j : surfids)
         {
             const goldsrc::msurface_t *surface = GetSurface(&engineModel, j);
@@ -864,8 +831,7 @@ gl3_brushvert_t *internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *out
                 float s = Dot(vertex->position, texinfo->vec_s) + texinfo->dist_s;
                 float t = Dot(vertex->position, texinfo->vec_t) + texinfo->dist_t;
 
-                // set the lightmap width later
-                vertex_buffer[vert_offset + k].position = { vertex->position, 0 };
+                vertex_buffer[vert_offset + k].position = vertex->position;
 
                 vertex_buffer[vert_offset + k].texCoord.x = s / texture_width;
                 vertex_buffer[vert_offset + k].texCoord.y = t / texture_height;
@@ -883,6 +849,43 @@ gl3_brushvert_t *internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *out
 
             vert_offset += surface->numedges;
         }
+    }
+}
+
+void internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *outModel, std::vector<gl3_brushvert_t> &vertices)
+{
+    const goldsrc::model_t &engineModel = *reinterpret_cast<const goldsrc::model_t *>(model);
+
+    // count vertices in this model
+    int num_verts = 0;
+
+    // associate surfaces with textures
+    std::vector<std::vector<int>> textureSurfaceIndices;
+    textureSurfaceIndices.resize(outModel->numtextures);
+
+    for (int j = 0; j < engineModel.numsurfaces; j++)
+    {
+        const goldsrc::msurface_t *surface = GetSurface(&engineModel, j);
+        num_verts += surface->numedges;
+
+        gl3_surface_t *dest = &outModel->surfaces[j];
+        gl3_texture_t *texture = dest->texture;
+        int textureIndex = texture - outModel->textures;
+        textureSurfaceIndices[textureIndex].push_back(j);
+    }
+
+    // lay out the per-texture ranges first so the textures can be filled in parallel
+    int vert_offset = 0;
+
+    for (int texid = 0; texid < outModel->numtextures; texid++)
+    {
+        int basevertex = vert_offset;
+        outModel->textures[texid].basevertex = basevertex;
+
+        for (int j : textureSurfaceIndices[texid])
+        {
+            vert_offset += GetSurface(&engineModel, j)->numedges;
+        }
 
         int vert_count = vert_offset - basevertex;
         if (vert_count > UINT16_MAX)
@@ -892,8 +895,12 @@ gl3_brushvert_t *internalBuildVertexBuffer(model_t *model, gl3_worldmodel_t *out
     }
 
     GL3_ASSERT(vert_offset == num_verts);
-    vertexCount = num_verts;
-    return vertex_buffer;
+
+    // vbo contents, kept until the upload
+    vertices.assign(num_verts, gl3_brushvert_t{});
+
+    VertexBufferBuild build{ &engineModel, outModel, vertices.data(), &textureSurfaceIndices };
+    jobParallelFor(outModel->numtextures, 8, BuildTextureVertices, &build);
 }
 
 template struct DecalClip<goldsrc::glvert_t>;
@@ -984,8 +991,6 @@ void internalSurfaceDecals(gl3_worldmodel_t *model, int surfaceIndex)
         // NOTE: GetDecalVertices only sets position and texcoords, we need to fill the rest
         for (int i = 0; i < vertexCount; i++)
         {
-            vertices[i].position.w = (float)fatsurface->lightmap_width / model->lightmap_width;
-
             vertices[i].lightmapTexCoord[0] = PACK_U16((float)(vertices[i].lightmapTexCoord[0] + (fatsurface->lightmap_x * 16) + 8) / (model->lightmap_width * 16));
             vertices[i].lightmapTexCoord[1] = PACK_U16((float)(vertices[i].lightmapTexCoord[1] + (fatsurface->lightmap_y * 16) + 8) / (model->lightmap_height * 16));
 
@@ -993,6 +998,8 @@ void internalSurfaceDecals(gl3_worldmodel_t *model, int surfaceIndex)
             {
                 vertices[i].styles[j] = fatsurface->styles[j];
             }
+
+            brushPackLightmapWidth(vertices[i].styles, fatsurface->lightmap_width);
         }
 
         if (vertexCount != 0)
@@ -1134,6 +1141,12 @@ bool internalTraceLineToSky(model_t *_model, const Vector3 &start, const Vector3
     return true;
 }
 
+bool internalTraceLineHitsSurface(model_t *_model, const Vector3 &start, const Vector3 &end)
+{
+    goldsrc::model_t *model = (goldsrc::model_t *)_model;
+    return TraceLineToSurface(model, model->nodes, start, end) != nullptr;
+}
+
 static bool SampleLightmap(LightmapSamples &result, goldsrc::model_t *model, goldsrc::mnode_t *node, const Vector3 &start, const Vector3 &end)
 {
     while (true)
@@ -1266,6 +1279,21 @@ LightmapSamples internalSampleLightmap(model_t *_model, const Vector3 &start, co
     return samples;
 }
 
+int internalPointContents(model_t *_model, const Vector3 &point)
+{
+    goldsrc::model_t *model = (goldsrc::model_t *)_model;
+    goldsrc::mnode_t *node = model->nodes;
+
+    // leafs share the contents field with the nodes
+    while (node->contents >= 0)
+    {
+        float dist = Dot(point, node->plane->normal) - node->plane->dist;
+        node = node->children[dist < 0];
+    }
+
+    return node->contents;
+}
+
 void internalUpdateViewmodelAnimation(cl_entity_t *viewmodel)
 {
     // a 100% reliable way to get pointers to cl.weaponstarttime and cl.weaponsequence
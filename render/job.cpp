@@ -0,0 +1,364 @@
+#include "stdafx.h"
+#include "job.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace Render
+{
+
+// more than this doesn't help with anything we do
+constexpr int JobMaxWorkers = 7;
+
+struct Job
+{
+    JobFunction function;
+    void *context;
+    int begin;
+    int end;
+    JobCounter *counter;
+};
+
+// one per thread, index 0 belongs to the main thread
+struct JobQueue
+{
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+struct MainThreadCall
+{
+    MainThreadFunction function;
+    void *context;
+    JobCounter *counter;
+};
+
+struct JobSystem
+{
+    int workerCount;
+    JobQueue queues[JobMaxWorkers + 1];
+    std::thread threads[JobMaxWorkers];
+    std::thread::id threadIds[JobMaxWorkers + 1];
+
+    // jobs sitting in the queues, workers sleep while this is zero
+    std::atomic<int> queuedJobs{};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool quit;
+
+    std::mutex mainThreadMutex;
+    std::vector<MainThreadCall> mainThreadCalls;
+    std::vector<MainThreadCall> mainThreadRunning;
+};
+
+// heap allocated and never freed in the dll, the engine doesn't tell us
+// when it's unloading and destroying this under a sleeping worker would be bad
+static JobSystem *s_jobs;
+
+static int ThreadIndex()
+{
+    std::thread::id id = std::this_thread::get_id();
+
+    for (int i = 0; i <= s_jobs->workerCount; i++)
+    {
+        if (s_jobs->threadIds[i] == id)
+        {
+            return i;
+        }
+    }
+
+    // some thread we didn't create
+    GL3_ASSERT(false);
+    return 0;
+}
+
+static bool TakeJob(int index, Job &job)
+{
+    if (s_jobs->queuedJobs.load() <= 0)
+    {
+        return false;
+    }
+
+    // own queue first, the newest job is the most likely to have its data in cache
+    {
+        JobQueue &queue = s_jobs->queues[index];
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+
+        if (!queue.jobs.empty())
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+            s_jobs->queuedJobs--;
+            return true;
+        }
+    }
+
+    // steal the oldest job from someone else
+    int queueCount = s_jobs->workerCount + 1;
+
+    for (int i = 1; i < queueCount; i++)
+    {
+        JobQueue &queue = s_jobs->queues[(index + i) % queueCount];
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+
+        if (!queue.jobs.empty())
+        {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+            s_jobs->queuedJobs--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void RunJob(const Job &job)
+{
+    job.function(job.context, job.begin, job.end);
+
+    if (job.counter)
+    {
+        job.counter->value--;
+    }
+}
+
+static void WorkerMain(int index)
+{
+    while (1)
+    {
+        Job job;
+        if (TakeJob(index, job))
+        {
+            RunJob(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{ s_jobs->sleepMutex };
+        s_jobs->sleepCondition.wait(lock, [] { return s_jobs->quit || s_jobs->queuedJobs.load() > 0; });
+
+        if (s_jobs->quit)
+        {
+            return;
+        }
+    }
+}
+
+void jobInit(int workerCount)
+{
+    if (s_jobs)
+    {
+        return;
+    }
+
+    // leave a core for the main thread, hardware_concurrency returns 0 if it doesn't know
+    if (workerCount < 0)
+    {
+        workerCount = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+    }
+
+    workerCount = Q_clamp(workerCount, 0, JobMaxWorkers);
+
+    s_jobs = new JobSystem;
+    s_jobs->workerCount = workerCount;
+    s_jobs->quit = false;
+    s_jobs->threadIds[0] = std::this_thread::get_id();
+
+    // workers only look at the ids once they have a job, so filling them in here is fine
+    for (int i = 0; i < workerCount; i++)
+    {
+        s_jobs->threads[i] = std::thread{ WorkerMain, i + 1 };
+        s_jobs->threadIds[i + 1] = s_jobs->threads[i].get_id();
+    }
+}
+
+void jobShutdown()
+{
+    if (!s_jobs)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ s_jobs->sleepMutex };
+        s_jobs->quit = true;
+    }
+
+    s_jobs->sleepCondition.notify_all();
+
+    for (int i = 0; i < s_jobs->workerCount; i++)
+    {
+        s_jobs->threads[i].join();
+    }
+
+    delete s_jobs;
+    s_jobs = nullptr;
+}
+
+int jobWorkerCount()
+{
+    return s_jobs ? s_jobs->workerCount : 0;
+}
+
+void jobAdd(JobCounter *counter, JobFunction function, void *context, int begin, int end)
+{
+    if (counter)
+    {
+        counter->value++;
+    }
+
+    Job job{ function, context, begin, end, counter };
+
+    if (!jobWorkerCount())
+    {
+        RunJob(job);
+        return;
+    }
+
+    {
+        JobQueue &queue = s_jobs->queues[ThreadIndex()];
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+        queue.jobs.push_back(job);
+        s_jobs->queuedJobs++;
+    }
+
+    // taking the lock makes sure a worker that just checked the count is waiting by now
+    {
+        std::lock_guard<std::mutex> lock{ s_jobs->sleepMutex };
+    }
+
+    s_jobs->sleepCondition.notify_one();
+}
+
+bool jobDone(const JobCounter &counter)
+{
+    return counter.value.load() <= 0;
+}
+
+void jobWait(JobCounter &counter)
+{
+    if (!s_jobs)
+    {
+        GL3_ASSERT(jobDone(counter));
+        return;
+    }
+
+    int index = ThreadIndex();
+    bool mainThread = (index == 0);
+
+    while (!jobDone(counter))
+    {
+        if (mainThread && jobRunMainThreadQueue())
+        {
+            continue;
+        }
+
+        Job job;
+        if (TakeJob(index, job))
+        {
+            RunJob(job);
+        }
+        else
+        {
+            // the last jobs are running on other threads
+            std::this_thread::yield();
+        }
+    }
+
+    // the last jobs may have queued something
+    if (mainThread)
+    {
+        jobRunMainThreadQueue();
+    }
+}
+
+void jobParallelFor(int count, int grain, JobFunction function, void *context)
+{
+    GL3_ASSERT(grain > 0);
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (count <= grain || !jobWorkerCount())
+    {
+        function(context, 0, count);
+        return;
+    }
+
+    JobCounter counter;
+
+    for (int begin = grain; begin < count; begin += grain)
+    {
+        jobAdd(&counter, function, context, begin, Q_min(begin + grain, count));
+    }
+
+    // first range goes on this thread
+    function(context, 0, grain);
+
+    jobWait(counter);
+}
+
+void jobQueueMainThread(MainThreadFunction function, void *context, JobCounter *counter)
+{
+    GL3_ASSERT(s_jobs);
+
+    if (counter)
+    {
+        counter->value++;
+    }
+
+    std::lock_guard<std::mutex> lock{ s_jobs->mainThreadMutex };
+    s_jobs->mainThreadCalls.push_back({ function, context, counter });
+}
+
+int jobRunMainThreadQueue(double timeLimit)
+{
+    GL3_ASSERT(s_jobs && ThreadIndex() == 0);
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    std::vector<MainThreadCall> &calls = s_jobs->mainThreadRunning;
+
+    {
+        std::lock_guard<std::mutex> lock{ s_jobs->mainThreadMutex };
+        calls.swap(s_jobs->mainThreadCalls);
+    }
+
+    int count = static_cast<int>(calls.size());
+
+    // the functions are free to queue more, those go to the other list
+    int i = 0;
+    while (i < count)
+    {
+        const MainThreadCall &call = calls[i++];
+        call.function(call.context);
+
+        if (call.counter)
+        {
+            call.counter->value--;
+        }
+
+        if (timeLimit > 0 && std::chrono::duration<double>(Clock::now() - start).count() >= timeLimit)
+        {
+            break;
+        }
+    }
+
+    // out of time, put the rest back in front of anything queued meanwhile
+    if (i < count)
+    {
+        std::lock_guard<std::mutex> lock{ s_jobs->mainThreadMutex };
+        std::vector<MainThreadCall> &queued = s_jobs->mainThreadCalls;
+        queued.insert(queued.begin(), calls.begin() + i, calls.end());
+    }
+
+    calls.clear();
+    return i;
+}
+
+}
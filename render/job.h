@@ -0,0 +1,58 @@
+#ifndef JOB_H
+#define JOB_H
+
+namespace Render
+{
+
+// small job system for the cpu heavy parts of level loading and the frame
+// every thread has its own deque, the owner works from the back and idle workers
+// steal from the front of the others. jobs must not call gl or the engine,
+// hand that work back to the main thread with jobQueueMainThread
+
+typedef void (*JobFunction)(void *context, int begin, int end);
+typedef void (*MainThreadFunction)(void *context);
+
+// incremented when a job is added and decremented when it finishes,
+// wait on it to know when everything added with it is done
+struct JobCounter
+{
+    std::atomic<int> value{};
+};
+
+// starts the worker threads, one less than there are cores unless
+// workerCount says otherwise (the tests want workers on any machine)
+void jobInit(int workerCount = -1);
+
+// stops the workers, the dll never gets a chance to call this but the host does
+void jobShutdown();
+
+// 0 if jobs run on the thread that adds them
+int jobWorkerCount();
+
+// calls function(context, begin, end) on some thread, counter may be null
+void jobAdd(JobCounter *counter, JobFunction function, void *context, int begin = 0, int end = 0);
+
+bool jobDone(const JobCounter &counter);
+
+// runs jobs until the counter hits zero, on the main thread this also
+// runs the main thread queue so uploads happen while the workers are busy.
+// don't wait on a counter with main thread functions from a worker
+void jobWait(JobCounter &counter);
+
+// splits [0, count) into ranges of at most grain items and waits for all of them,
+// small counts run directly on the calling thread
+void jobParallelFor(int count, int grain, JobFunction function, void *context);
+
+// completion queue, the function gets called from the main thread
+// in jobWait or jobRunMainThreadQueue. counter may be null, if not it
+// stays above zero until the function has run
+void jobQueueMainThread(MainThreadFunction function, void *context, JobCounter *counter = nullptr);
+
+// runs queued functions in order until the queue is empty or timeLimit seconds
+// have passed (0 for no limit), at least one function runs if there are any.
+// returns the number of functions that were run
+int jobRunMainThreadQueue(double timeLimit = 0);
+
+}
+
+#endif
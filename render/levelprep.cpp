@@ -0,0 +1,124 @@
+#include "stdafx.h"
+#include "levelprep.h"
+#include "brush.h"
+#include "job.h"
+#include "lightprobe.h"
+#include "profile.h"
+#include "studio_cache.h"
+
+namespace Render
+{
+
+// milliseconds of gl uploads per frame while a level is being prepared, 0 does everything in one frame
+static cvar_t *gl3_load_budget;
+
+static bool s_preparing;
+static double s_startTime;
+static JobCounter s_counter;
+static LevelPrepStats s_stats;
+
+static const char *s_stageNames[LevelPrepStageCount] = {
+    "convert",
+    "studio setup",
+    "world build",
+    "studio build",
+    "light probes",
+    "upload",
+    "total"
+};
+
+void levelPrepInit()
+{
+    gl3_load_budget = g_engfuncs.pfnRegisterVariable("gl3_load_budget", "4", 0);
+}
+
+static void PrepFinished()
+{
+    s_preparing = false;
+    s_stats.times[LevelPrepTotal] = profileSeconds() - s_startTime;
+
+    g_engfuncs.Con_Printf("Level prepared in %.1f ms over %d frames\n",
+        s_stats.times[LevelPrepTotal] * 1000.0,
+        s_stats.frames);
+}
+
+void levelPrepBegin(model_t *worldmodel)
+{
+    GL3_ASSERT(!s_preparing);
+
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_startTime = profileSeconds();
+    s_preparing = true;
+
+    // both add their main thread time to the stats themselves
+    brushLoadWorldModel(worldmodel, s_counter);
+    s_stats.studioModels = studioCacheTouchAll(s_counter);
+    lightProbeBuild(worldmodel, s_counter);
+}
+
+void levelPrepFinish()
+{
+    if (!s_preparing)
+    {
+        return;
+    }
+
+    // runs the remaining uploads and helps the workers, so the time isn't all uploading
+    double start = profileSeconds();
+    jobWait(s_counter);
+    s_stats.times[LevelPrepUpload] += profileSeconds() - start;
+
+    PrepFinished();
+}
+
+bool levelPrepActive()
+{
+    return s_preparing;
+}
+
+bool levelPrepUpdate()
+{
+    if (!s_preparing)
+    {
+        return true;
+    }
+
+    float budget = gl3_load_budget->value;
+    if (budget <= 0)
+    {
+        levelPrepFinish();
+        return true;
+    }
+
+    double start = profileSeconds();
+    jobRunMainThreadQueue(budget / 1000.0);
+    s_stats.times[LevelPrepUpload] += profileSeconds() - start;
+
+    if (!jobDone(s_counter))
+    {
+        s_stats.frames++;
+        return false;
+    }
+
+    PrepFinished();
+    return true;
+}
+
+void levelPrepAddTime(LevelPrepStage stage, double seconds)
+{
+    GL3_ASSERT(stage >= 0 && stage < LevelPrepStageCount);
+    s_stats.times[stage] += seconds;
+}
+
+const LevelPrepStats &levelPrepStats()
+{
+    return s_stats;
+}
+
+const char *levelPrepStageName(LevelPrepStage stage)
+{
+    GL3_ASSERT(stage >= 0 && stage < LevelPrepStageCount);
+    return s_stageNames[stage];
+}
+
+}
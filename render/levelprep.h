@@ -0,0 +1,53 @@
+#ifndef LEVELPREP_H
+#define LEVELPREP_H
+
+namespace Render
+{
+
+// level loading runs on the job system and the uploads are spread over frames,
+// the engine renderer draws until the gl3 world is ready
+
+enum LevelPrepStage
+{
+    LevelPrepConvert, // engine world to gl3_worldmodel_t, main thread
+    LevelPrepStudioSetup, // studio cache slots and texture headers, main thread
+    LevelPrepWorldBuild, // world vertices, lightmap atlas and indices, worker
+    LevelPrepStudioBuild, // tricmds and meshopt, summed over all models and workers
+    LevelPrepLightProbes, // studio lighting probe grid, summed over workers
+    LevelPrepUpload, // gl uploads, main thread
+    LevelPrepTotal, // from the level change until the world is ready
+    LevelPrepStageCount
+};
+
+struct LevelPrepStats
+{
+    double times[LevelPrepStageCount]; // seconds
+    int frames; // frames the engine renderer drew in the meantime
+    int studioModels;
+};
+
+// registers gl3_load_budget
+void levelPrepInit();
+
+// starts preparing the world, finishes any prep that was still running first
+void levelPrepBegin(model_t *worldmodel);
+
+// blocks until the current prep is done
+void levelPrepFinish();
+
+bool levelPrepActive();
+
+// does this frame's share of the uploads, returns true once the world can be drawn
+bool levelPrepUpdate();
+
+// main thread only, for the stages that run elsewhere
+void levelPrepAddTime(LevelPrepStage stage, double seconds);
+
+// stats of the last level prep
+const LevelPrepStats &levelPrepStats();
+
+const char *levelPrepStageName(LevelPrepStage stage);
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "lightcluster.h"
+#include "dynamicbuffer.h"
+#include "commandbuffer.h"
+
+namespace Render
+{
+
+// must match the shader
+struct LightConstants
+{
+    Vector4 lightPositions[MAX_SHADER_LIGHTS]; // w stores 1/radius
+    Vector4 lightColors[MAX_SHADER_LIGHTS];
+
+    Vector4 clusterTileScale; // xy: gl_FragCoord to tile, zw: bias
+    Vector4 clusterDepth; // xyz: view forward, w: -dot(forward, origin)
+    Vector4 clusterSlice; // x: log2 depth scale, y: bias
+
+    // bit per light, the shader reads these as uvec4
+    uint32_t clusterMasks[LIGHT_CLUSTER_COUNT];
+};
+
+static_assert(MAX_SHADER_LIGHTS <= 32, "cluster masks are 32 bits");
+static_assert(MAX_DLIGHTS <= MAX_SHADER_LIGHTS, "every dlight should fit");
+static_assert(!(LIGHT_CLUSTER_COUNT % 4), "masks are read as uvec4");
+
+// the first slice covers everything closer, no point splitting the first few units
+constexpr float ClusterNear = 16.0f;
+
+static int DepthSlice(float depth, const Vector4 &slice)
+{
+    int result = static_cast<int>(floorf(log2f(Q_max(depth, 1.0f)) * slice.x + slice.y));
+    return Q_clamp(result, 0, LIGHT_CLUSTERS_Z - 1);
+}
+
+static int TileIndex(float ndc, int count)
+{
+    int result = static_cast<int>(floorf((ndc * 0.5f + 0.5f) * count));
+    return Q_clamp(result, 0, count - 1);
+}
+
+static void BinLight(LightConstants &constants, int index, const Vector3 &origin, float radius)
+{
+    Vector3 delta = origin - g_state.viewOrigin;
+    float x = Dot(delta, g_state.viewRight);
+    float y = Dot(delta, g_state.viewUp);
+    float depth = Dot(delta, g_state.viewForward);
+
+    int minX = 0, maxX = LIGHT_CLUSTERS_X - 1;
+    int minY = 0, maxY = LIGHT_CLUSTERS_Y - 1;
+
+    // the view position is inside or behind the sphere, it can cover the whole screen
+    float nearDepth = depth - radius;
+    float farDepth = depth + radius;
+
+    if (nearDepth > 1.0f)
+    {
+        // x/depth is extreme at the corners of the sphere's view space box
+        float scaleX = g_state.projectionMatrix.m00;
+        float scaleY = g_state.projectionMatrix.m11;
+
+        float left = Q_min((x - radius) / nearDepth, (x - radius) / farDepth) * scaleX;
+        float right = Q_max((x + radius) / nearDepth, (x + radius) / farDepth) * scaleX;
+        float bottom = Q_min((y - radius) / nearDepth, (y - radius) / farDepth) * scaleY;
+        float top = Q_max((y + radius) / nearDepth, (y + radius) / farDepth) * scaleY;
+
+        minX = TileIndex(left, LIGHT_CLUSTERS_X);
+        maxX = TileIndex(right, LIGHT_CLUSTERS_X);
+        minY = TileIndex(bottom, LIGHT_CLUSTERS_Y);
+        maxY = TileIndex(top, LIGHT_CLUSTERS_Y);
+    }
+
+    int minZ = DepthSlice(nearDepth, constants.clusterSlice);
+    int maxZ = DepthSlice(farDepth, constants.clusterSlice);
+
+    uint32_t bit = 1u << index;
+
+    for (int z = minZ; z <= maxZ; z++)
+    {
+        for (int y = minY; y <= maxY; y++)
+        {
+            uint32_t *row = &constants.clusterMasks[(z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X];
+
+            for (int x = minX; x <= maxX; x++)
+            {
+                row[x] |= bit;
+            }
+        }
+    }
+}
+
+int lightClusterUpdate(float zNear, float zFar)
+{
+    LightConstants constants;
+
+    const int *viewport = g_state.viewport;
+    float tileScaleX = static_cast<float>(LIGHT_CLUSTERS_X) / viewport[2];
+    float tileScaleY = static_cast<float>(LIGHT_CLUSTERS_Y) / viewport[3];
+    constants.clusterTileScale = { tileScaleX, tileScaleY, -viewport[0] * tileScaleX, -viewport[1] * tileScaleY };
+
+    constants.clusterDepth = { g_state.viewForward, -Dot(g_state.viewForward, g_state.viewOrigin) };
+
+    // exponential slices, the same size on screen
+    float nearPlane = Q_max(zNear, ClusterNear);
+    float sliceScale = LIGHT_CLUSTERS_Z / log2f(Q_max(zFar, nearPlane * 2.0f) / nearPlane);
+    constants.clusterSlice = { sliceScale, -log2f(nearPlane) * sliceScale, 0, 0 };
+
+    memset(constants.clusterMasks, 0, sizeof(constants.clusterMasks));
+
+    int numLights = 0;
+
+    for (int i = 0; i < MAX_DLIGHTS; i++)
+    {
+        dlight_t *light = &g_dlights[i];
+        if (light->radius < 0.01f || light->die < g_engfuncs.GetClientTime())
+        {
+            continue;
+        }
+
+        if (g_state.viewFrustum.CullSphere(light->origin, light->radius))
+        {
+            continue;
+        }
+
+        constants.lightPositions[numLights] = { light->origin, 1.0f / light->radius };
+        constants.lightColors[numLights].x = static_cast<float>(light->color.r) / 255.0f;
+        constants.lightColors[numLights].y = static_cast<float>(light->color.g) / 255.0f;
+        constants.lightColors[numLights].z = static_cast<float>(light->color.b) / 255.0f;
+        constants.lightColors[numLights].w = 0.0f;
+
+        BinLight(constants, numLights, light->origin, light->radius);
+        numLights++;
+    }
+
+    // the shader variant without dlights doesn't read them
+    if (numLights)
+    {
+        BufferSpan span = dynamicUniformData(&constants, sizeof(constants));
+        commandBindUniformBuffer(5, span.buffer, span.byteOffset, sizeof(constants));
+    }
+
+    return numLights;
+}
+
+}
@@ -0,0 +1,13 @@
+#ifndef LIGHTCLUSTER_H
+#define LIGHTCLUSTER_H
+
+namespace Render
+{
+
+// bins the visible dlights into view space clusters and binds the result for
+// lightmapped.frag, call after the view is set up. returns the dlight count
+int lightClusterUpdate(float zNear, float zFar);
+
+}
+
+#endif
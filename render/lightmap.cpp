@@ -1,8 +1,8 @@
 #include "stdafx.h"
 #include "lightmap.h"
-#include "memory.h"
 #include "brush.h"
 #include "texture.h"
+#include "job.h"
 
 // dump to disk so we can laugh at how inefficent we are
 //#define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -106,7 +106,6 @@ static bool PackRects(LightmapRect *rects, int rectCount, int pixelCount, int &a
     {
         if (PackRectsToSize(rects, rectCount, atlasWidth, atlasHeight))
         {
-            g_engfuncs.Con_Printf("Lightmaps packed to %dx%d\n", atlasWidth, atlasHeight);
             return true;
         }
 
@@ -114,7 +113,6 @@ static bool PackRects(LightmapRect *rects, int rectCount, int pixelCount, int &a
         atlasHeight *= 2;
     }
 
-    g_engfuncs.Con_Printf("Lightmap packing failed, the map will have no lightmaps\n");
     return false;
 }
 
@@ -175,50 +173,80 @@ static GLuint CreateLightmapTexture(const Color32 *data, int width, int height)
     return texture;
 }
 
-GLuint lightmapCreateAtlas(gl3_worldmodel_t *model, gl3_brushvert_t *vertices)
+struct AtlasBuild
 {
-    TempMemoryScope temp;
-
-    int rectCount, pixelCount;
-    LightmapRect *rects = temp.Alloc<LightmapRect>(model->numsurfaces);
-    GetSortedLightmapRects(model, rects, rectCount, pixelCount);
-
-    int atlasWidth, atlasHeight;
-    if (!PackRects(rects, rectCount, pixelCount, atlasWidth, atlasHeight))
-    {
-        GL3_ASSERT(false);
-        return 0;
-    }
-
-    model->lightmap_width = atlasWidth;
-    model->lightmap_height = atlasHeight;
+    gl3_worldmodel_t *model;
+    gl3_brushvert_t *vertices;
+    const LightmapRect *rects;
+    Color32 *atlas;
+    int atlasWidth;
+    int atlasHeight;
+};
 
-    Color32 *atlas = temp.Alloc<Color32>(atlasWidth * atlasHeight);
+// rects don't overlap and each surface owns its vertices, so any thread can take any range
+static void CopyRectsToAtlas(void *context, int begin, int end)
+{
+    const AtlasBuild &build = *static_cast<const AtlasBuild *>(context);
+    int atlasWidth = build.atlasWidth;
+    int atlasHeight = build.atlasHeight;
 
-    for (int i = 0; i < rectCount; i++)
+    for (int i = begin; i < end; i++)
     {
-        LightmapRect &rect = rects[i];
-        gl3_fatsurface_t &surface = model->fatsurfaces[rect.surfaceIndex];
+        const LightmapRect &rect = build.rects[i];
+        gl3_fatsurface_t &surface = build.model->fatsurfaces[rect.surfaceIndex];
 
         surface.lightmap_x = rect.x;
         surface.lightmap_y = rect.y;
 
-        CopyLightmapsToAtlas(surface, surface.lightmap_x, surface.lightmap_y, atlas, atlasWidth);
-
-        float lightmap_width = (float)surface.lightmap_width / atlasWidth;
+        CopyLightmapsToAtlas(surface, surface.lightmap_x, surface.lightmap_y, build.atlas, atlasWidth);
 
         for (int k = 0; k < surface.numverts; k++)
         {
-            gl3_brushvert_t *vertex = &vertices[surface.firstvert + k];
+            gl3_brushvert_t *vertex = &build.vertices[surface.firstvert + k];
 
-            vertex->position.w = lightmap_width;
+            brushPackLightmapWidth(vertex->styles, surface.lightmap_width);
 
             vertex->lightmapTexCoord[0] = PACK_U16((float)(vertex->lightmapTexCoord[0] + (surface.lightmap_x * 16) + 8) / (atlasWidth * 16));
             vertex->lightmapTexCoord[1] = PACK_U16((float)(vertex->lightmapTexCoord[1] + (surface.lightmap_y * 16) + 8) / (atlasHeight * 16));
         }
     }
+}
+
+void lightmapBuildAtlas(gl3_worldmodel_t *model, gl3_brushvert_t *vertices, std::vector<Color32> &atlas)
+{
+    // not temp memory, this can run off the main thread
+    int rectCount, pixelCount;
+    std::vector<LightmapRect> rects(Q_max(model->numsurfaces, 1));
+    GetSortedLightmapRects(model, rects.data(), rectCount, pixelCount);
+
+    atlas.clear();
+
+    int atlasWidth, atlasHeight;
+    if (!PackRects(rects.data(), rectCount, pixelCount, atlasWidth, atlasHeight))
+    {
+        return;
+    }
+
+    model->lightmap_width = atlasWidth;
+    model->lightmap_height = atlasHeight;
+
+    atlas.resize(atlasWidth * atlasHeight);
+
+    AtlasBuild build{ model, vertices, rects.data(), atlas.data(), atlasWidth, atlasHeight };
+    jobParallelFor(rectCount, 256, CopyRectsToAtlas, &build);
+}
+
+GLuint lightmapUploadAtlas(gl3_worldmodel_t *model, const std::vector<Color32> &atlas)
+{
+    if (atlas.empty())
+    {
+        g_engfuncs.Con_Printf("Lightmap packing failed, the map will have no lightmaps\n");
+        GL3_ASSERT(false);
+        return 0;
+    }
 
-    return CreateLightmapTexture(atlas, atlasWidth, atlasHeight);
+    g_engfuncs.Con_Printf("Lightmaps packed to %dx%d\n", model->lightmap_width, model->lightmap_height);
+    return CreateLightmapTexture(atlas.data(), model->lightmap_width, model->lightmap_height);
 }
 
 }
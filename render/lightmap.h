@@ -7,9 +7,12 @@ namespace Render
 struct gl3_worldmodel_t;
 struct gl3_brushvert_t;
 
-// creates the lightmap texture and updates the lightmap texcoords of vertices
-// returns the GL texture name
-GLuint lightmapCreateAtlas(gl3_worldmodel_t *model, gl3_brushvert_t *vertices);
+// packs the lightmaps into atlas and updates the lightmap texcoords of vertices,
+// doesn't touch gl so it can run on a worker. atlas is left empty if packing fails
+void lightmapBuildAtlas(gl3_worldmodel_t *model, gl3_brushvert_t *vertices, std::vector<Color32> &atlas);
+
+// main thread half, returns the GL texture name or 0 if there's no atlas
+GLuint lightmapUploadAtlas(gl3_worldmodel_t *model, const std::vector<Color32> &atlas);
 
 }
 
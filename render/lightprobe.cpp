@@ -0,0 +1,479 @@
+#include "stdafx.h"
+#include "lightprobe.h"
+#include "internal.h"
+#include "job.h"
+#include "levelprep.h"
+#include "profile.h"
+
+namespace Render
+{
+
+constexpr float LightProbeSpacing = 32.0f;
+
+// bricks of 4x4x4 probes, only the ones with a probe outside solid get allocated
+constexpr int LightProbeBrickSize = 4;
+constexpr int LightProbeBrickProbes = LightProbeBrickSize * LightProbeBrickSize * LightProbeBrickSize;
+
+// a bsp is at most 8192 units across, anything bigger is a broken model
+constexpr int LightProbeMaxBricks = 128;
+
+// rows of bricks per job
+constexpr int LightProbeRowGrain = 4;
+
+// of the trilinear weight, less than this left after dropping hidden probes and the caller traces
+constexpr float LightProbeMinWeight = 0.1f;
+
+// neighbouring probes are checked for visibility from the start of their traces
+constexpr float LightProbeTraceHeight = 8.0f;
+
+struct LightProbeBrick
+{
+    uint64_t valid; // probes outside solid
+    uint64_t linked[3]; // nothing between the probe and its +x/+y/+z neighbour
+    uint64_t skyKnown; // sky visibility traced for s_skyVec
+    uint64_t skyVisible;
+
+    // index to samples, probes in the same column usually see the same floor and share one
+    uint8_t probes[LightProbeBrickProbes];
+    std::vector<LightProbe> samples;
+};
+
+// the bricks along x, one job bakes a few of these
+struct LightProbeRow
+{
+    std::vector<int> index; // to bricks for every x, -1 if there's nothing there
+    std::vector<LightProbeBrick> bricks;
+    double buildTime;
+};
+
+static cvar_t *gl3_light_probes;
+
+static model_t *s_world;
+static Vector3 s_origin; // position of the first probe
+static int s_probeCounts[3];
+static int s_brickCounts[3];
+static std::vector<LightProbeRow> s_rows;
+
+static std::atomic<int> s_jobsLeft;
+static bool s_ready;
+static unsigned s_generation;
+
+// what the sky bits are for
+static Vector3 s_skyVec;
+
+void lightProbeInit()
+{
+    gl3_light_probes = g_engfuncs.pfnRegisterVariable("gl3_light_probes", "1", 0);
+}
+
+void lightProbeTrace(model_t *world, const Vector3 &origin, const Vector3 &direction, LightProbe &result)
+{
+    Vector3 start = origin;
+
+    // need to do this bullshit
+    Vector3 end = start + direction * 2048;
+    result.sample = internalSampleLightmap(world, start, end);
+
+    start.x -= 16;
+    start.y -= 16;
+    end.x -= 16;
+    end.y -= 16;
+    result.intensity[0] = internalSampleLightmap(world, start, end);
+
+    start.x += 32;
+    end.x += 32;
+    result.intensity[1] = internalSampleLightmap(world, start, end);
+
+    start.y += 32;
+    end.y += 32;
+    result.intensity[2] = internalSampleLightmap(world, start, end);
+
+    start.x -= 32;
+    end.x -= 32;
+    result.intensity[3] = internalSampleLightmap(world, start, end);
+}
+
+static Vector3 ProbePosition(int x, int y, int z)
+{
+    return s_origin + Vector3{ x * LightProbeSpacing, y * LightProbeSpacing, z * LightProbeSpacing };
+}
+
+static int BrickProbeIndex(int x, int y, int z)
+{
+    return x + (y * LightProbeBrickSize) + (z * LightProbeBrickSize * LightProbeBrickSize);
+}
+
+// false if every probe of the brick is in solid
+static bool BakeBrick(LightProbeBrick &brick, int brickX, int brickY, int brickZ)
+{
+    brick.valid = 0;
+    brick.linked[0] = 0;
+    brick.linked[1] = 0;
+    brick.linked[2] = 0;
+    brick.skyKnown = 0;
+    brick.skyVisible = 0;
+    brick.samples.clear();
+
+    for (int y = 0; y < LightProbeBrickSize; y++)
+    {
+        for (int x = 0; x < LightProbeBrickSize; x++)
+        {
+            int previous = -1;
+
+            for (int z = 0; z < LightProbeBrickSize; z++)
+            {
+                int cell[3] = {
+                    brickX * LightProbeBrickSize + x,
+                    brickY * LightProbeBrickSize + y,
+                    brickZ * LightProbeBrickSize + z
+                };
+
+                Vector3 point = ProbePosition(cell[0], cell[1], cell[2]);
+
+                int contents = internalPointContents(s_world, point);
+                if (contents == CONTENTS_SOLID || contents == CONTENTS_SKY)
+                {
+                    previous = -1;
+                    continue;
+                }
+
+                // same as the traced path for an entity at point, see ComputeLightingForKey
+                LightProbe probe;
+                lightProbeTrace(s_world, point + Vector3{ 0, 0, LightProbeTraceHeight }, { 0, 0, -1 }, probe);
+
+                if (previous == -1 || memcmp(&brick.samples[previous], &probe, sizeof(probe)))
+                {
+                    previous = static_cast<int>(brick.samples.size());
+                    brick.samples.push_back(probe);
+                }
+
+                int index = BrickProbeIndex(x, y, z);
+                brick.probes[index] = static_cast<uint8_t>(previous);
+                brick.valid |= 1ull << index;
+
+                // the grid is coarser than most floors and walls, sampling only blends
+                // probes that can see each other so the room below or next door stays out
+                Vector3 start = point + Vector3{ 0, 0, LightProbeTraceHeight };
+
+                for (int i = 0; i < 3; i++)
+                {
+                    int next[3] = { cell[0], cell[1], cell[2] };
+                    next[i]++;
+
+                    Vector3 neighbour = ProbePosition(next[0], next[1], next[2]);
+
+                    int neighbourContents = internalPointContents(s_world, neighbour);
+                    if (neighbourContents == CONTENTS_SOLID || neighbourContents == CONTENTS_SKY)
+                    {
+                        continue;
+                    }
+
+                    if (!internalTraceLineHitsSurface(s_world, start, neighbour + Vector3{ 0, 0, LightProbeTraceHeight }))
+                    {
+                        brick.linked[i] |= 1ull << index;
+                    }
+                }
+            }
+        }
+    }
+
+    return brick.valid != 0;
+}
+
+static void FinishBake(void *)
+{
+    double buildTime = 0;
+    for (const LightProbeRow &row : s_rows)
+    {
+        buildTime += row.buildTime;
+    }
+
+    levelPrepAddTime(LevelPrepLightProbes, buildTime);
+
+    s_ready = true;
+    s_generation++;
+}
+
+// the counter passed to lightProbeBuild
+static JobCounter *s_counter;
+
+static void BakeRowsJob(void *, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        double start = profileSeconds();
+
+        LightProbeRow &row = s_rows[i];
+        int brickY = i % s_brickCounts[1];
+        int brickZ = i / s_brickCounts[1];
+
+        row.index.assign(s_brickCounts[0], -1);
+
+        LightProbeBrick brick;
+        for (int x = 0; x < s_brickCounts[0]; x++)
+        {
+            if (BakeBrick(brick, x, brickY, brickZ))
+            {
+                row.index[x] = static_cast<int>(row.bricks.size());
+                row.bricks.push_back(std::move(brick));
+            }
+        }
+
+        row.buildTime = profileSeconds() - start;
+    }
+
+    // the last one hands the grid over
+    if (s_jobsLeft.fetch_sub(1) == 1)
+    {
+        jobQueueMainThread(FinishBake, nullptr, s_counter);
+    }
+}
+
+void lightProbeBuild(model_t *world, JobCounter &counter)
+{
+    lightProbeFree();
+
+    if (!gl3_light_probes->value)
+    {
+        return;
+    }
+
+    const Vector3 &mins = world->mins;
+    const Vector3 &maxs = world->maxs;
+
+    for (int i = 0; i < 3; i++)
+    {
+        float first = floorf((&mins.x)[i] / LightProbeSpacing);
+        float last = ceilf((&maxs.x)[i] / LightProbeSpacing);
+
+        (&s_origin.x)[i] = first * LightProbeSpacing;
+        s_brickCounts[i] = Q_clamp(static_cast<int>(last - first) / LightProbeBrickSize + 1, 1, LightProbeMaxBricks);
+        s_probeCounts[i] = s_brickCounts[i] * LightProbeBrickSize;
+    }
+
+    s_world = world;
+    s_rows.resize(s_brickCounts[1] * s_brickCounts[2]);
+
+    int rowCount = static_cast<int>(s_rows.size());
+    s_jobsLeft = (rowCount + LightProbeRowGrain - 1) / LightProbeRowGrain;
+    s_counter = &counter;
+
+    for (int i = 0; i < rowCount; i += LightProbeRowGrain)
+    {
+        jobAdd(&counter, BakeRowsJob, nullptr, i, Q_min(i + LightProbeRowGrain, rowCount));
+    }
+}
+
+void lightProbeFree()
+{
+    // the level prep is done with it by now
+    std::vector<LightProbeRow>().swap(s_rows);
+
+    s_world = nullptr;
+    s_ready = false;
+    s_generation++;
+}
+
+unsigned lightProbeGeneration()
+{
+    return s_generation;
+}
+
+static LightProbeBrick *FindBrick(const int (&probe)[3], int &index)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (probe[i] < 0 || probe[i] >= s_probeCounts[i])
+        {
+            return nullptr;
+        }
+    }
+
+    LightProbeRow &row = s_rows[(probe[1] / LightProbeBrickSize) + (probe[2] / LightProbeBrickSize) * s_brickCounts[1]];
+
+    int brick = row.index[probe[0] / LightProbeBrickSize];
+    if (brick == -1)
+    {
+        return nullptr;
+    }
+
+    index = BrickProbeIndex(probe[0] % LightProbeBrickSize, probe[1] % LightProbeBrickSize, probe[2] % LightProbeBrickSize);
+    return &row.bricks[brick];
+}
+
+static void ResetSky(const Vector3 &skyVec)
+{
+    s_skyVec = skyVec;
+
+    for (LightProbeRow &row : s_rows)
+    {
+        for (LightProbeBrick &brick : row.bricks)
+        {
+            brick.skyKnown = 0;
+            brick.skyVisible = 0;
+        }
+    }
+}
+
+bool lightProbeSample(LightProbeResult &result, const Vector3 &origin, const Vector3 *skyVec)
+{
+    if (!s_ready || !gl3_light_probes->value)
+    {
+        return false;
+    }
+
+    if (skyVec && !(*skyVec == s_skyVec))
+    {
+        ResetSky(*skyVec);
+    }
+
+    Vector3 position = (origin - s_origin) * (1.0f / LightProbeSpacing);
+
+    int base[3];
+    float frac[3];
+    for (int i = 0; i < 3; i++)
+    {
+        float value = (&position.x)[i];
+        float whole = floorf(value);
+        base[i] = static_cast<int>(whole);
+        frac[i] = value - whole;
+    }
+
+    // the corners of the cell around the point, bit i of the corner is +1 along axis i
+    LightProbeBrick *bricks[8];
+    int indices[8];
+    float weights[8];
+    int valid = 0;
+    int nearest = -1;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        int probe[3];
+        float weight = 1;
+
+        for (int i = 0; i < 3; i++)
+        {
+            bool upper = (corner >> i) & 1;
+            probe[i] = base[i] + (upper ? 1 : 0);
+            weight *= upper ? frac[i] : (1.0f - frac[i]);
+        }
+
+        bricks[corner] = FindBrick(probe, indices[corner]);
+        weights[corner] = weight;
+
+        if (!bricks[corner] || !(bricks[corner]->valid & (1ull << indices[corner])))
+        {
+            continue;
+        }
+
+        valid |= 1 << corner;
+
+        if (weight > 0 && (nearest == -1 || weight > weights[nearest]))
+        {
+            nearest = corner;
+        }
+    }
+
+    if (nearest == -1)
+    {
+        return false;
+    }
+
+    // the point is taken to see the nearest probe, the others count only when they connect
+    // to it along cell edges nothing blocks
+    int reached = 1 << nearest;
+
+    for (int pass = 0; pass < 3; pass++)
+    {
+        for (int corner = 0; corner < 8; corner++)
+        {
+            if (!(reached & (1 << corner)))
+            {
+                continue;
+            }
+
+            for (int i = 0; i < 3; i++)
+            {
+                int other = corner ^ (1 << i);
+                if (!(valid & (1 << other)))
+                {
+                    continue;
+                }
+
+                // the link is kept on the lower of the two
+                int lower = (corner & (1 << i)) ? other : corner;
+                if (bricks[lower]->linked[i] & (1ull << indices[lower]))
+                {
+                    reached |= 1 << other;
+                }
+            }
+        }
+    }
+
+    result.count = 0;
+    result.sky = 0;
+    float total = 0;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        float weight = weights[corner];
+        if (!(reached & (1 << corner)) || weight <= 0)
+        {
+            continue;
+        }
+
+        LightProbeBrick *brick = bricks[corner];
+        int index = indices[corner];
+        uint64_t bit = 1ull << index;
+
+        // the sky bits get filled in lazily, once per probe for each sky direction
+        if (skyVec)
+        {
+            if (!(brick->skyKnown & bit))
+            {
+                int probe[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    probe[i] = base[i] + ((corner >> i) & 1);
+                }
+
+                Vector3 point = ProbePosition(probe[0], probe[1], probe[2]);
+                Vector3 end = point - (*skyVec * 8192);
+
+                brick->skyKnown |= bit;
+                if (internalTraceLineToSky(s_world, point + Vector3{ 0, 0, LightProbeTraceHeight }, end))
+                {
+                    brick->skyVisible |= bit;
+                }
+            }
+
+            if (brick->skyVisible & bit)
+            {
+                result.sky += weight;
+            }
+        }
+
+        result.probes[result.count] = &brick->samples[brick->probes[index]];
+        result.weights[result.count] = weight;
+        result.count++;
+        total += weight;
+    }
+
+    // stuck in a wall, outside the world or most of the probes around are cut off,
+    // the caller traces instead
+    if (total < LightProbeMinWeight)
+    {
+        return false;
+    }
+
+    float scale = 1.0f / total;
+    for (int i = 0; i < result.count; i++)
+    {
+        result.weights[i] *= scale;
+    }
+
+    result.sky *= scale;
+    return true;
+}
+
+}
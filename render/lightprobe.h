@@ -0,0 +1,44 @@
+#ifndef LIGHTPROBE_H
+#define LIGHTPROBE_H
+
+namespace Render
+{
+
+struct JobCounter;
+struct LightProbe;
+
+// studio model lighting traces baked into a sparse grid at level load, so moving
+// entities interpolate the probes around them instead of walking the bsp every frame
+
+// the probes around a point with their trilinear weights, probes in solid or cut off
+// from the nearest one by a surface are left out
+struct LightProbeResult
+{
+    int count;
+    const LightProbe *probes[8];
+    float weights[8]; // sum to 1
+    float sky; // weight of the probes that see the sky, if asked for
+};
+
+// registers gl3_light_probes
+void lightProbeInit();
+
+// the lightmap samples studio lighting takes going down from start, shared with the traced path
+void lightProbeTrace(model_t *world, const Vector3 &start, const Vector3 &direction, LightProbe &result);
+
+// bakes the grid for the world on the job system, done when the counter is
+void lightProbeBuild(model_t *world, JobCounter &counter);
+
+// frees the grid, the pointers from lightProbeSample become invalid
+void lightProbeFree();
+
+// bumped whenever the grid changes, anything holding on to probes has to sample again
+unsigned lightProbeGeneration();
+
+// false if the grid isn't ready or too few of the probes around the point see it. sky visibility
+// along skyVec gets traced the first time a probe is asked for it, pass null to skip it
+bool lightProbeSample(LightProbeResult &result, const Vector3 &origin, const Vector3 *skyVec);
+
+}
+
+#endif
@@ -161,6 +161,60 @@ Matrix3x4 DiagonalMatrix3x4(float f)
     return result;
 }
 
+Matrix3x4 operator*(const Matrix3x4 &a, const Matrix3x4 &b)
+{
+    Matrix3x4 result;
+    result.m00 = a.m00 * b.m00 + a.m01 * b.m10 + a.m02 * b.m20;
+    result.m01 = a.m00 * b.m01 + a.m01 * b.m11 + a.m02 * b.m21;
+    result.m02 = a.m00 * b.m02 + a.m01 * b.m12 + a.m02 * b.m22;
+    result.m03 = a.m00 * b.m03 + a.m01 * b.m13 + a.m02 * b.m23 + a.m03;
+
+    result.m10 = a.m10 * b.m00 + a.m11 * b.m10 + a.m12 * b.m20;
+    result.m11 = a.m10 * b.m01 + a.m11 * b.m11 + a.m12 * b.m21;
+    result.m12 = a.m10 * b.m02 + a.m11 * b.m12 + a.m12 * b.m22;
+    result.m13 = a.m10 * b.m03 + a.m11 * b.m13 + a.m12 * b.m23 + a.m13;
+
+    result.m20 = a.m20 * b.m00 + a.m21 * b.m10 + a.m22 * b.m20;
+    result.m21 = a.m20 * b.m01 + a.m21 * b.m11 + a.m22 * b.m21;
+    result.m22 = a.m20 * b.m02 + a.m21 * b.m12 + a.m22 * b.m22;
+    result.m23 = a.m20 * b.m03 + a.m21 * b.m13 + a.m22 * b.m23 + a.m23;
+    return result;
+}
+
+bool InvertMatrix3x4(const Matrix3x4 &m, Matrix3x4 &result)
+{
+    // cofactors of the 3x3 part, scaled models need the full inverse
+    float c00 = m.m11 * m.m22 - m.m12 * m.m21;
+    float c01 = m.m12 * m.m20 - m.m10 * m.m22;
+    float c02 = m.m10 * m.m21 - m.m11 * m.m20;
+
+    float det = m.m00 * c00 + m.m01 * c01 + m.m02 * c02;
+    if (fabsf(det) < 1e-12f)
+    {
+        return false;
+    }
+
+    float inv = 1.0f / det;
+
+    result.m00 = c00 * inv;
+    result.m01 = (m.m02 * m.m21 - m.m01 * m.m22) * inv;
+    result.m02 = (m.m01 * m.m12 - m.m02 * m.m11) * inv;
+
+    result.m10 = c01 * inv;
+    result.m11 = (m.m00 * m.m22 - m.m02 * m.m20) * inv;
+    result.m12 = (m.m02 * m.m10 - m.m00 * m.m12) * inv;
+
+    result.m20 = c02 * inv;
+    result.m21 = (m.m01 * m.m20 - m.m00 * m.m21) * inv;
+    result.m22 = (m.m00 * m.m11 - m.m01 * m.m10) * inv;
+
+    // translation is -inverse(rotation) * origin
+    result.m03 = -(result.m00 * m.m03 + result.m01 * m.m13 + result.m02 * m.m23);
+    result.m13 = -(result.m10 * m.m03 + result.m11 * m.m13 + result.m12 * m.m23);
+    result.m23 = -(result.m20 * m.m03 + result.m21 * m.m13 + result.m22 * m.m23);
+    return true;
+}
+
 // absolute packed singles in your xmm0
 static __m128 AbsPS(__m128 x)
 {
@@ -220,6 +220,12 @@ struct Matrix3x4
 Matrix3x4 ModelMatrix3x4(const Vector3 &origin, const Vector3 &angles);
 Matrix3x4 DiagonalMatrix3x4(float f);
 
+// treats the matrices as affine 4x4 ones with an implicit last row
+Matrix3x4 operator*(const Matrix3x4 &a, const Matrix3x4 &b);
+
+// false if the matrix can't be inverted
+bool InvertMatrix3x4(const Matrix3x4 &m, Matrix3x4 &result);
+
 class alignas(16) ViewFrustum
 {
 public:
@@ -251,6 +257,39 @@ public:
         return (_mm_movemask_ps(backMask) != 0);
     }
 
+    // like CullBox but only tests the planes in clipMask, returns -1 if the box
+    // is outside, otherwise the planes in clipMask the box still crosses
+    int ClipBox(const Vector3 &center, const Vector3 &extents, int clipMask)
+    {
+        __m128 cx = _mm_set1_ps(center.x);
+        __m128 cy = _mm_set1_ps(center.y);
+        __m128 cz = _mm_set1_ps(center.z);
+
+        __m128 ex = _mm_set1_ps(extents.x);
+        __m128 ey = _mm_set1_ps(extents.y);
+        __m128 ez = _mm_set1_ps(extents.z);
+
+        __m128 dist = _mm_mul_ps(cx, m_nx);
+        __m128 radius = _mm_mul_ps(ex, m_absNx);
+
+        dist = _mm_add_ps(dist, _mm_mul_ps(cy, m_ny));
+        radius = _mm_add_ps(radius, _mm_mul_ps(ey, m_absNy));
+
+        dist = _mm_add_ps(dist, _mm_mul_ps(cz, m_nz));
+        radius = _mm_add_ps(radius, _mm_mul_ps(ez, m_absNz));
+
+        dist = _mm_add_ps(dist, m_d);
+
+        __m128 backMask = _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps());
+        if (_mm_movemask_ps(backMask) & clipMask)
+        {
+            return -1;
+        }
+
+        __m128 frontMask = _mm_cmpge_ps(_mm_sub_ps(dist, radius), _mm_setzero_ps());
+        return clipMask & ~_mm_movemask_ps(frontMask);
+    }
+
     bool CullSphere(const Vector3 &center, float radius)
     {
         __m128 cx = _mm_set1_ps(center.x);
@@ -268,6 +307,36 @@ public:
         return (_mm_movemask_ps(backMask) != 0);
     }
 
+    // four boxes at once, one per lane, components in x/y/z order
+    // returns a bit for each box that is outside
+    int CullBoxes4(const __m128 center[3], const __m128 extents[3])
+    {
+        __m128 outside = BoxesBehindPlane<0>(center, extents);
+        outside = _mm_or_ps(outside, BoxesBehindPlane<1>(center, extents));
+        outside = _mm_or_ps(outside, BoxesBehindPlane<2>(center, extents));
+        outside = _mm_or_ps(outside, BoxesBehindPlane<3>(center, extents));
+        return _mm_movemask_ps(outside);
+    }
+
+    template<int Plane>
+    __m128 BoxesBehindPlane(const __m128 center[3], const __m128 extents[3])
+    {
+        constexpr int Lane = _MM_SHUFFLE(Plane, Plane, Plane, Plane);
+
+        __m128 dist = _mm_mul_ps(center[0], _mm_shuffle_ps(m_nx, m_nx, Lane));
+        __m128 radius = _mm_mul_ps(extents[0], _mm_shuffle_ps(m_absNx, m_absNx, Lane));
+
+        dist = _mm_add_ps(dist, _mm_mul_ps(center[1], _mm_shuffle_ps(m_ny, m_ny, Lane)));
+        radius = _mm_add_ps(radius, _mm_mul_ps(extents[1], _mm_shuffle_ps(m_absNy, m_absNy, Lane)));
+
+        dist = _mm_add_ps(dist, _mm_mul_ps(center[2], _mm_shuffle_ps(m_nz, m_nz, Lane)));
+        radius = _mm_add_ps(radius, _mm_mul_ps(extents[2], _mm_shuffle_ps(m_absNz, m_absNz, Lane)));
+
+        dist = _mm_add_ps(dist, _mm_shuffle_ps(m_d, m_d, Lane));
+
+        return _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps());
+    }
+
     __m128 m_nx;
     __m128 m_ny;
     __m128 m_nz;
@@ -5,6 +5,7 @@
 #include "internal.h"
 #include "hudgl3.h"
 #include "texture.h"
+#include "job.h"
 
 namespace Render
 {
@@ -18,6 +19,9 @@ static particle_t *s_freeParticles;
 static particle_t *s_activeParticles;
 static particle_t *s_activeTracers;
 
+// the active list flattened so the update can be split up
+static particle_t *s_updateList[MaxParticles];
+
 static GLuint s_particleTexture;
 
 static GLuint s_tracerTexture;
@@ -234,6 +238,11 @@ particle_t *particleAllocateTracer()
     return AllocateParticle(&s_activeTracers);
 }
 
+const particle_t *particleGetActive(bool tracers)
+{
+    return tracers ? s_activeTracers : s_activeParticles;
+}
+
 static void DrawTracer(particle_t *tracer, float camSide)
 {
     Vector3 point1 = tracer->org;
@@ -514,6 +523,32 @@ static void ParticleUpdate(particle_t *particle, float frametime, float gravity)
     }
 }
 
+// client callbacks and randomInt aren't safe to call off the main thread
+static bool MainThreadUpdate(const particle_t *particle)
+{
+    return particle->type == pt_clientcustom || particle->type == pt_blob || particle->type == pt_blob2;
+}
+
+struct ParticleUpdateJob
+{
+    float frametime;
+    float gravity;
+};
+
+static void UpdateParticles(void *context, int begin, int end)
+{
+    const ParticleUpdateJob &job = *static_cast<const ParticleUpdateJob *>(context);
+
+    for (int i = begin; i < end; i++)
+    {
+        particle_t *particle = s_updateList[i];
+        if (!MainThreadUpdate(particle))
+        {
+            ParticleUpdate(particle, job.frametime, job.gravity);
+        }
+    }
+}
+
 static void DrawParticles()
 {
     FreeDeadParticles(&s_activeParticles);
@@ -536,10 +571,7 @@ static void DrawParticles()
     Vector3 right = g_state.viewRight * 1.5f;
     Vector3 up = g_state.viewUp * 1.5f;
 
-    // FIXME: won't work with very old engine versions (no hudGetClientOldTime)
-    float frametime = g_engfuncs.GetClientTime() - g_engfuncs.hudGetClientOldTime();
-
-    float gravity = g_state.movevars->gravity * 0.05f * frametime;
+    int count = 0;
 
     for (particle_t *particle = s_activeParticles; particle; particle = particle->next)
     {
@@ -548,12 +580,31 @@ static void DrawParticles()
             ParticleDraw(particle, right, up);
         }
 
-        ParticleUpdate(particle, frametime, gravity);
+        s_updateList[count++] = particle;
     }
 
     immediateEnd();
 
     immediateDrawEnd();
+
+    // FIXME: won't work with very old engine versions (no hudGetClientOldTime)
+    float frametime = g_engfuncs.GetClientTime() - g_engfuncs.hudGetClientOldTime();
+
+    ParticleUpdateJob job;
+    job.frametime = frametime;
+    job.gravity = g_state.movevars->gravity * 0.05f * frametime;
+
+    jobParallelFor(count, 512, UpdateParticles, &job);
+
+    // same order as before so the random sequence doesn't change
+    for (int i = 0; i < count; i++)
+    {
+        particle_t *particle = s_updateList[i];
+        if (MainThreadUpdate(particle))
+        {
+            ParticleUpdate(particle, job.frametime, job.gravity);
+        }
+    }
 }
 
 void particleDraw()
@@ -14,6 +14,9 @@ void particleDraw();
 particle_t *particleAllocate();
 particle_t *particleAllocateTracer();
 
+// head of the active particle or tracer list, for frame capture
+const particle_t *particleGetActive(bool tracers);
+
 }
 
 #endif
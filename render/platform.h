@@ -29,6 +29,9 @@ void *platformGetDecalTexture(int index);
 
 const Lightstyle &platformLightstyleString(int style);
 
+// returns false if it couldn't be created or already exists
+bool platformMakeDirectory(const char *path);
+
 }
 
 #endif
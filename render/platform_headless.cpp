@@ -0,0 +1,73 @@
+#include "stdafx.h"
+#include "platform.h"
+
+#if defined(RENDER_HEADLESS)
+
+#include <sys/stat.h>
+
+// the headless host links us in statically and defines the engine globals
+// itself, so there is nothing to go looking for
+extern "C"
+{
+extern Render::Vector3 r_origin, vpn, vright, vup;
+extern cl_entity_t *currententity;
+extern Render::Lightstyle cl_lightstyle[MAX_LIGHTSTYLES];
+void *Draw_DecalTexture(int index);
+}
+
+namespace Render
+{
+
+void platformInit(void *, void *, void *)
+{
+}
+
+[[noreturn]] void platformError(const char *format, ...)
+{
+    va_list ap;
+    char buffer[4096];
+
+    va_start(ap, format);
+    Q_vsprintf(buffer, format, ap);
+    va_end(ap);
+
+    fprintf(stderr, PRODUCT_NAME ": %s\n", buffer);
+    exit(1);
+}
+
+void platformSetViewInfo(
+    const Vector3 &origin,
+    const Vector3 &forward,
+    const Vector3 &right,
+    const Vector3 &up)
+{
+    r_origin = origin;
+    vpn = forward;
+    vright = right;
+    vup = up;
+}
+
+void platformSetCurrentEntity(void *entity)
+{
+    currententity = static_cast<cl_entity_t *>(entity);
+}
+
+void *platformGetDecalTexture(int index)
+{
+    return Draw_DecalTexture(index);
+}
+
+const Lightstyle &platformLightstyleString(int style)
+{
+    GL3_ASSERT(style >= 0 && style < MAX_LIGHTSTYLES);
+    return cl_lightstyle[style];
+}
+
+bool platformMakeDirectory(const char *path)
+{
+    return mkdir(path, 0755) == 0;
+}
+
+}
+
+#endif
@@ -1,12 +1,13 @@
 #include "stdafx.h"
 #include "platform.h"
 
-#if defined(__linux__)
+#if defined(__linux__) && !defined(RENDER_HEADLESS)
 
 #include <dlfcn.h>
 #include <link.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #if !defined(__i386__)
@@ -196,6 +197,11 @@ const Lightstyle &platformLightstyleString(int style)
     return s_lightstyle[style];
 }
 
+bool platformMakeDirectory(const char *path)
+{
+    return mkdir(path, 0755) == 0;
+}
+
 }
 
 #endif
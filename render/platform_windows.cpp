@@ -1,7 +1,7 @@
 #include "stdafx.h"
 #include "platform.h"
 
-#if defined(_WIN32)
+#if defined(_WIN32) && !defined(RENDER_HEADLESS)
 
 // workaround for sdks
 #define HSPRITE HANDLE_SPRITE
@@ -292,6 +292,11 @@ const Lightstyle &platformLightstyleString(int style)
     return s_lightstyle[style];
 }
 
+bool platformMakeDirectory(const char *path)
+{
+    return CreateDirectoryA(path, nullptr) != FALSE;
+}
+
 }
 
 #endif
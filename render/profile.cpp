@@ -0,0 +1,63 @@
+#include "stdafx.h"
+#include "profile.h"
+
+#include <chrono>
+
+namespace Render
+{
+
+using ProfileClock = std::chrono::steady_clock;
+
+static ProfileClock::time_point s_startTimes[ProfilePassCount];
+static double s_passTimes[ProfilePassCount];
+
+static const char *s_passNames[ProfilePassCount] = {
+    "frame",
+    "linkleaves",
+    "brush",
+    "studio",
+    "translucent",
+    "particles",
+    "execute"
+};
+
+void profileFrameBegin()
+{
+    for (double &time : s_passTimes)
+    {
+        time = 0;
+    }
+}
+
+void profileBegin(ProfilePass pass)
+{
+    GL3_ASSERT(pass >= 0 && pass < ProfilePassCount);
+    s_startTimes[pass] = ProfileClock::now();
+}
+
+void profileEnd(ProfilePass pass)
+{
+    GL3_ASSERT(pass >= 0 && pass < ProfilePassCount);
+    std::chrono::duration<double> elapsed = ProfileClock::now() - s_startTimes[pass];
+    s_passTimes[pass] += elapsed.count();
+}
+
+double profilePassTime(ProfilePass pass)
+{
+    GL3_ASSERT(pass >= 0 && pass < ProfilePassCount);
+    return s_passTimes[pass];
+}
+
+const char *profilePassName(ProfilePass pass)
+{
+    GL3_ASSERT(pass >= 0 && pass < ProfilePassCount);
+    return s_passNames[pass];
+}
+
+double profileSeconds()
+{
+    std::chrono::duration<double> time = ProfileClock::now().time_since_epoch();
+    return time.count();
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+namespace Render
+{
+
+// cpu time spent in the big chunks of RenderScene, used by capture replay
+enum ProfilePass
+{
+    ProfileFrame, // all of RenderScene
+    ProfileLinkLeaves, // part of ProfileBrush
+    ProfileBrush,
+    ProfileStudio, // solid studio models, solid sprites and the viewmodel
+    ProfileTranslucent,
+    ProfileParticles, // particles and beams
+    ProfileCommandExecute,
+    ProfilePassCount
+};
+
+// zeroes the pass times, called at the start of RenderScene
+void profileFrameBegin();
+
+// passes may be entered more than once per frame, the time adds up
+void profileBegin(ProfilePass pass);
+void profileEnd(ProfilePass pass);
+
+// seconds spent in the pass during the last frame
+double profilePassTime(ProfilePass pass);
+
+const char *profilePassName(ProfilePass pass);
+
+// steady clock in seconds, for timing things outside the passes
+double profileSeconds();
+
+class ProfileScope
+{
+public:
+    ProfileScope(ProfilePass pass)
+        : m_pass{ pass }
+    {
+        profileBegin(pass);
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope(ProfileScope &&) = delete;
+
+    ~ProfileScope()
+    {
+        profileEnd(m_pass);
+    }
+
+private:
+    ProfilePass m_pass;
+};
+
+}
+
+#endif
@@ -33,6 +33,11 @@ static void MarkNodesVisible(gl3_leaf_t *leaf)
     while (node && node->pvsframe != g_pvsFrame)
     {
         node->pvsframe = g_pvsFrame;
+
+        // only called for leaves with visible surfaces, so the whole chain is in there
+        GL3_ASSERT(node->flatnode != -1);
+        g_worldmodel->flatnodes[node->flatnode].pvsframe = g_pvsFrame;
+
         node = node->parent;
     }
 }
@@ -22,6 +22,13 @@
 #include "particle.h"
 #include "studio_misc.h"
 #include "beam.h"
+#include "profile.h"
+#include "capture.h"
+#include "job.h"
+#include "levelprep.h"
+#include "worldcache.h"
+#include "lightprobe.h"
+#include "lightcluster.h"
 
 extern "C" void HUD_DrawNormalTriangles();
 extern "C" void HUD_DrawTransparentTriangles();
@@ -54,9 +61,6 @@ struct FrameConstants
 
     Vector4 clientTime; // FIXME: could pack with... something
 
-    Vector4 lightPositions[MAX_SHADER_LIGHTS]; // w stores 1/radius
-    Vector4 lightColors[MAX_SHADER_LIGHTS];
-
     // accessed with lightstyles[i].x
     Vector4 lightstyles[MAX_LIGHTSTYLES];
 };
@@ -158,11 +162,9 @@ static void RestoreState()
 {
     glUseProgram(0);
 
-    // we didn't use vertex array objects.. disable all attribs we used to not break vgui2
-    for (int i = 0; i < MaxVertexAttribs; i++)
-    {
-        glDisableVertexAttribArray(i);
-    }
+    // our attribs live in vertex array objects so the default one vgui2 uses is left alone,
+    // commandExecute already goes back to it but make sure
+    glBindVertexArray(0);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -264,6 +266,7 @@ void Initialize(struct engine_studio_api_s *studio, r_studio_interface_s **pinte
 #endif
 
     memoryInit();
+    jobInit();
     gammaInit();
     shaderInit();
     immediateInit();
@@ -280,6 +283,11 @@ void Initialize(struct engine_studio_api_s *studio, r_studio_interface_s **pinte
     triapiInit();
     particleInit();
     screenFadeInit();
+    captureInit();
+    levelPrepInit();
+    worldCacheInit();
+    studioCacheInit();
+    lightProbeInit();
 
     // dummy textures for fullbright etc.
     {
@@ -322,7 +330,8 @@ static uint64_t ComputeLevelHash(const model_t *model)
     return hash1 | (hash2 << 32);
 }
 
-static void CheckLevelChange()
+// returns false while the level is still being prepared
+static bool CheckLevelChange()
 {
     // probably engine errors???
     GL_ERRORS_QUIET();
@@ -331,36 +340,46 @@ static void CheckLevelChange()
 
     model_t *worldmodel = g_engineStudio.GetModelByIndex(1);
     uint64_t hash = ComputeLevelHash(worldmodel);
-    if (hash == previousHash)
+    if (hash != previousHash)
     {
-        // no change
-        return;
-    }
+        previousHash = hash;
 
-    previousHash = hash;
+        // the jobs still write to level memory
+        levelPrepFinish();
 
-    // free the previous level data
-    brushFreeWorldModel();
-    memoryLevelFree();
+        // captures don't carry level changes
+        captureStop();
 
-    // if the level changed, load it to g_worldmodel
-    if (worldmodel)
-    {
-        brushLoadWorldModel(worldmodel);
+        // free the previous level data
+        brushFreeWorldModel();
+        lightProbeFree();
+        memoryLevelFree();
 
-        // try to prebuild model caches to avoid hitches at draw time
-        studioCacheTouchAll();
+        // if the level changed, load it to g_worldmodel
+        if (worldmodel)
+        {
+            // world buffers and model caches get built in the background
+            levelPrepBegin(worldmodel);
 
-        // brush model loading and studio cache touching
-        // can change opengl state so restore it
-        RestoreState();
+            // i guess
+            particleClear();
 
-        // i guess
-        particleClear();
+            // not sure if needed
+            lightstyleReset();
+        }
+    }
 
-        // not sure if needed
-        lightstyleReset();
+    if (!levelPrepActive())
+    {
+        return true;
     }
+
+    bool ready = levelPrepUpdate();
+
+    // brush model loading and the uploads can change opengl state so restore it
+    RestoreState();
+
+    return ready;
 }
 
 int BeginFrame()
@@ -368,7 +387,8 @@ int BeginFrame()
     // just in case
     gammaUpdate();
 
-    if (!gl3_enable->value)
+    // the engine renderer draws while the level is prepared
+    if (!gl3_enable->value || !CheckLevelChange())
     {
         g_state.active = false;
         r_norefresh->value = 0;
@@ -378,10 +398,8 @@ int BeginFrame()
     g_state.active = true;
     r_norefresh->value = 1;
 
-    CheckLevelChange();
-
     // clear entities from the previous frame
-    entityClearBuckets();
+    entityClearQueue();
 
     return true;
 }
@@ -424,8 +442,7 @@ static Matrix4 SkyMatrix(const Vector3 &cameraPosition)
     return result;
 }
 
-// returns the dlight count for this frame
-static int UpdateFrameConstants(const Matrix4 &vmViewProjectionMatrix)
+static void UpdateFrameConstants(const Matrix4 &vmViewProjectionMatrix)
 {
     FrameConstants frameConstants;
     frameConstants.viewProjectionMatrix = g_state.viewProjectionMatrix;
@@ -441,48 +458,10 @@ static int UpdateFrameConstants(const Matrix4 &vmViewProjectionMatrix)
         frameConstants.lightstyles[i] = { value, 0, 0, 0 };
     }
 
-    int numLights = 0;
-
-    for (int i = 0; i < MAX_DLIGHTS; i++)
-    {
-        dlight_t *light = &g_dlights[i];
-        if (light->radius < 0.01f || light->die < g_engfuncs.GetClientTime())
-        {
-            continue;
-        }
-
-        if (g_state.viewFrustum.CullSphere(light->origin, light->radius))
-        {
-            continue;
-        }
-
-        if (numLights == MAX_SHADER_LIGHTS)
-        {
-            // could do a more aggressive cull???
-            break;
-        }
-
-        frameConstants.lightPositions[numLights] = { light->origin, 1.0f / light->radius };
-
-        frameConstants.lightColors[numLights].x = static_cast<float>(light->color.r) / 255.0f;
-        frameConstants.lightColors[numLights].y = static_cast<float>(light->color.g) / 255.0f;
-        frameConstants.lightColors[numLights].z = static_cast<float>(light->color.b) / 255.0f;
-
-        numLights++;
-    }
-
-    for (int i = numLights; i < MAX_SHADER_LIGHTS; i++)
-    {
-        frameConstants.lightPositions[i] = {};
-        frameConstants.lightColors[i] = {};
-    }
-
     frameConstants.clientTime.x = g_engfuncs.GetClientTime();
 
     BufferSpan span = dynamicUniformData(&frameConstants, sizeof(frameConstants));
     commandBindUniformBuffer(0, span.buffer, span.byteOffset, sizeof(frameConstants));
-
-    return numLights;
 }
 
 void renderFogEnable(bool enable, bool forceUpdate)
@@ -590,6 +569,11 @@ static void SetupViewport(const SceneParams &params)
     int y = screenInfo.iHeight - params.viewport_y - params.viewport_h;
     glViewport(params.viewport_x, y, params.viewport_w, params.viewport_h);
 
+    g_state.viewport[0] = params.viewport_x;
+    g_state.viewport[1] = y;
+    g_state.viewport[2] = params.viewport_w;
+    g_state.viewport[3] = params.viewport_h;
+
     glClear(GL_DEPTH_BUFFER_BIT);
 }
 
@@ -631,7 +615,8 @@ static void SetupView(const SceneParams &params)
     // update these mofos
     platformSetViewInfo(params.origin, params.forward, params.right, params.up);
 
-    g_state.dlightCount = UpdateFrameConstants(vmViewProjectionMatrix);
+    UpdateFrameConstants(vmViewProjectionMatrix);
+    g_state.dlightCount = lightClusterUpdate(zNear, zFar);
 
     UpdateFogConstants();
 }
@@ -640,22 +625,31 @@ static void SceneRenderPass(const SceneParams &params, bool onlyClientDraw)
 {
     SetupViewport(params);
 
-    entitySortTranslucents(params.origin);
-
     lightstyleUpdate();
 
     SetupView(params);
 
+    entitySortQueue(params.origin);
+
     if (!onlyClientDraw)
     {
         // animate the viewmodel, draw last
-        entityDrawViewmodel(STUDIO_EVENTS);
+        {
+            ProfileScope scope{ ProfileStudio };
+            entityDrawViewmodel(STUDIO_EVENTS);
+        }
 
         // draw world and solid brush entities
-        entityDrawSolidBrushes();
+        {
+            ProfileScope scope{ ProfileBrush };
+            entityDrawSolidBrushes();
+        }
 
         // solid studio models and sprites
-        entityDrawSolidEntities();
+        {
+            ProfileScope scope{ ProfileStudio };
+            entityDrawSolidEntities();
+        }
     }
 
     // solid triapi draw
@@ -667,6 +661,7 @@ static void SceneRenderPass(const SceneParams &params, bool onlyClientDraw)
 
     if (!onlyClientDraw)
     {
+        ProfileScope scope{ ProfileTranslucent };
         entityDrawTranslucentEntities(params.origin, params.forward);
     }
 
@@ -683,12 +678,18 @@ static void SceneRenderPass(const SceneParams &params, bool onlyClientDraw)
 
     if (!onlyClientDraw)
     {
-        particleDraw();
-        beamDraw();
+        {
+            ProfileScope scope{ ProfileParticles };
+            particleDraw();
+            beamDraw();
+        }
 
         // draw the viewmodel last, can't draw it first
         // even though it covers a large part of the screen
-        entityDrawViewmodel(STUDIO_RENDER);
+        {
+            ProfileScope scope{ ProfileStudio };
+            entityDrawViewmodel(STUDIO_RENDER);
+        }
     }
 
     // check errors before draw calls...
@@ -705,6 +706,12 @@ void RenderScene(const Params &params)
     g_state.inFrame = true;
     g_state.frameCount++;
 
+    profileFrameBegin();
+    profileBegin(ProfileFrame);
+
+    // before anything touches the inputs
+    captureFrame(params);
+
     // clear engine errors
     GL_ERRORS_QUIET();
 
@@ -731,8 +738,9 @@ void RenderScene(const Params &params)
     // kinda shit place to do this but we conveniently get the sky name from the ref parms...
     skyboxUpdate(g_state.movevars->skyName);
 
-    commandRecord();
+    // mapping can grow the buffers, which frees vertex arrays so it has to happen before recording
     dynamicBuffersMap();
+    commandRecord();
 
     {
         SceneParams sceneParams;
@@ -750,7 +758,12 @@ void RenderScene(const Params &params)
     }
 
     dynamicBuffersUnmap();
-    commandExecute();
+
+    {
+        ProfileScope scope{ ProfileCommandExecute };
+        commandOptimize();
+        commandExecute();
+    }
 
     // this fucking sucks, actually
     if (!refParams->onlyClientDraw)
@@ -761,6 +774,8 @@ void RenderScene(const Params &params)
     // back to fixed function
     RestoreState();
 
+    profileEnd(ProfileFrame);
+
     g_state.inFrame = false;
 }
 
@@ -25,12 +25,16 @@ struct State
     int uniformBufferSize;
     int drawcallCount;
     int commandBufferSize;
+    int commandsRemoved; // by commandOptimize
 #endif
 
     // set when RenderScene is called
     movevars_t *movevars; //  used for studio model lighting params
     Vector3 crosshairAngle;
 
+    // SetupViewport, bottom left origin like glViewport
+    int viewport[4];
+
     // SetupView
     Vector3 viewOrigin;
     Vector3 viewAngles;
@@ -42,7 +46,7 @@ struct State
     Matrix4 projectionMatrix;
     Matrix4 viewProjectionMatrix;
 
-    int dlightCount;
+    int dlightCount; // binned by lightClusterUpdate
 
     // actual fog switch, either triapi fog or water fog
     bool sceneHasFog;
@@ -257,7 +257,10 @@ static void BindUniformBlocks(GLuint program)
     static const BlockBinding blocks[] = {
         { "FrameConstants", 0 },
         { "ModelConstants", 1 },
-        { "FogConstants", 2 }
+        { "FogConstants", 2 },
+        { "InstanceConstants", 3 },
+        { "BoneConstants", 4 },
+        { "LightConstants", 5 }
     };
 
     for (const BlockBinding &block : blocks)
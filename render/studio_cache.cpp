@@ -3,6 +3,10 @@
 #include "studio_misc.h"
 #include <meshoptimizer.h>
 #include "memory.h"
+#include "bufferpool.h"
+#include "job.h"
+#include "levelprep.h"
+#include "profile.h"
 
 namespace Render
 {
@@ -13,6 +17,13 @@ constexpr int StudioCacheMaxBits = 12; // 4096 entries
 static int s_cacheCount;
 static StudioCache s_caches[1 << StudioCacheMaxBits];
 
+// every model's geometry lives in these, 8 MB of vertices and 2 MB of indices per block
+constexpr unsigned StudioPoolVertices = 1 << 18;
+constexpr unsigned StudioPoolIndices = 1 << 20;
+
+static BufferPool s_vertexPool;
+static BufferPool s_indexPool;
+
 // studiohdr_t::name
 struct NameField
 {
@@ -44,6 +55,7 @@ static unsigned ParseTricmds(BuildBuffer *build,
     Vector3 *vertices,
     Vector3 *normals,
     byte *vertinfo,
+    const uint8_t *boneRemap,
     float s,
     float t)
 {
@@ -79,7 +91,7 @@ static unsigned ParseTricmds(BuildBuffer *build,
             vert->texCoord.x = s * tricmds[2];
             vert->texCoord.y = t * tricmds[3];
 
-            vert->bone = vertinfo[tricmds[0]];
+            vert->bone = boneRemap[vertinfo[tricmds[0]]];
 
             tricmds += 4;
             vert++;
@@ -168,6 +180,218 @@ static unsigned ParseTricmds(BuildBuffer *build,
     return baseVertex;
 }
 
+// lod targets as a fraction of the full mesh's indices
+static const float s_lodRatios[StudioMaxLods] = { 1.0f, 0.5f, 0.25f };
+
+// relative to the mesh's extents
+constexpr float StudioLodMaxError = 0.02f;
+
+// a lod has to drop at least this much of the previous one's triangles to be kept
+constexpr float StudioLodMinSaving = 0.15f;
+
+static const float s_lodNormalWeights[3] = { 0.5f, 0.5f, 0.5f };
+
+// appends the simplified index ranges of a mesh after its full one
+static void SimplifyMesh(BuildBuffer *build, unsigned baseVertex, StudioMesh *mesh)
+{
+    unsigned vertexCount = build->vertexCount - baseVertex;
+    const StudioVertexFat *vertices = &build->vertices[baseVertex];
+    const GLuint *indices = &build->indices[mesh->indexOffset_notbytes[0]];
+    unsigned indexCount = mesh->indexCount[0];
+
+    for (int lod = 1; lod < StudioMaxLods; lod++)
+    {
+        mesh->indexOffset_notbytes[lod] = mesh->indexOffset_notbytes[lod - 1];
+        mesh->indexCount[lod] = mesh->indexCount[lod - 1];
+    }
+
+    if (!indexCount)
+    {
+        return;
+    }
+
+    // the positions are relative to their bone, so anything on a triangle that spans
+    // bones stays put. that way nothing gets collapsed onto a vertex in another space
+    std::vector<unsigned char> lock(vertexCount);
+
+    for (unsigned i = 0; i < indexCount; i += 3)
+    {
+        float bone = vertices[indices[i]].bone;
+        if (vertices[indices[i + 1]].bone != bone || vertices[indices[i + 2]].bone != bone)
+        {
+            lock[indices[i]] = 1;
+            lock[indices[i + 1]] = 1;
+            lock[indices[i + 2]] = 1;
+        }
+    }
+
+    for (int lod = 1; lod < StudioMaxLods; lod++)
+    {
+        size_t target = static_cast<size_t>(indexCount * s_lodRatios[lod]) / 3 * 3;
+        unsigned offset = build->indexCount;
+
+        // always simplified from the full mesh, chaining adds up the error
+        size_t count = meshopt_simplifyWithAttributes(
+            &build->indices[offset],
+            indices,
+            indexCount,
+            &vertices->position.x,
+            vertexCount,
+            sizeof(StudioVertexFat),
+            &vertices->normal.x,
+            sizeof(StudioVertexFat),
+            s_lodNormalWeights,
+            3,
+            lock.data(),
+            target,
+            StudioLodMaxError,
+            0,
+            nullptr);
+
+        if (!count || count > mesh->indexCount[lod - 1] * (1.0f - StudioLodMinSaving))
+        {
+            // doesn't get any simpler than the previous one
+            break;
+        }
+
+        meshopt_optimizeVertexCache(&build->indices[offset], &build->indices[offset], count, vertexCount);
+
+        build->indexCount += static_cast<unsigned>(count);
+
+        for (int i = lod; i < StudioMaxLods; i++)
+        {
+            mesh->indexOffset_notbytes[i] = offset;
+            mesh->indexCount[i] = static_cast<unsigned>(count);
+        }
+    }
+}
+
+// true if the skinrefs pick the same texture in every skin family
+static bool SameTexture(studiohdr_t *textureheader, int skinref1, int skinref2)
+{
+    short *skins = (short *)((byte *)textureheader + textureheader->skinindex);
+
+    for (int i = 0; i < textureheader->numskinfamilies; i++)
+    {
+        short *family = &skins[i * textureheader->numskinref];
+        if (family[skinref1] != family[skinref2])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// folds meshes of a submodel that draw with the same texture into the first one, one draw
+// for all of them. the merged away meshes are left empty. rewrites the submodel's indices,
+// which have to be the last thing in the build
+static void MergeMeshes(BuildBuffer *build,
+    unsigned firstIndex,
+    studiohdr_t *textureheader,
+    mstudiomesh_t *meshes,
+    StudioMesh *mem_meshes,
+    int nummesh)
+{
+    // the meshes' vertices follow each other, so a mesh ends where the next one starts
+    std::vector<unsigned> vertexEnd(nummesh);
+    for (int i = 0; i < nummesh; i++)
+    {
+        vertexEnd[i] = (i + 1 < nummesh) ? mem_meshes[i + 1].baseVertex : build->vertexCount;
+    }
+
+    // group leader of each mesh
+    std::vector<int> leader(nummesh, -1);
+    bool merged = false;
+
+    for (int i = 0; i < nummesh; i++)
+    {
+        if (leader[i] != -1 || !mem_meshes[i].indexCount[0])
+        {
+            continue;
+        }
+
+        leader[i] = i;
+
+        for (int j = i + 1; j < nummesh; j++)
+        {
+            // the indices are 16-bit relative to the leader's base vertex
+            if (leader[j] == -1
+                && mem_meshes[j].indexCount[0]
+                && vertexEnd[j] - mem_meshes[i].baseVertex <= UINT16_MAX + 1
+                && SameTexture(textureheader, meshes[i].skinref, meshes[j].skinref))
+            {
+                leader[j] = i;
+                merged = true;
+            }
+        }
+    }
+
+    if (!merged)
+    {
+        return;
+    }
+
+    std::vector<GLuint> source(&build->indices[firstIndex], &build->indices[build->indexCount]);
+    std::vector<StudioMesh> sourceMeshes(mem_meshes, mem_meshes + nummesh);
+
+    unsigned cursor = firstIndex;
+
+    for (int i = 0; i < nummesh; i++)
+    {
+        StudioMesh &group = mem_meshes[i];
+
+        if (leader[i] != i)
+        {
+            // empty or merged into an earlier mesh
+            memset(group.indexOffset_notbytes, 0, sizeof(group.indexOffset_notbytes));
+            memset(group.indexCount, 0, sizeof(group.indexCount));
+            continue;
+        }
+
+        for (int lod = 0; lod < StudioMaxLods; lod++)
+        {
+            // keep sharing the previous range if none of the meshes got simpler
+            bool repeat = lod > 0;
+            for (int j = i; j < nummesh && repeat; j++)
+            {
+                const StudioMesh &from = sourceMeshes[j];
+                repeat = leader[j] != i || from.indexOffset_notbytes[lod] == from.indexOffset_notbytes[lod - 1];
+            }
+
+            if (repeat)
+            {
+                group.indexOffset_notbytes[lod] = group.indexOffset_notbytes[lod - 1];
+                group.indexCount[lod] = group.indexCount[lod - 1];
+                continue;
+            }
+
+            group.indexOffset_notbytes[lod] = cursor;
+
+            for (int j = i; j < nummesh; j++)
+            {
+                if (leader[j] != i)
+                {
+                    continue;
+                }
+
+                const StudioMesh &from = sourceMeshes[j];
+                const GLuint *indices = &source[from.indexOffset_notbytes[lod] - firstIndex];
+                unsigned rebase = from.baseVertex - group.baseVertex;
+
+                for (unsigned k = 0; k < from.indexCount[lod]; k++)
+                {
+                    build->indices[cursor++] = indices[k] + rebase;
+                }
+            }
+
+            group.indexCount[lod] = cursor - group.indexOffset_notbytes[lod];
+        }
+    }
+
+    build->indexCount = cursor;
+}
+
 static int CountVertsTricmds(short *tricmds)
 {
     int result = 0;
@@ -234,49 +458,478 @@ static void PackIndices(uint32_t *indices, unsigned count)
     }
 }
 
-static void PackNormal(int8_t(&dest)[4], const Vector3 &source)
+static void PackNormal(int8_t(&dest)[3], const Vector3 &source)
 {
     dest[0] = (int8_t)Lerp(INT8_MIN, INT8_MAX, 0.5f + (source.x * 0.5f));
     dest[1] = (int8_t)Lerp(INT8_MIN, INT8_MAX, 0.5f + (source.y * 0.5f));
     dest[2] = (int8_t)Lerp(INT8_MIN, INT8_MAX, 0.5f + (source.z * 0.5f));
-    dest[3] = 0;
 }
 
-static void PackVertices(StudioVertexFat *source, int count)
+static int16_t PackPosition(float value, float invScale)
+{
+    return static_cast<int16_t>(Q_clamp(roundf(value * invScale * INT16_MAX), static_cast<float>(-INT16_MAX), static_cast<float>(INT16_MAX)));
+}
+
+// returns the scale the positions were packed with
+static float PackVertices(StudioVertexFat *source, int count)
 {
     static_assert(sizeof(StudioVertex) < sizeof(StudioVertexFat), "wtf");
     StudioVertex *dest = (StudioVertex *)source;
 
+    float scale = 0.0f;
+
+    for (int i = 0; i < count; i++)
+    {
+        const Vector3 &position = source[i].position;
+        scale = Q_max(scale, Q_max(fabsf(position.x), Q_max(fabsf(position.y), fabsf(position.z))));
+    }
+
+    // keep it sane for empty or degenerate models
+    scale = Q_max(scale, 1.0f / 1024);
+    float invScale = 1.0f / scale;
+
     for (int i = 0; i < count; i++)
     {
         StudioVertexFat from = source[i];
         StudioVertex &to = dest[i];
 
-        to.position = from.position;
-        to.texCoord = from.texCoord;
-        to.bone = from.bone;
+        to.position[0] = PackPosition(from.position.x, invScale);
+        to.position[1] = PackPosition(from.position.y, invScale);
+        to.position[2] = PackPosition(from.position.z, invScale);
+        to.position[3] = 0;
+
+        to.texCoord.x = static_cast<uint16_t>(meshopt_quantizeHalf(from.texCoord.x));
+        to.texCoord.y = static_cast<uint16_t>(meshopt_quantizeHalf(from.texCoord.y));
+
         PackNormal(to.normal, from.normal);
+        to.bone = static_cast<uint8_t>(from.bone);
     }
+
+    return scale;
 }
 
-static void BuildStudioVertexBuffer(StudioCache *cache, model_t *model, studiohdr_t *header)
+// cpu side of building a model, filled in on a worker and uploaded on the main thread
+struct StudioBuild
 {
-    int total_verts = CountVerts(header);
-
-    TempMemoryScope temp;
+    StudioCache *cache;
+    studiohdr_t *header;
+    studiohdr_t *textureheader;
 
+    std::vector<StudioVertexFat> vertices;
+    std::vector<GLuint> indices;
     BuildBuffer build;
-    build.vertexCount = 0;
-    build.vertices = temp.Alloc<StudioVertexFat>(total_verts);
-    build.indexCount = 0;
-    build.indices = temp.Alloc<GLuint>(total_verts * 3);
 
+    float positionScale;
+
+    // empty if the disk cache is off
+    char cachePath[256];
+
+    double buildTime;
+};
+
+constexpr uint32_t StudioFileMagic = 0x4d334c47; // GL3M
+
+// bump when the build changes what it produces
+constexpr int StudioFileVersion = 6;
+
+constexpr char StudioFileDirectory[] = "gl3cache";
+
+// followed by the StudioMesh array in bodypart/model/mesh order and
+// the meshoptimizer encoded vertex and index buffers
+struct StudioFileHeader
+{
+    uint32_t magic;
+    int version;
+    uint64_t hash;
+    int length; // studiohdr_t::length
+
+    // layout checks, a file from another build of the renderer is just a miss
+    int vertexSize;
+    int meshCount;
+
+    float positionScale;
+
+    unsigned vertexCount;
+    unsigned indexCount;
+    unsigned vertexBytes;
+    unsigned indexBytes;
+};
+
+static cvar_t *gl3_studio_cache;
+
+// lists the triangle counts of each lod for every built model
+static void StudioLods()
+{
+    static_assert(StudioMaxLods == 3, "update the printout");
+
+    unsigned totals[StudioMaxLods]{};
+
+    for (const StudioCache &cache : s_caches)
+    {
+        if (!cache.fileName[0] || !cache.vertexBuffer)
+        {
+            continue;
+        }
+
+        const unsigned *triangles = cache.lodTriangles;
+        unsigned full = Q_max(triangles[0], 1u);
+
+        g_engfuncs.Con_Printf("%s: %u, %u (%d%%), %u (%d%%)\n",
+            cache.fileName,
+            triangles[0],
+            triangles[1], static_cast<int>(triangles[1] * 100 / full),
+            triangles[2], static_cast<int>(triangles[2] * 100 / full));
+
+        for (int i = 0; i < StudioMaxLods; i++)
+        {
+            totals[i] += triangles[i];
+        }
+    }
+
+    g_engfuncs.Con_Printf("Total: %u, %u, %u triangles\n", totals[0], totals[1], totals[2]);
+}
+
+// lists how many draws merging same texture meshes saved for every built model
+static void StudioDraws()
+{
+    unsigned totalMeshes = 0;
+    unsigned totalDraws = 0;
+
+    for (const StudioCache &cache : s_caches)
+    {
+        if (!cache.fileName[0] || !cache.vertexBuffer)
+        {
+            continue;
+        }
+
+        unsigned meshes = Q_max(cache.meshCount, 1u);
+
+        g_engfuncs.Con_Printf("%s: %u meshes, %u draws (%d%% fewer)\n",
+            cache.fileName,
+            cache.meshCount,
+            cache.drawCount,
+            static_cast<int>((cache.meshCount - cache.drawCount) * 100 / meshes));
+
+        totalMeshes += cache.meshCount;
+        totalDraws += cache.drawCount;
+    }
+
+    g_engfuncs.Con_Printf("Total: %u meshes, %u draws\n", totalMeshes, totalDraws);
+}
+
+void studioCacheInit()
+{
+    gl3_studio_cache = g_engfuncs.pfnRegisterVariable("gl3_studio_cache", "1", 0);
+    g_engfuncs.pfnAddCommand("gl3_studio_lods", StudioLods);
+    g_engfuncs.pfnAddCommand("gl3_studio_draws", StudioDraws);
+
+    bufferPoolInit(s_vertexPool, GL_ARRAY_BUFFER, sizeof(StudioVertex), StudioPoolVertices);
+    bufferPoolInit(s_indexPool, GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort), StudioPoolIndices);
+}
+
+// calls visit for every mesh of the cache in file order
+template<typename Visit>
+static void VisitMeshes(studiohdr_t *header, StudioCache *cache, Visit visit)
+{
     mstudiobodyparts_t *bodyparts = (mstudiobodyparts_t *)((byte *)header + header->bodypartindex);
 
-    studiohdr_t *textureheader = studioTextureHeader(model, header);
+    for (int i = 0; i < header->numbodyparts; i++)
+    {
+        mstudiobodyparts_t *bodypart = &bodyparts[i];
+        mstudiomodel_t *models = (mstudiomodel_t *)((byte *)header + bodypart->modelindex);
+
+        for (int j = 0; j < bodypart->nummodels; j++)
+        {
+            for (int k = 0; k < models[j].nummesh; k++)
+            {
+                visit(cache->bodyparts[i].models[j].meshes[k]);
+            }
+        }
+    }
+}
+
+// number of shorts in a tricmd list including the terminator
+static int CountTricmdShorts(short *tricmds)
+{
+    int result = 1;
+
+    while (1)
+    {
+        int value = tricmds[result - 1];
+        if (!value)
+            break;
+
+        if (value < 0)
+            value = -value;
+
+        result += 1 + (4 * value);
+    }
+
+    return result;
+}
+
+// only hashes what BuildStudioMeshes reads, the rest of the header can't be trusted:
+// the engine writes gl texture names into the textures and we keep the cache index in the name
+static uint64_t HashStudioInputs(StudioBuild *studioBuild, int &meshCount)
+{
+    studiohdr_t *header = studioBuild->header;
+    studiohdr_t *textureheader = studioBuild->textureheader;
+
+    mstudiobodyparts_t *bodyparts = (mstudiobodyparts_t *)((byte *)header + header->bodypartindex);
     short *skins = (short *)((byte *)textureheader + textureheader->skinindex);
     mstudiotexture_t *textures = (mstudiotexture_t *)((byte *)textureheader + textureheader->textureindex);
 
+    uint64_t hash = HashSeed64;
+    meshCount = 0;
+
+    // MergeMeshes looks at every skin family, a reskin can change what gets merged
+    int skinCounts[2] = { textureheader->numskinref, textureheader->numskinfamilies };
+    hash = HashBytes64(hash, skinCounts, sizeof(skinCounts));
+    hash = HashBytes64(hash, skins, textureheader->numskinref * textureheader->numskinfamilies * sizeof(short));
+
+    for (int i = 0; i < header->numbodyparts; i++)
+    {
+        mstudiobodyparts_t *bodypart = &bodyparts[i];
+        mstudiomodel_t *models = (mstudiomodel_t *)((byte *)header + bodypart->modelindex);
+
+        hash = HashBytes64(hash, &bodypart->nummodels, sizeof(bodypart->nummodels));
+
+        for (int j = 0; j < bodypart->nummodels; j++)
+        {
+            mstudiomodel_t *submodel = &models[j];
+            mstudiomesh_t *meshes = (mstudiomesh_t *)((byte *)header + submodel->meshindex);
+
+            int counts[3] = { submodel->nummesh, submodel->numverts, submodel->numnorms };
+            hash = HashBytes64(hash, counts, sizeof(counts));
+            hash = HashBytes64(hash, (byte *)header + submodel->vertindex, submodel->numverts * sizeof(Vector3));
+            hash = HashBytes64(hash, (byte *)header + submodel->vertinfoindex, submodel->numverts);
+            hash = HashBytes64(hash, (byte *)header + submodel->normindex, submodel->numnorms * sizeof(Vector3));
+
+            for (int k = 0; k < submodel->nummesh; k++)
+            {
+                mstudiomesh_t *mesh = &meshes[k];
+                mstudiotexture_t *texture = &textures[skins[mesh->skinref]];
+                short *tricmds = (short *)((byte *)header + mesh->triindex);
+
+                int size[2] = { texture->width, texture->height };
+                hash = HashBytes64(hash, size, sizeof(size));
+                hash = HashBytes64(hash, tricmds, CountTricmdShorts(tricmds) * sizeof(short));
+            }
+
+            meshCount += submodel->nummesh;
+        }
+    }
+
+    // 0 means no hash
+    return hash ? hash : 1;
+}
+
+static bool ReadArray(FILE *stream, void *data, size_t size, size_t count)
+{
+    return fread(data, size, count, stream) == count;
+}
+
+template<typename T>
+static bool ReadArray(FILE *stream, std::vector<T> &data)
+{
+    return data.empty() || ReadArray(stream, data.data(), sizeof(T), data.size());
+}
+
+// fills in the build as if the meshes were parsed and packed, false if there's no usable file
+static bool LoadStudioFile(StudioBuild *studioBuild, uint64_t hash, int meshCount)
+{
+    FILE *stream = fopen(studioBuild->cachePath, "rb");
+    if (!stream)
+    {
+        return false;
+    }
+
+    StudioFileHeader header;
+    bool valid = ReadArray(stream, &header, sizeof(header), 1)
+        && header.magic == StudioFileMagic
+        && header.version == StudioFileVersion
+        && header.hash == hash
+        && header.length == studioBuild->header->length
+        && header.vertexSize == static_cast<int>(sizeof(StudioVertex))
+        && header.meshCount == meshCount
+        && header.positionScale > 0.0f
+        && header.vertexCount <= (1u << 24)
+        && header.indexCount <= (1u << 24)
+        && !(header.indexCount % 3)
+        && header.vertexBytes <= (1u << 28)
+        && header.indexBytes <= (1u << 28);
+
+    std::vector<StudioMesh> meshes;
+    std::vector<unsigned char> encoded;
+
+    if (valid)
+    {
+        meshes.resize(header.meshCount);
+        encoded.resize(header.vertexBytes + header.indexBytes);
+
+        valid = ReadArray(stream, meshes) && ReadArray(stream, encoded);
+    }
+
+    fclose(stream);
+
+    for (const StudioMesh &mesh : meshes)
+    {
+        valid = valid && mesh.baseVertex <= header.vertexCount;
+
+        for (int i = 0; i < StudioMaxLods; i++)
+        {
+            valid = valid
+                && mesh.indexOffset_notbytes[i] <= header.indexCount
+                && mesh.indexCount[i] <= header.indexCount - mesh.indexOffset_notbytes[i];
+        }
+    }
+
+    if (!valid)
+    {
+        return false;
+    }
+
+    // decode in place of the fat buffers like the packing does
+    studioBuild->vertices.resize(Q_max(header.vertexCount, 1u));
+    studioBuild->indices.resize(Q_max((header.indexCount + 1) / 2, 1u));
+
+    if (meshopt_decodeVertexBuffer(studioBuild->vertices.data(), header.vertexCount, sizeof(StudioVertex), encoded.data(), header.vertexBytes)
+        || meshopt_decodeIndexBuffer(studioBuild->indices.data(), header.indexCount, sizeof(uint16_t), encoded.data() + header.vertexBytes, header.indexBytes))
+    {
+        return false;
+    }
+
+    // nothing checksums the content, a damaged file can still decode fine. indices past
+    // the end would go straight into the shared pool and fetch another model's vertices
+    const uint16_t *indices = reinterpret_cast<const uint16_t *>(studioBuild->indices.data());
+
+    for (const StudioMesh &mesh : meshes)
+    {
+        unsigned vertexLimit = header.vertexCount - mesh.baseVertex;
+
+        for (int i = 0; i < StudioMaxLods; i++)
+        {
+            const uint16_t *range = &indices[mesh.indexOffset_notbytes[i]];
+
+            for (unsigned j = 0; j < mesh.indexCount[i]; j++)
+            {
+                if (range[j] >= vertexLimit)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    const StudioMesh *from = meshes.data();
+    VisitMeshes(studioBuild->header, studioBuild->cache, [&from](StudioMesh &mesh) { mesh = *from++; });
+
+    studioBuild->positionScale = header.positionScale;
+
+    BuildBuffer &build = studioBuild->build;
+    build.vertexCount = header.vertexCount;
+    build.vertices = studioBuild->vertices.data();
+    build.indexCount = header.indexCount;
+    build.indices = studioBuild->indices.data();
+    return true;
+}
+
+// expects packed vertices and unpacked indices
+static void SaveStudioFile(StudioBuild *studioBuild, uint64_t hash, int meshCount)
+{
+    const BuildBuffer &build = studioBuild->build;
+
+    std::vector<StudioMesh> meshes;
+    meshes.reserve(meshCount);
+    VisitMeshes(studioBuild->header, studioBuild->cache, [&meshes](StudioMesh &mesh) { meshes.push_back(mesh); });
+
+    std::vector<unsigned char> vertexData(meshopt_encodeVertexBufferBound(build.vertexCount, sizeof(StudioVertex)));
+    vertexData.resize(meshopt_encodeVertexBuffer(vertexData.data(), vertexData.size(), build.vertices, build.vertexCount, sizeof(StudioVertex)));
+
+    std::vector<unsigned char> indexData(meshopt_encodeIndexBufferBound(build.indexCount, build.vertexCount));
+    indexData.resize(meshopt_encodeIndexBuffer(indexData.data(), indexData.size(), build.indices, build.indexCount));
+
+    if (vertexData.empty() || (build.indexCount && indexData.empty()))
+    {
+        return;
+    }
+
+    StudioFileHeader header;
+    header.magic = StudioFileMagic;
+    header.version = StudioFileVersion;
+    header.hash = hash;
+    header.length = studioBuild->header->length;
+    header.vertexSize = sizeof(StudioVertex);
+    header.meshCount = meshCount;
+    header.positionScale = studioBuild->positionScale;
+    header.vertexCount = build.vertexCount;
+    header.indexCount = build.indexCount;
+    header.vertexBytes = static_cast<unsigned>(vertexData.size());
+    header.indexBytes = static_cast<unsigned>(indexData.size());
+
+    // same dance as the world cache, another client might be writing the same file
+    char tempPath[sizeof(studioBuild->cachePath) + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", studioBuild->cachePath);
+
+    FILE *stream = fopen(tempPath, "wb");
+    if (!stream)
+    {
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, stream) == 1
+        && fwrite(meshes.data(), sizeof(StudioMesh), meshes.size(), stream) == meshes.size()
+        && fwrite(vertexData.data(), 1, vertexData.size(), stream) == vertexData.size()
+        && fwrite(indexData.data(), 1, indexData.size(), stream) == indexData.size();
+
+    written = (fclose(stream) == 0) && written;
+
+    remove(studioBuild->cachePath);
+
+    if (!written || rename(tempPath, studioBuild->cachePath))
+    {
+        remove(tempPath);
+    }
+}
+
+// collects the bones a submodel's vertices use, in model bone order. bad
+// indices go to bone 0 rather than past the end of the bone transforms
+static void BuildBonePalette(StudioSubModel *mem_model, studiohdr_t *header, mstudiomodel_t *submodel)
+{
+    byte *vertinfo = (byte *)header + submodel->vertinfoindex;
+    int numbones = Q_clamp(header->numbones, 0, 256);
+
+    bool used[256]{};
+    for (int i = 0; i < submodel->numverts; i++)
+    {
+        int bone = vertinfo[i];
+        used[(bone < numbones) ? bone : 0] = true;
+    }
+
+    int count = 0;
+    for (int i = 0; i < numbones; i++)
+    {
+        count += used[i] ? 1 : 0;
+    }
+
+    mem_model->bones = memoryStaticAlloc<uint8_t>(Q_max(count, 1));
+    mem_model->boneCount = count;
+
+    count = 0;
+    for (int i = 0; i < numbones; i++)
+    {
+        if (used[i])
+        {
+            mem_model->bones[count++] = static_cast<uint8_t>(i);
+        }
+    }
+}
+
+// memoryStaticAlloc isn't thread safe, so the mesh tree gets allocated up front
+static void AllocateMeshes(StudioCache *cache, studiohdr_t *header)
+{
+    mstudiobodyparts_t *bodyparts = (mstudiobodyparts_t *)((byte *)header + header->bodypartindex);
+
     cache->bodyparts = memoryStaticAlloc<StudioBodypart>(header->numbodyparts);
 
     for (int i = 0; i < header->numbodyparts; i++)
@@ -287,6 +940,43 @@ static void BuildStudioVertexBuffer(StudioCache *cache, model_t *model, studiohd
         StudioBodypart *mem_bodypart = &cache->bodyparts[i];
         mem_bodypart->models = memoryStaticAlloc<StudioSubModel>(bodypart->nummodels);
 
+        for (int j = 0; j < bodypart->nummodels; j++)
+        {
+            mem_bodypart->models[j].meshes = memoryStaticAlloc<StudioMesh>(models[j].nummesh);
+            BuildBonePalette(&mem_bodypart->models[j], header, &models[j]);
+        }
+    }
+}
+
+static void ParseStudioMeshes(StudioBuild *studioBuild)
+{
+    studiohdr_t *header = studioBuild->header;
+    int total_verts = CountVerts(header);
+
+    // not temp memory, that's only for the main thread
+    studioBuild->vertices.resize(Q_max(total_verts, 1));
+    // room for the lods, simplification needs as much as the full mesh to work with
+    studioBuild->indices.resize(Q_max(total_verts * 3 * StudioMaxLods, 1));
+
+    BuildBuffer &build = studioBuild->build;
+    build.vertexCount = 0;
+    build.vertices = studioBuild->vertices.data();
+    build.indexCount = 0;
+    build.indices = studioBuild->indices.data();
+
+    mstudiobodyparts_t *bodyparts = (mstudiobodyparts_t *)((byte *)header + header->bodypartindex);
+
+    studiohdr_t *textureheader = studioBuild->textureheader;
+    short *skins = (short *)((byte *)textureheader + textureheader->skinindex);
+    mstudiotexture_t *textures = (mstudiotexture_t *)((byte *)textureheader + textureheader->textureindex);
+
+    for (int i = 0; i < header->numbodyparts; i++)
+    {
+        mstudiobodyparts_t *bodypart = &bodyparts[i];
+        mstudiomodel_t *models = (mstudiomodel_t *)((byte *)header + bodypart->modelindex);
+
+        StudioBodypart *mem_bodypart = &studioBuild->cache->bodyparts[i];
+
         for (int j = 0; j < bodypart->nummodels; j++)
         {
             mstudiomodel_t *submodel = &models[j];
@@ -298,7 +988,20 @@ static void BuildStudioVertexBuffer(StudioCache *cache, model_t *model, studiohd
             byte *vertinfo = (byte *)((byte *)header + submodel->vertinfoindex);
 
             StudioSubModel *mem_model = &mem_bodypart->models[j];
-            mem_model->meshes = memoryStaticAlloc<StudioMesh>(submodel->nummesh);
+
+            // model bone -> palette index, same fallback as BuildBonePalette
+            uint8_t boneRemap[256]{};
+            for (int l = 0; l < mem_model->boneCount; l++)
+            {
+                boneRemap[mem_model->bones[l]] = static_cast<uint8_t>(l);
+            }
+
+            for (int l = Q_max(header->numbones, 0); l < 256; l++)
+            {
+                boneRemap[l] = boneRemap[0];
+            }
+
+            unsigned firstIndex = build.indexCount;
 
             for (int k = 0; k < submodel->nummesh; k++)
             {
@@ -310,38 +1013,139 @@ static void BuildStudioVertexBuffer(StudioCache *cache, model_t *model, studiohd
                 float t = 1.0f / (float)texture->height;
 
                 unsigned index_offset = build.indexCount;
-                unsigned baseVertex = ParseTricmds(&build, tricmds, vertices, normals, vertinfo, s, t);
+                unsigned baseVertex = ParseTricmds(&build, tricmds, vertices, normals, vertinfo, boneRemap, s, t);
 
                 StudioMesh *mem_mesh = &mem_model->meshes[k];
-                mem_mesh->indexOffset_notbytes = index_offset;
-                mem_mesh->indexCount = build.indexCount - index_offset;
+                mem_mesh->indexOffset_notbytes[0] = index_offset;
+                mem_mesh->indexCount[0] = build.indexCount - index_offset;
                 mem_mesh->baseVertex = baseVertex;
+
+                SimplifyMesh(&build, baseVertex, mem_mesh);
             }
+
+            MergeMeshes(&build, firstIndex, textureheader, meshes, mem_model->meshes, submodel->nummesh);
         }
     }
 
     // packing vertices afterwards
-    PackVertices(build.vertices, build.vertexCount);
+    studioBuild->positionScale = PackVertices(build.vertices, build.vertexCount);
+}
+
+// safe to run on a worker, only touches the build and the cache's mesh tree
+static void BuildStudioMeshes(StudioBuild *studioBuild)
+{
+    uint64_t hash = 0;
+    int meshCount = 0;
+
+    if (studioBuild->cachePath[0])
+    {
+        hash = HashStudioInputs(studioBuild, meshCount);
+
+        if (LoadStudioFile(studioBuild, hash, meshCount))
+        {
+            return;
+        }
+    }
+
+    ParseStudioMeshes(studioBuild);
+
+    if (hash)
+    {
+        SaveStudioFile(studioBuild, hash, meshCount);
+    }
 
     // why use u32 when u16 do trick..
+    BuildBuffer &build = studioBuild->build;
     PackIndices(build.indices, build.indexCount);
+}
+
+static void UploadStudioMeshes(StudioBuild *studioBuild)
+{
+    StudioCache *cache = studioBuild->cache;
+    const BuildBuffer &build = studioBuild->build;
+
+    cache->positionScale = studioBuild->positionScale;
+    cache->vertexCount = build.vertexCount;
+    cache->vertexBuffer = bufferPoolAlloc(s_vertexPool, build.vertexCount, cache->firstVertex);
+    bufferPoolUpload(s_vertexPool, cache->vertexBuffer, cache->firstVertex, build.vertexCount, build.vertices);
+
+    cache->indexCount = build.indexCount;
+    cache->indexBuffer = bufferPoolAlloc(s_indexPool, build.indexCount, cache->firstIndex);
+    bufferPoolUpload(s_indexPool, cache->indexBuffer, cache->firstIndex, build.indexCount, build.indices);
 
-    glGenBuffers(1, &cache->vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, cache->vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, build.vertexCount * sizeof(StudioVertex), build.vertices, GL_STATIC_DRAW);
+    // the build and the cache files are relative to the model, move the meshes to where it landed
+    memset(cache->lodTriangles, 0, sizeof(cache->lodTriangles));
+    cache->meshCount = 0;
+    cache->drawCount = 0;
 
-    glGenBuffers(1, &cache->indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cache->indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, build.indexCount * sizeof(GLushort), build.indices, GL_STATIC_DRAW);
+    VisitMeshes(studioBuild->header, cache, [cache](StudioMesh &mesh)
+    {
+        cache->meshCount++;
+        cache->drawCount += mesh.indexCount[0] ? 1 : 0;
+
+        mesh.baseVertex += cache->firstVertex;
+
+        for (int i = 0; i < StudioMaxLods; i++)
+        {
+            mesh.indexOffset_notbytes[i] += cache->firstIndex;
+            cache->lodTriangles[i] += mesh.indexCount[i] / 3;
+        }
+    });
+
+    // done with the cpu copy
+    std::vector<StudioVertexFat>().swap(studioBuild->vertices);
+    std::vector<GLuint>().swap(studioBuild->indices);
 }
 
-static void BuildStudioCache(StudioCache *cache, model_t *model, studiohdr_t *header)
+// main thread part of a build, engine calls and allocations
+static void BeginStudioBuild(StudioBuild *studioBuild, StudioCache *cache, model_t *model, studiohdr_t *header)
 {
-    Q_strcpy(cache->fileName, model->name);
+    // the lookup already set the name to claim the slot
     cache->fileLength = header->length;
 
-    // build vertex and index buffer
-    BuildStudioVertexBuffer(cache, model, header);
+    AllocateMeshes(cache, header);
+
+    studioBuild->cache = cache;
+    studioBuild->header = header;
+    studioBuild->textureheader = studioTextureHeader(model, header);
+    studioBuild->cachePath[0] = '\0';
+
+    if (gl3_studio_cache->value)
+    {
+        // models/player/gign/gign.mdl -> <gamedir>/gl3cache/models_player_gign_gign.gl3m
+        char baseName[128];
+        Q_strcpy_truncate(baseName, model->name);
+
+        char *extension = strrchr(baseName, '.');
+        if (extension)
+        {
+            *extension = '\0';
+        }
+
+        for (char *c = baseName; *c; c++)
+        {
+            if (*c == '/' || *c == '\\' || *c == ':')
+            {
+                *c = '_';
+            }
+        }
+
+        char directory[192];
+        snprintf(directory, sizeof(directory), "%s/%s", g_engfuncs.pfnGetGameDirectory(), StudioFileDirectory);
+
+        // fails if it already exists, which is fine
+        platformMakeDirectory(directory);
+
+        snprintf(studioBuild->cachePath, sizeof(studioBuild->cachePath), "%s/%s.gl3m", directory, baseName);
+    }
+}
+
+static void BuildStudioCache(StudioCache *cache, model_t *model, studiohdr_t *header)
+{
+    StudioBuild studioBuild;
+    BeginStudioBuild(&studioBuild, cache, model, header);
+    BuildStudioMeshes(&studioBuild);
+    UploadStudioMeshes(&studioBuild);
 }
 
 static NameField *GetNameField(studiohdr_t *header)
@@ -371,14 +1175,21 @@ static void ReleaseCache(StudioCache *cache)
 {
     // we can't free the memory allocated with memoryStaticAlloc, but
     // those allocations are very small so doesn't matter
-    // free the gpu buffers though
-    glDeleteBuffers(1, &cache->vertexBuffer);
-    glDeleteBuffers(1, &cache->indexBuffer);
+    // give the buffer ranges back though, unless the build hasn't been uploaded yet
+    if (cache->vertexBuffer)
+    {
+        bufferPoolFree(s_vertexPool, cache->vertexBuffer, cache->firstVertex, cache->vertexCount);
+        bufferPoolFree(s_indexPool, cache->indexBuffer, cache->firstIndex, cache->indexCount);
+    }
+
     memset(cache, 0, sizeof(*cache));
 }
 
-StudioCache *studioCacheGet(model_t *model, studiohdr_t *header)
+// finds the cache slot for the model, build is set if the caller has to (re)build it
+static StudioCache *LookupCache(model_t *model, studiohdr_t *header, bool &build)
 {
+    build = false;
+
     // see if the cache index is in the header
     int cacheIndex = GetCacheIndex(header);
     if (cacheIndex != -1)
@@ -405,7 +1216,9 @@ StudioCache *studioCacheGet(model_t *model, studiohdr_t *header)
 
             s_cacheCount++;
 
-            BuildStudioCache(cache, model, header);
+            // claim the slot now, the build fills in the rest
+            Q_strcpy(cache->fileName, model->name);
+            build = true;
             SetCacheIndex(header, i);
             return cache;
         }
@@ -416,7 +1229,8 @@ StudioCache *studioCacheGet(model_t *model, studiohdr_t *header)
             if (header->length != cache->fileLength)
             {
                 ReleaseCache(cache);
-                BuildStudioCache(cache, model, header);
+                Q_strcpy(cache->fileName, model->name);
+                build = true;
             }
 
             // update the header
@@ -426,6 +1240,19 @@ StudioCache *studioCacheGet(model_t *model, studiohdr_t *header)
     }
 }
 
+StudioCache *studioCacheGet(model_t *model, studiohdr_t *header)
+{
+    bool build;
+    StudioCache *cache = LookupCache(model, header, build);
+
+    if (build)
+    {
+        BuildStudioCache(cache, model, header);
+    }
+
+    return cache;
+}
+
 StudioCache *studioCacheGet(cl_entity_t *entity)
 {
     model_t *model = entity->model;
@@ -442,8 +1269,41 @@ StudioCache *studioCacheGet(cl_entity_t *entity)
     return studioCacheGet(model, studiohdr);
 }
 
-void studioCacheTouchAll()
+// studioCacheTouchAll's builds, kept until the uploads have run
+static std::vector<StudioBuild> s_touchBuilds;
+static JobCounter *s_touchCounter;
+
+static void UploadTouchedModel(void *context)
+{
+    StudioBuild *build = static_cast<StudioBuild *>(context);
+    UploadStudioMeshes(build);
+    levelPrepAddTime(LevelPrepStudioBuild, build->buildTime);
+}
+
+static void BuildStudioJob(void *context, int begin, int end)
 {
+    for (int i = begin; i < end; i++)
+    {
+        StudioBuild *build = &s_touchBuilds[i];
+
+        double start = profileSeconds();
+        BuildStudioMeshes(build);
+        build->buildTime = profileSeconds() - start;
+
+        // gl has to happen on the main thread
+        jobQueueMainThread(UploadTouchedModel, build, s_touchCounter);
+    }
+}
+
+int studioCacheTouchAll(JobCounter &counter)
+{
+    double start = profileSeconds();
+
+    // the previous level's uploads are done by now
+    s_touchBuilds.clear();
+    s_touchCounter = &counter;
+
+    // engine calls and the slot lookup stay on this thread, only the mesh building goes wide
     for (int i = 2;; i++)
     {
         model_t *model = g_engineStudio.GetModelByIndex(i);
@@ -458,11 +1318,31 @@ void studioCacheTouchAll()
         }
 
         studiohdr_t *studiohdr = static_cast<studiohdr_t *>(g_engineStudio.Mod_Extradata(model));
-        if (studiohdr)
+        if (!studiohdr)
         {
-            studioCacheGet(model, studiohdr);
+            continue;
+        }
+
+        bool build;
+        StudioCache *cache = LookupCache(model, studiohdr, build);
+
+        if (build)
+        {
+            s_touchBuilds.emplace_back();
+            BeginStudioBuild(&s_touchBuilds.back(), cache, model, studiohdr);
         }
     }
+
+    levelPrepAddTime(LevelPrepStudioSetup, profileSeconds() - start);
+
+    int count = static_cast<int>(s_touchBuilds.size());
+
+    for (int i = 0; i < count; i++)
+    {
+        jobAdd(&counter, BuildStudioJob, nullptr, i, i + 1);
+    }
+
+    return count;
 }
 
 }
@@ -4,16 +4,29 @@
 namespace Render
 {
 
+struct JobCounter;
+
+// full detail and two simplified versions
+constexpr int StudioMaxLods = 3;
+
 struct StudioMesh
 {
-    unsigned indexOffset_notbytes;
-    unsigned indexCount;
+    // index range of each lod, 0 is the full mesh. a lod that
+    // couldn't be simplified any further repeats the previous one.
+    // empty if the mesh got merged into an earlier one with the same texture
+    unsigned indexOffset_notbytes[StudioMaxLods];
+    unsigned indexCount[StudioMaxLods];
     unsigned baseVertex;
 };
 
 struct StudioSubModel
 {
     StudioMesh *meshes;
+
+    // the model bones the submodel's vertices reference, StudioVertex::bone
+    // indexes this so only these matrices need to be uploaded for a draw
+    uint8_t *bones;
+    int boneCount;
 };
 
 struct StudioBodypart
@@ -23,19 +36,19 @@ struct StudioBodypart
 
 struct StudioVertex
 {
-    Vector3 position;
-    Vector2 texCoord;
+    // snorm, multiplied by StudioCache::positionScale in the shader. positions are
+    // relative to their bone so even large models stay well within a few units of error
+    int16_t position[4];
 
-    // store the bone as a float so we don't have to use glVertexAttribIPointer
-    float bone;
+    HalfVector2 texCoord;
 
     // pack normals to 24 bits... GL_INT_2_10_10_10_REV not available
     // and this is generally enough resolution (valve studiomdl quantizes
     // to 2 degrees of accuracy, int8 component should have around 0.6)
-    int8_t normal[4];
+    int8_t normal[3];
 
-    // could use for tangent or smooth normals
-    int8_t padding[4];
+    // unnormalized so the shader gets it as a float, no glVertexAttribIPointer needed
+    uint8_t bone;
 };
 
 struct StudioCache
@@ -45,14 +58,37 @@ struct StudioCache
 
     StudioBodypart *bodyparts;
 
+    // largest vertex coordinate, see StudioVertex::position
+    float positionScale;
+
+    // shared with other models, see bufferpool.h. the meshes'
+    // base vertices and index offsets already include the ranges
     GLuint vertexBuffer;
     GLuint indexBuffer;
+
+    unsigned firstVertex;
+    unsigned vertexCount;
+    unsigned firstIndex;
+    unsigned indexCount;
+
+    // summed over every mesh, for gl3_studio_lods
+    unsigned lodTriangles[StudioMaxLods];
+
+    // meshes in the model and the draws left after merging, for gl3_studio_draws
+    unsigned meshCount;
+    unsigned drawCount;
 };
 
+// registers gl3_studio_cache, gl3_studio_lods and gl3_studio_draws
+void studioCacheInit();
+
 StudioCache *studioCacheGet(model_t *model, studiohdr_t *header);
 StudioCache *studioCacheGet(cl_entity_t *entity);
 
-void studioCacheTouchAll();
+// builds the caches of every loaded model on the job system, the uploads
+// go through the main thread queue. the counter is done when they've all run.
+// returns the number of models being built
+int studioCacheTouchAll(JobCounter &counter);
 
 }
 
@@ -3,6 +3,7 @@
 #include "brush.h" // worldmodel lightmap
 #include "internal.h"
 #include "lightstyle.h"
+#include "lightprobe.h"
 
 namespace Render
 {
@@ -18,13 +19,8 @@ constexpr int MaxClientEntities = 1024;
 enum LightingType
 {
     LightingNormal,
-    LightingSky
-};
-
-struct NormalLighting
-{
-    LightmapSamples sample;
-    LightmapSamples intensity[4];
+    LightingSky,
+    LightingProbes
 };
 
 struct SkyLighting
@@ -38,8 +34,9 @@ struct LightingData
 
     union
     {
-        NormalLighting normal;
+        LightProbe normal;
         SkyLighting sky;
+        LightProbeResult probes;
     } lighting;
 };
 
@@ -53,6 +50,7 @@ struct LightingKey
 struct LightingCache
 {
     bool dirty{ true };
+    unsigned probeGeneration; // the probes get freed with the level
 
     LightingKey key;
     LightingData data;
@@ -76,23 +74,10 @@ inline Vector3 AnimatePoint(const Vector3 &point)
     return result;
 }
 
-bool studioFrustumCull(cl_entity_t *entity, studiohdr_t *header)
+static void SequenceBounds(studiohdr_t *header, int sequenceIndex, Vector3 &localMins, Vector3 &localMaxs)
 {
-    if (entity == g_engfuncs.GetViewModel())
-    {
-        // no need to cull, and interferes with bbox visualization
-        return false;
-    }
-
-    if (entity->curstate.sequence >= header->numseq)
-    {
-        entity->curstate.sequence = 0;
-    }
-
     mstudioseqdesc_t *sequences = (mstudioseqdesc_t *)((byte *)header + header->seqindex);
-    mstudioseqdesc_t *sequence = &sequences[entity->curstate.sequence];
-
-    Vector3 localMins, localMaxs;
+    mstudioseqdesc_t *sequence = &sequences[sequenceIndex];
 
     // none of the fallback paths are realistically executed, but keep them in anyway
     if (!VectorIsZero(sequence->bbmin))
@@ -115,6 +100,23 @@ bool studioFrustumCull(cl_entity_t *entity, studiohdr_t *header)
         localMins = { -16, -16, -16 };
         localMaxs = { 16, 16, 16 };
     }
+}
+
+bool studioFrustumCull(cl_entity_t *entity, studiohdr_t *header)
+{
+    if (entity == g_engfuncs.GetViewModel())
+    {
+        // no need to cull, and interferes with bbox visualization
+        return false;
+    }
+
+    if (entity->curstate.sequence >= header->numseq)
+    {
+        entity->curstate.sequence = 0;
+    }
+
+    Vector3 localMins, localMaxs;
+    SequenceBounds(header, entity->curstate.sequence, localMins, localMaxs);
 
     Vector3 mins{ FLT_MAX, FLT_MAX, FLT_MAX };
     Vector3 maxs{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
@@ -144,6 +146,44 @@ bool studioFrustumCull(cl_entity_t *entity, studiohdr_t *header)
     return g_state.viewFrustum.CullBox(center, extents);
 }
 
+bool studioEntityBounds(cl_entity_t *entity, Vector3 &center, Vector3 &extents)
+{
+    // takes its position from the entity it follows when drawn
+    if (entity->curstate.movetype == MOVETYPE_FOLLOW)
+    {
+        return false;
+    }
+
+    studiohdr_t *header = static_cast<studiohdr_t *>(g_engineStudio.Mod_Extradata(entity->model));
+    if (!header)
+    {
+        return false;
+    }
+
+    // leave fixing up the sequence to studioFrustumCull
+    int sequence = entity->curstate.sequence;
+    if (sequence < 0 || sequence >= header->numseq)
+    {
+        sequence = 0;
+    }
+
+    Vector3 localMins, localMaxs;
+    SequenceBounds(header, sequence, localMins, localMaxs);
+
+    // the game can draw the model with different angles than the entity has (players
+    // for one) so use a box that holds the sequence bbox in any orientation
+    Vector3 corner;
+    corner.x = Q_max(fabsf(localMins.x), fabsf(localMaxs.x));
+    corner.y = Q_max(fabsf(localMins.y), fabsf(localMaxs.y));
+    corner.z = Q_max(fabsf(localMins.z), fabsf(localMaxs.z));
+
+    float radius = VectorLength(corner) * Q_max(entity->curstate.scale, 1.0f);
+
+    center = entity->origin;
+    extents = { radius, radius, radius };
+    return true;
+}
+
 void studioUpdateSkyLight(const movevars_t *mv)
 {
     Vector3 skyColor{ mv->skycolor_r, mv->skycolor_g, mv->skycolor_b };
@@ -158,10 +198,10 @@ void studioUpdateSkyLight(const movevars_t *mv)
     s_skyColor = skyColor;
     s_skyVec = skyVec;
 
-    // invalidate skylight caches
+    // invalidate skylight caches, the probes might see the sky now
     for (LightingCache &cache : s_lightingCache)
     {
-        if (!cache.dirty && cache.data.type == LightingSky)
+        if (!cache.dirty && (cache.data.type == LightingSky || cache.data.type == LightingProbes))
         {
             cache.dirty = true;
         }
@@ -180,13 +220,21 @@ static void ComputeLightingForKey(Vector3 &direction, LightingData &result, cons
     }
 
     Vector3 start = key.origin - direction * 8;
+    bool skyLit = !VectorIsZero(s_skyColor);
 
-    if (!VectorIsZero(s_skyColor))
+    // the probes only have the downward traces
+    LightProbeResult &probes = result.lighting.probes;
+    bool probed = !(key.effects & EF_INVLIGHT) && lightProbeSample(probes, key.origin, skyLit ? &s_skyVec : nullptr);
+
+    if (skyLit)
     {
         Vector3 end = key.origin - (s_skyVec * 8192);
 
         // no constant for this flag in the sdk (it's in gl_model.h)
-        if ((key.model_flags & 1024) || internalTraceLineToSky(g_worldmodel->engine_model, start, end))
+        bool sky = (key.model_flags & 1024)
+            || (probed ? (probes.sky >= 0.5f) : internalTraceLineToSky(g_worldmodel->engine_model, start, end));
+
+        if (sky)
         {
             result.type = LightingSky;
             result.lighting.sky.color = s_skyColor;
@@ -195,29 +243,26 @@ static void ComputeLightingForKey(Vector3 &direction, LightingData &result, cons
         }
     }
 
-    result.type = LightingNormal;
-
-    // need to do this bullshit
-    Vector3 end = start + direction * 2048;
-    result.lighting.normal.sample = internalSampleLightmap(g_worldmodel->engine_model, start, end);
-
-    start.x -= 16;
-    start.y -= 16;
-    end.x -= 16;
-    end.y -= 16;
-    result.lighting.normal.intensity[0] = internalSampleLightmap(g_worldmodel->engine_model, start, end);
+    if (probed)
+    {
+        result.type = LightingProbes;
+        return;
+    }
 
-    start.x += 32;
-    end.x += 32;
-    result.lighting.normal.intensity[1] = internalSampleLightmap(g_worldmodel->engine_model, start, end);
+    result.type = LightingNormal;
+    lightProbeTrace(g_worldmodel->engine_model, start, direction, result.lighting.normal);
+}
 
-    start.y += 32;
-    end.y += 32;
-    result.lighting.normal.intensity[2] = internalSampleLightmap(g_worldmodel->engine_model, start, end);
+// adds what the samples under the entity contribute to the color and the four direction intensities
+static void AccumulateNormalLighting(const LightProbe &probe, float weight, Vector3 &color, float (&intensity)[4])
+{
+    color += lightstyleApply(probe.sample) * weight;
 
-    start.x -= 32;
-    end.x -= 32;
-    result.lighting.normal.intensity[3] = internalSampleLightmap(g_worldmodel->engine_model, start, end);
+    for (int i = 0; i < 4; i++)
+    {
+        Vector3 sample = lightstyleApply(probe.intensity[i]);
+        intensity[i] += weight * (sample.x + sample.y + sample.z) / 768.0f;
+    }
 }
 
 static const LightingData &GetCachedLightingData(Vector3 &out_direction, cl_entity_t *entity)
@@ -231,7 +276,7 @@ static const LightingData &GetCachedLightingData(Vector3 &out_direction, cl_enti
     GL3_ASSERT(index >= 0 && index < MaxClientEntities);
 
     LightingCache &cache = s_lightingCache[index];
-    if (!cache.dirty)
+    if (!cache.dirty && cache.probeGeneration == lightProbeGeneration())
     {
         if (!memcmp(&cache.key, &key, sizeof(LightingKey)))
         {
@@ -245,6 +290,7 @@ static const LightingData &GetCachedLightingData(Vector3 &out_direction, cl_enti
     }
 
     cache.key = key;
+    cache.probeGeneration = lightProbeGeneration();
     ComputeLightingForKey(cache.direction, cache.data, cache.key);
     out_direction = cache.direction;
 
@@ -277,19 +323,27 @@ void studioDynamicLight(cl_entity_t *entity, alight_t *light)
     }
     else
     {
-        color = lightstyleApply(data.lighting.normal.sample);
-
-        Vector3 sample2 = lightstyleApply(data.lighting.normal.intensity[0]);
-        float f1 = (sample2.x + sample2.y + sample2.z) / 768.0f;
-
-        sample2 = lightstyleApply(data.lighting.normal.intensity[1]);
-        float f2 = (sample2.x + sample2.y + sample2.z) / 768.0f;
+        color = { 0, 0, 0 };
+        float intensity[4]{};
 
-        sample2 = lightstyleApply(data.lighting.normal.intensity[2]);
-        float f3 = (sample2.x + sample2.y + sample2.z) / 768.0f;
+        if (data.type == LightingProbes)
+        {
+            // lightstyles animate, so the probes get blended after applying them
+            const LightProbeResult &probes = data.lighting.probes;
+            for (int i = 0; i < probes.count; i++)
+            {
+                AccumulateNormalLighting(*probes.probes[i], probes.weights[i], color, intensity);
+            }
+        }
+        else
+        {
+            AccumulateNormalLighting(data.lighting.normal, 1.0f, color, intensity);
+        }
 
-        sample2 = lightstyleApply(data.lighting.normal.intensity[3]);
-        float f4 = (sample2.x + sample2.y + sample2.z) / 768.0f;
+        float f1 = intensity[0];
+        float f2 = intensity[1];
+        float f3 = intensity[2];
+        float f4 = intensity[3];
 
         direction.x = f4 - f2 - f3 + f1;
         direction.y = f2 - f3 - f4 + f1;
@@ -7,6 +7,9 @@ namespace Render
 void studioUpdateSkyLight(const movevars_t *movevars);
 
 bool studioFrustumCull(cl_entity_t *entity, studiohdr_t *header);
+
+// conservative world bounds for culling before the game sets up bones, false if it can't be culled
+bool studioEntityBounds(cl_entity_t *entity, Vector3 &center, Vector3 &extents);
 void studioDynamicLight(cl_entity_t *entity, alight_t *light);
 
 studiohdr_t *studioTextureHeader(model_t *model, studiohdr_t *header);
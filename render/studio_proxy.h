@@ -6,6 +6,7 @@ namespace Render
 
 struct StudioCache;
 struct StudioSubModel;
+struct StudioBatch;
 
 // per-entity rendering state
 struct StudioContext
@@ -31,6 +32,12 @@ struct StudioContext
 
     // FIXME: reconsider
     int rendermode;
+
+    int lod; // index range of the meshes to draw, picked in studioSetupRenderer
+
+    // set if the entity went into an instanced batch instead of drawing itself
+    StudioBatch *batch;
+    bool batchOwner; // first entity of the batch, its submodels get recorded
 };
 
 void studioProxyInit(struct engine_studio_api_s *studio);
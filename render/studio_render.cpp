@@ -18,19 +18,67 @@ struct StudioConstants
     Vector4 lightDir;
     Vector4 ambientAndShadeLight; // x = ambientlight, y = shadelight
     Vector4 chromeOriginAndShellScale; // chrome origin (xyz) and glowshell scale (w)
+    Vector4 positionScale; // x = StudioCache::positionScale
 
     Vector4 elightPositions[STUDIO_MAX_ELIGHTS];
     Vector4 elightColors[STUDIO_MAX_ELIGHTS]; // 4th component stores radius^2
+};
+
+// a submodel's bones uploaded this frame, shell and multi-pass draws of the same pose reuse it
+struct StudioBoneSpan
+{
+    cl_entity_t *entity;
+    const StudioSubModel *submodel;
+    int frameCount;
+    uint64_t hash; // of the palette matrices, the game may set up the bones again between passes
+    BufferSpan span;
+    int size;
+};
+
+// must match shader
+struct StudioInstance
+{
+    Matrix3x4 transform;
+    Vector4 renderColor;
+    Vector4 lightDir;
+    Vector4 ambientAndShadeLight;
+};
+
+// entities that would draw the exact same pose, only the transform and lighting differ
+struct StudioBatchKey
+{
+    StudioCache *cache;
+    int lod;
+    int skin;
+    int body;
+    int sequence;
+    float frame;
+    byte controller[4];
+    byte blending[2];
+    byte padding[2];
+};
+
+struct StudioBatchSubModel
+{
+    mstudiomodel_t *submodel;
+    StudioSubModel *rendererSubModel;
+};
 
-    // bones must be last! see StudioSetConstants
-    Matrix3x4 bones[MAX_SHADER_BONES];
+struct StudioBatch
+{
+    StudioBatchKey key;
+    StudioContext context; // the first entity's
+    std::vector<StudioBatchSubModel> submodels;
+    std::vector<StudioInstance> instances;
+    std::vector<BufferSpan> instanceSpans; // STUDIO_MAX_INSTANCES per span, filled in DrawBatch
+    Matrix3x4 bones[MAX_SHADER_BONES]; // relative to the model
 };
 
 static const VertexAttrib s_vertexAttribs[] = {
-    {&StudioVertex::position, "a_position" },
+    {&StudioVertex::position, "a_position", true },
     {&StudioVertex::texCoord, "a_texCoord" },
     {&StudioVertex::bone, "a_bone" },
-    {&StudioVertex::normal, "a_normal", true }
+    {&StudioVertex::normal, "a_normal", true },
 };
 
 const VertexFormat g_studioVertexFormat{ sizeof(StudioVertex) , s_vertexAttribs };
@@ -49,7 +97,8 @@ static const ShaderUniform s_uniforms[] = {
 
 static constexpr ShaderOption s_shaderOptions[] = {
     { "ALPHA_TEST", 1 },
-    { "HAS_ELIGHTS", 1 }
+    { "HAS_ELIGHTS", 1 },
+    { "INSTANCED", 1 }
 };
 
 // must match s_shaderOptions
@@ -57,6 +106,7 @@ struct StudioShaderOptions
 {
     unsigned alphaTest;
     unsigned hasElights;
+    unsigned instanced;
 };
 
 static StudioShader s_shaders[shaderVariantCount(s_shaderOptions)];
@@ -67,11 +117,39 @@ static StudioShader *s_currentShader;
 
 static cvar_t *r_glowshellfreq;
 static cvar_t *cl_righthand;
+static cvar_t *gl3_studio_instancing;
+static cvar_t *gl3_studio_lod;
+
+// screen size (fraction of half the viewport height) below which each lod kicks in
+static const float s_lodSizes[StudioMaxLods] = { 0.0f, 0.12f, 0.05f };
+
+// how far past a threshold the size has to go before switching, stops flickering at the edge
+constexpr float StudioLodHysteresis = 0.1f;
+
+constexpr int StudioMaxLodEntities = 1024;
+
+// the lod each entity drew with last
+static uint8_t s_entityLods[StudioMaxLodEntities];
+
+// passes of an entity come one after another, only needs to cover the submodels of a few entities
+constexpr int StudioBoneSpanCount = 32;
+
+static StudioBoneSpan s_boneSpans[StudioBoneSpanCount];
+static int s_nextBoneSpan;
+
+// batches are kept between frames so the vectors keep their memory
+static std::vector<StudioBatch> s_batches;
+static int s_batchCount;
 
 void studioRenderInit()
 {
     shaderRegister(s_shaders, "studio", s_vertexAttribs, s_uniforms, s_shaderOptions);
 
+    gl3_studio_instancing = g_engfuncs.pfnRegisterVariable("gl3_studio_instancing", "1", 0);
+
+    // scales how early the lods kick in, 0 always draws the full models
+    gl3_studio_lod = g_engfuncs.pfnRegisterVariable("gl3_studio_lod", "1", 0);
+
     r_glowshellfreq = g_engfuncs.pfnGetCvarPointer("r_glowshellfreq");
     cl_righthand = g_engfuncs.pfnGetCvarPointer("cl_righthand");
 }
@@ -213,7 +291,9 @@ void studioSetupLighting(StudioContext &context, const alight_t *lighting)
 
 static void StudioSetConstants(StudioContext &context)
 {
-    StudioConstants constants;
+    // written in place, every member gets stored exactly once
+    BufferSpanT<StudioConstants> span = dynamicUniformBegin<StudioConstants>();
+    StudioConstants &constants = *span.data;
 
     entity_state_t &state = context.entity->curstate;
     if (state.renderfx == kRenderFxGlowShell)
@@ -245,10 +325,9 @@ static void StudioSetConstants(StudioContext &context)
         constants.chromeOriginAndShellScale = { g_state.viewOrigin, 0.0f };
     }
 
-    GL3_ASSERT(context.header->numbones <= MAX_SHADER_BONES);
-
     constants.lightDir = { context.lightvec, 0 };
     constants.ambientAndShadeLight = { context.ambientlight, context.shadelight, 0, 0 };
+    constants.positionScale = { context.cache->positionScale, 0, 0, 0 };
 
     for (int i = 0; i < STUDIO_MAX_ELIGHTS; i++)
     {
@@ -256,25 +335,244 @@ static void StudioSetConstants(StudioContext &context)
         constants.elightColors[i] = context.elightColors[i];
     }
 
-    memcpy(static_cast<void *>(constants.bones), g_engineStudio.StudioGetBoneTransform(), sizeof(Matrix3x4) * context.header->numbones);
+    dynamicUniformEnd<StudioConstants>();
+    commandBindUniformBuffer(1, span.buffer, span.byteOffset, sizeof(StudioConstants));
+}
+
+// copies the submodel's palette out of bones straight into the buffer, see StudioSubModel::bones
+static BufferSpan UploadBones(const Matrix3x4 *bones, const StudioSubModel *submodel, int &size)
+{
+    GL3_ASSERT(submodel->boneCount <= MAX_SHADER_BONES);
+
+    BufferSpanT<Matrix3x4> span = dynamicUniformBegin<Matrix3x4>(submodel->boneCount);
+    for (int i = 0; i < submodel->boneCount; i++)
+    {
+        span.data[i] = bones[submodel->bones[i]];
+    }
+
+    dynamicUniformEnd<Matrix3x4>(submodel->boneCount);
+
+    size = static_cast<int>(sizeof(Matrix3x4)) * submodel->boneCount;
+    return { span.buffer, span.byteOffset, span.data };
+}
+
+static void StudioSetBones(StudioContext &context)
+{
+    const StudioSubModel *submodel = context.rendererSubModel;
+    const Matrix3x4 *bones = reinterpret_cast<const Matrix3x4 *>(g_engineStudio.StudioGetBoneTransform());
+
+    uint64_t hash = HashSeed64;
+    for (int i = 0; i < submodel->boneCount; i++)
+    {
+        hash = HashBytes64(hash, &bones[submodel->bones[i]], sizeof(Matrix3x4));
+    }
+
+    for (const StudioBoneSpan &entry : s_boneSpans)
+    {
+        if (entry.entity == context.entity
+            && entry.submodel == submodel
+            && entry.frameCount == g_state.frameCount
+            && entry.hash == hash)
+        {
+            commandBindUniformBuffer(4, entry.span.buffer, entry.span.byteOffset, entry.size);
+            return;
+        }
+    }
+
+    StudioBoneSpan &entry = s_boneSpans[s_nextBoneSpan];
+    s_nextBoneSpan = (s_nextBoneSpan + 1) % StudioBoneSpanCount;
+
+    entry.entity = context.entity;
+    entry.submodel = submodel;
+    entry.frameCount = g_state.frameCount;
+    entry.hash = hash;
+    entry.span = UploadBones(bones, submodel, entry.size);
+
+    commandBindUniformBuffer(4, entry.span.buffer, entry.span.byteOffset, entry.size);
+}
+
+// the pose doesn't depend on the frame, lots of props play a one frame idle
+static bool SingleFrameSequence(studiohdr_t *header, int sequence)
+{
+    if (sequence < 0 || sequence >= header->numseq)
+    {
+        return false;
+    }
+
+    mstudioseqdesc_t *seqdesc = StudioGet<mstudioseqdesc_t>(header, header->seqindex);
+    return seqdesc[sequence].numframes <= 1;
+}
+
+// static props that can be drawn with the other entities using the same model, skin and pose
+static bool CanInstance(StudioContext &context, int rendermode)
+{
+    if (!gl3_studio_instancing->value || s_viewmodel)
+    {
+        return false;
+    }
+
+    cl_entity_t *entity = context.entity;
+    const entity_state_t &state = entity->curstate;
+
+    // the pose has to come from the state alone, so nothing that animates
+    if (entity->player || (state.framerate != 0.0f && !SingleFrameSequence(context.header, state.sequence)))
+    {
+        return false;
+    }
+
+    // anything that touches the blend state or per entity constants draws itself
+    if (rendermode != kRenderNormal || state.renderfx != kRenderFxNone || context.blend != 1.0f)
+    {
+        return false;
+    }
+
+    if (context.elightCount || g_engineStudio.GetForceFaceFlags())
+    {
+        return false;
+    }
+
+    // batch bones are kept in model order
+    return context.header->numbones <= MAX_SHADER_BONES;
+}
+
+static StudioBatch *FindBatch(const StudioBatchKey &key)
+{
+    // there's a handful of batches per frame, a linear search is fine
+    for (int i = 0; i < s_batchCount; i++)
+    {
+        if (!memcmp(&s_batches[i].key, &key, sizeof(key)))
+        {
+            return &s_batches[i];
+        }
+    }
+
+    return nullptr;
+}
+
+static bool AddInstance(StudioContext &context)
+{
+    const entity_state_t &state = context.entity->curstate;
+
+    StudioBatchKey key;
+    memset(&key, 0, sizeof(key));
+    key.cache = context.cache;
+    key.lod = context.lod;
+    key.skin = state.skin;
+    key.body = state.body;
+    key.sequence = state.sequence;
+    key.frame = SingleFrameSequence(context.header, state.sequence) ? 0.0f : state.frame;
+    memcpy(key.controller, state.controller, sizeof(key.controller));
+    memcpy(key.blending, state.blending, sizeof(key.blending));
+
+    const Matrix3x4 &transform = *reinterpret_cast<const Matrix3x4 *>(g_engineStudio.StudioGetRotationMatrix());
+
+    StudioBatch *batch = FindBatch(key);
+    bool owner = !batch;
+
+    if (owner)
+    {
+        Matrix3x4 inverse;
+        if (!InvertMatrix3x4(transform, inverse))
+        {
+            return false;
+        }
+
+        if (s_batchCount == static_cast<int>(s_batches.size()))
+        {
+            s_batches.emplace_back();
+        }
+
+        batch = &s_batches[s_batchCount++];
+        batch->key = key;
+        batch->context = context;
+        batch->submodels.clear();
+        batch->instances.clear();
+
+        // take the model's transform back out of the bones, each instance puts its own in
+        const Matrix3x4 *bones = reinterpret_cast<const Matrix3x4 *>(g_engineStudio.StudioGetBoneTransform());
+        for (int i = 0; i < context.header->numbones; i++)
+        {
+            batch->bones[i] = inverse * bones[i];
+        }
+    }
+
+    StudioInstance instance;
+    instance.transform = transform;
+    instance.renderColor = { context.lightcolor, context.blend };
+    instance.lightDir = { context.lightvec, 0 };
+    instance.ambientAndShadeLight = { context.ambientlight, context.shadelight, 0, 0 };
+    batch->instances.push_back(instance);
+
+    context.batch = batch;
+    context.batchOwner = owner;
+    return true;
+}
+
+static int SelectLod(StudioContext &context)
+{
+    if (gl3_studio_lod->value <= 0 || s_viewmodel)
+    {
+        return 0;
+    }
+
+    cl_entity_t *entity = context.entity;
+
+    Vector3 center, extents;
+    if (!studioEntityBounds(entity, center, extents))
+    {
+        return 0;
+    }
+
+    float radius = VectorLength(extents);
+    float distance = VectorLength(center - g_state.viewOrigin);
+    if (distance <= radius)
+    {
+        return 0;
+    }
+
+    float size = radius * g_state.projectionMatrix.m11 / (distance * gl3_studio_lod->value);
 
-    constexpr int bonelessSize = sizeof(constants) - sizeof(constants.bones);
-    int bonesSize = sizeof(Matrix3x4) * context.header->numbones;
-    int constantsSize = bonelessSize + bonesSize;
+    // temp entities share index 0, they don't get to keep a lod
+    int index = entity->index;
+    bool tracked = index > 0 && index < StudioMaxLodEntities;
+    int previous = tracked ? s_entityLods[index] : 0;
 
-    BufferSpan span = dynamicUniformData(&constants, constantsSize);
-    commandBindUniformBuffer(1, span.buffer, span.byteOffset, constantsSize);
+    int lod = 0;
+    while (lod + 1 < StudioMaxLods)
+    {
+        float bias = (lod + 1 > previous) ? (1.0f - StudioLodHysteresis) : (1.0f + StudioLodHysteresis);
+        if (size >= s_lodSizes[lod + 1] * bias)
+        {
+            break;
+        }
+
+        lod++;
+    }
+
+    if (tracked)
+    {
+        s_entityLods[index] = static_cast<uint8_t>(lod);
+    }
+
+    return lod;
 }
 
 void studioSetupRenderer(StudioContext &context, int rendermode)
 {
     context.rendermode = rendermode;
+    context.lod = SelectLod(context);
+
+    if (CanInstance(context, rendermode) && AddInstance(context))
+    {
+        // drawn in studioEndModels
+        return;
+    }
 
     // set the model to be rendered
     commandBindVertexBuffer(context.cache->vertexBuffer, g_studioVertexFormat);
     commandBindIndexBuffer(context.cache->indexBuffer);
 
-    // FIXME: bones uploaded twice for chromeshell
+    // lighting and colour, the bones go per submodel in studioDrawPoints
     StudioSetConstants(context);
 
     // set the rendermode here too
@@ -302,6 +600,12 @@ void studioSetupRenderer(StudioContext &context, int rendermode)
 
 void studioRestoreRenderer(StudioContext &context)
 {
+    if (context.batch)
+    {
+        // never set anything up
+        return;
+    }
+
     // restore blending and depth mask i guess
     if (context.rendermode != kRenderNormal)
     {
@@ -350,11 +654,12 @@ static int GetShaderFlags(StudioContext &context, int textureFlags)
 }
 
 // selects and uses the correct shader program, sets uniforms on the default block
-static void StudioUseProgram(StudioContext &context, int textureFlags)
+static void StudioUseProgram(StudioContext &context, int textureFlags, bool instanced)
 {
     StudioShaderOptions options{};
     options.alphaTest = (textureFlags & STUDIO_NF_MASKED) ? 1 : 0;
     options.hasElights = (context.elightCount > 0) ? 1 : 0;
+    options.instanced = instanced ? 1 : 0;
 
     StudioShader *shader = &shaderSelect(s_shaders, s_shaderOptions, options);
     if (shader != s_currentShader)
@@ -368,7 +673,8 @@ static void StudioUseProgram(StudioContext &context, int textureFlags)
     commandUniform1i(shader->u_flags, GetShaderFlags(context, textureFlags));
 }
 
-void studioDrawPoints(StudioContext &context)
+// instanceCount 0 is a regular draw
+static void StudioDrawMeshes(StudioContext &context, int instanceCount)
 {
     studiohdr_t *header = context.header;
     studiohdr_t *textureheader = studioTextureHeader(context.model, header);
@@ -387,11 +693,20 @@ void studioDrawPoints(StudioContext &context)
         skins = &skins[skin * textureheader->numskinref];
     }
 
+    // batches only take entities without forced flags, whatever the game set last doesn't apply
+    int forceFaceFlags = instanceCount ? 0 : g_engineStudio.GetForceFaceFlags();
+
     for (int i = 0; i < submodel->nummesh; i++)
     {
+        StudioMesh *mem_mesh = &mem_submodel->meshes[i];
+        if (!mem_mesh->indexCount[0])
+        {
+            // merged into an earlier mesh, or nothing to draw
+            continue;
+        }
+
         mstudiomesh_t *mesh = &meshes[i];
         mstudiotexture_t *texture = &textures[skins[mesh->skinref]];
-        StudioMesh *mem_mesh = &mem_submodel->meshes[i];
 
         bool additive = ((texture->flags & STUDIO_NF_ADDITIVE) && context.entity->curstate.rendermode == kRenderNormal);
         if (additive)
@@ -401,20 +716,32 @@ void studioDrawPoints(StudioContext &context)
             commandDepthMask(GL_FALSE);
         }
 
-        StudioUseProgram(context, texture->flags | g_engineStudio.GetForceFaceFlags());
+        StudioUseProgram(context, texture->flags | forceFaceFlags, instanceCount > 0);
 
         // FIXME: remaps won't work!!! we could have called StudioSetupSkin,
         // but now we have the command buffer system going on...
-        if ((g_engineStudio.GetForceFaceFlags() & STUDIO_NF_CHROME) == 0)
+        if ((forceFaceFlags & STUDIO_NF_CHROME) == 0)
         {
             commandBindTexture(0, GL_TEXTURE_2D, texture->index);
         }
 
-        commandDrawElementsBaseVertex(GL_TRIANGLES,
-            mem_mesh->indexCount,
-            GL_UNSIGNED_SHORT,
-            mem_mesh->indexOffset_notbytes * sizeof(GLushort),
-            mem_mesh->baseVertex);
+        if (instanceCount)
+        {
+            commandDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+                mem_mesh->indexCount[context.lod],
+                GL_UNSIGNED_SHORT,
+                mem_mesh->indexOffset_notbytes[context.lod] * sizeof(GLushort),
+                instanceCount,
+                mem_mesh->baseVertex);
+        }
+        else
+        {
+            commandDrawElementsBaseVertex(GL_TRIANGLES,
+                mem_mesh->indexCount[context.lod],
+                GL_UNSIGNED_SHORT,
+                mem_mesh->indexOffset_notbytes[context.lod] * sizeof(GLushort),
+                mem_mesh->baseVertex);
+        }
 
         if (additive)
         {
@@ -424,6 +751,86 @@ void studioDrawPoints(StudioContext &context)
     }
 }
 
+void studioDrawPoints(StudioContext &context)
+{
+    // blank bodygroups have no vertices and so no bones, a zero sized bind is an error
+    if (!context.rendererSubModel->boneCount)
+    {
+        return;
+    }
+
+    if (context.batch)
+    {
+        // the first entity decides what the batch draws
+        if (context.batchOwner)
+        {
+            context.batch->submodels.push_back({ context.submodel, context.rendererSubModel });
+        }
+
+        return;
+    }
+
+    // per submodel, the bone palettes differ
+    StudioSetBones(context);
+
+    StudioDrawMeshes(context, 0);
+}
+
+static void DrawBatch(StudioBatch &batch)
+{
+    StudioContext &context = batch.context;
+
+    commandBindVertexBuffer(context.cache->vertexBuffer, g_studioVertexFormat);
+    commandBindIndexBuffer(context.cache->indexBuffer);
+
+    // lighting comes from the instances, only the chrome origin and the position scale are used.
+    // these are the same for most batches so they go through dynamicUniformData to get shared
+    StudioConstants constants;
+    memset(static_cast<void *>(&constants), 0, sizeof(constants));
+    constants.chromeOriginAndShellScale = { g_state.viewOrigin, 0.0f };
+    constants.positionScale = { context.cache->positionScale, 0, 0, 0 };
+
+    BufferSpan span = dynamicUniformData(&constants, sizeof(constants));
+    commandBindUniformBuffer(1, span.buffer, span.byteOffset, sizeof(constants));
+
+    int total = static_cast<int>(batch.instances.size());
+
+    // the instances are shared by every submodel, upload them once
+    batch.instanceSpans.clear();
+
+    for (int first = 0; first < total; first += STUDIO_MAX_INSTANCES)
+    {
+        int count = Q_min(total - first, STUDIO_MAX_INSTANCES);
+        batch.instanceSpans.push_back(dynamicUniformData(&batch.instances[first], static_cast<int>(sizeof(StudioInstance)) * count));
+    }
+
+    for (const StudioBatchSubModel &submodel : batch.submodels)
+    {
+        // nothing gets added for blank bodygroups but make sure, see studioDrawPoints
+        if (!submodel.rendererSubModel->boneCount)
+        {
+            continue;
+        }
+
+        context.submodel = submodel.submodel;
+        context.rendererSubModel = submodel.rendererSubModel;
+
+        int bonesSize;
+        BufferSpan bonesSpan = UploadBones(batch.bones, submodel.rendererSubModel, bonesSize);
+        commandBindUniformBuffer(4, bonesSpan.buffer, bonesSpan.byteOffset, bonesSize);
+
+        for (int chunk = 0; chunk < static_cast<int>(batch.instanceSpans.size()); chunk++)
+        {
+            int count = Q_min(total - chunk * STUDIO_MAX_INSTANCES, STUDIO_MAX_INSTANCES);
+            int instancesSize = static_cast<int>(sizeof(StudioInstance)) * count;
+
+            const BufferSpan &instanceSpan = batch.instanceSpans[chunk];
+            commandBindUniformBuffer(3, instanceSpan.buffer, instanceSpan.byteOffset, instancesSize);
+            StudioDrawMeshes(context, count);
+        }
+    }
+}
+
 void studioBeginModels(bool viewmodel)
 {
     s_viewmodel = viewmodel;
@@ -432,6 +839,12 @@ void studioBeginModels(bool viewmodel)
 
 void studioEndModels()
 {
+    for (int i = 0; i < s_batchCount; i++)
+    {
+        DrawBatch(s_batches[i]);
+    }
+
+    s_batchCount = 0;
     s_currentShader = nullptr;
 }
 
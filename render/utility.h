@@ -103,6 +103,31 @@ inline uint32_t HashString(const char *string)
     return hash;
 }
 
+constexpr uint64_t HashSeed64 = 0xcbf29ce484222325;
+
+// fnv-1a over 64-bit words with a fold so the high bits reach the low ones,
+// for noticing changes in megabytes of data rather than for hash tables
+inline uint64_t HashBytes64(uint64_t hash, const void *data, size_t length)
+{
+    constexpr uint64_t Prime = 0x100000001b3;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (; length >= 8; bytes += 8, length -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * Prime;
+        hash ^= hash >> 32;
+    }
+
+    for (; length > 0; bytes++, length--)
+    {
+        hash = (hash ^ *bytes) * Prime;
+    }
+
+    return hash;
+}
+
 template<typename T>
 static T AlignUp(T address, int alignment)
 {
@@ -6,6 +6,12 @@ namespace Render
 
 constexpr int MaxVertexAttribs = 5;
 
+// half floats, the bits come from meshopt_quantizeHalf
+struct HalfVector2
+{
+    uint16_t x, y;
+};
+
 // try to infer the gl type
 constexpr GLenum GLType(const float *) { return GL_FLOAT; }
 constexpr GLenum GLType(const Vector2 *) { return GL_FLOAT; }
@@ -14,6 +20,10 @@ constexpr GLenum GLType(const Vector4 *) { return GL_FLOAT; }
 constexpr GLenum GLType(const int8_t (*)[4]) { return GL_BYTE; }
 constexpr GLenum GLType(const uint8_t (*)[4]) { return GL_UNSIGNED_BYTE; }
 constexpr GLenum GLType(const uint16_t (*)[2]) { return GL_UNSIGNED_SHORT; }
+constexpr GLenum GLType(const int16_t (*)[4]) { return GL_SHORT; }
+constexpr GLenum GLType(const int8_t (*)[3]) { return GL_BYTE; }
+constexpr GLenum GLType(const uint8_t *) { return GL_UNSIGNED_BYTE; }
+constexpr GLenum GLType(const HalfVector2 *) { return GL_HALF_FLOAT; }
 
 // try to infer the component count
 constexpr int ComponentCount(const float *) { return 1; }
@@ -23,6 +33,10 @@ constexpr int ComponentCount(const Vector4 *) { return 4; }
 constexpr int ComponentCount(const int8_t (*)[4]) { return 4; }
 constexpr int ComponentCount(const uint8_t (*)[4]) { return 4; }
 constexpr int ComponentCount(const uint16_t (*)[2]) { return 2; }
+constexpr int ComponentCount(const int16_t (*)[4]) { return 4; }
+constexpr int ComponentCount(const int8_t (*)[3]) { return 3; }
+constexpr int ComponentCount(const uint8_t *) { return 1; }
+constexpr int ComponentCount(const HalfVector2 *) { return 2; }
 
 struct VertexAttrib
 {
@@ -0,0 +1,310 @@
+#include "stdafx.h"
+#include "worldcache.h"
+#include "brush.h"
+
+namespace Render
+{
+
+constexpr uint32_t WorldCacheMagic = 0x57334c47; // GL3W
+
+// bump when the world build changes what it produces
+constexpr int WorldCacheVersion = 2;
+
+constexpr char WorldCacheDirectory[] = "gl3cache";
+
+// bsp30 header, only what the hash needs
+enum
+{
+    BspLumpTextures = 2,
+    BspLumpVertexes = 3,
+    BspLumpTexinfo = 6,
+    BspLumpFaces = 7,
+    BspLumpLighting = 8,
+    BspLumpEdges = 12,
+    BspLumpSurfedges = 13,
+    BspLumpCount = 15
+};
+
+struct BspLump
+{
+    int fileofs;
+    int filelen;
+};
+
+struct BspHeader
+{
+    int version;
+    BspLump lumps[BspLumpCount];
+};
+
+// the lumps internalBuildVertexBuffer and lightmapBuildAtlas end up reading,
+// so the entity lump can be edited without throwing the cache away
+static const int s_hashedLumps[] = {
+    BspLumpTextures,
+    BspLumpVertexes,
+    BspLumpTexinfo,
+    BspLumpFaces,
+    BspLumpLighting,
+    BspLumpEdges,
+    BspLumpSurfedges
+};
+
+struct WorldCacheHeader
+{
+    uint32_t magic;
+    int version;
+    uint64_t hash;
+
+    // layout checks, a cache from another build of the renderer is just a miss
+    int vertexSize;
+    int numsurfaces;
+    int numtextures;
+
+    int numverts;
+    int lightmapWidth; // 0 if packing failed
+    int lightmapHeight;
+};
+
+// what the build writes to gl3_fatsurface_t, surface firstvert is derived from it
+struct WorldCacheSurface
+{
+    int firstvert;
+    int lightmap_x;
+    int lightmap_y;
+};
+
+static cvar_t *gl3_world_cache;
+
+void worldCacheInit()
+{
+    gl3_world_cache = g_engfuncs.pfnRegisterVariable("gl3_world_cache", "1", 0);
+}
+
+void worldCacheOpen(WorldCacheFile &file, const model_t *engineModel)
+{
+    file.path[0] = '\0';
+    file.bsp = nullptr;
+    file.bspLength = 0;
+
+    if (!gl3_world_cache->value)
+    {
+        return;
+    }
+
+    // maps/de_dust2.bsp -> <gamedir>/gl3cache/de_dust2.gl3w
+    const char *name = strrchr(engineModel->name, '/');
+    name = name ? name + 1 : engineModel->name;
+
+    char baseName[64];
+    Q_strcpy_truncate(baseName, name);
+
+    char *extension = strrchr(baseName, '.');
+    if (extension)
+    {
+        *extension = '\0';
+    }
+
+    const char *gameDirectory = g_engfuncs.pfnGetGameDirectory();
+
+    char directory[192];
+    snprintf(directory, sizeof(directory), "%s/%s", gameDirectory, WorldCacheDirectory);
+
+    // fails if it already exists, which is fine
+    platformMakeDirectory(directory);
+
+    snprintf(file.path, sizeof(file.path), "%s/%s.gl3w", directory, baseName);
+
+    file.bsp = g_engfuncs.COM_LoadFile(const_cast<char *>(engineModel->name), 5, &file.bspLength);
+}
+
+void worldCacheFreeBsp(WorldCacheFile &file)
+{
+    if (file.bsp)
+    {
+        g_engfuncs.COM_FreeFile(file.bsp);
+        file.bsp = nullptr;
+    }
+}
+
+uint64_t worldCacheHash(const WorldCacheFile &file)
+{
+    if (!file.bsp || file.bspLength < static_cast<int>(sizeof(BspHeader)))
+    {
+        return 0;
+    }
+
+    const BspHeader *header = reinterpret_cast<const BspHeader *>(file.bsp);
+
+    uint64_t hash = HashBytes64(HashSeed64, &header->version, sizeof(header->version));
+
+    for (int lump : s_hashedLumps)
+    {
+        const BspLump &info = header->lumps[lump];
+        if (info.fileofs < 0 || info.filelen < 0 || info.fileofs > file.bspLength - info.filelen)
+        {
+            return 0;
+        }
+
+        hash = HashBytes64(hash, &info.filelen, sizeof(info.filelen));
+        hash = HashBytes64(hash, file.bsp + info.fileofs, info.filelen);
+    }
+
+    // 0 means no hash
+    return hash ? hash : 1;
+}
+
+static bool ReadArray(FILE *stream, void *data, size_t size, size_t count)
+{
+    return fread(data, size, count, stream) == count;
+}
+
+template<typename T>
+static bool ReadArray(FILE *stream, std::vector<T> &data)
+{
+    return data.empty() || ReadArray(stream, data.data(), sizeof(T), data.size());
+}
+
+bool worldCacheLoad(const WorldCacheFile &file, uint64_t hash, gl3_worldmodel_t *model, std::vector<gl3_brushvert_t> &vertices, std::vector<Color32> &atlas)
+{
+    if (!file.path[0] || !hash)
+    {
+        return false;
+    }
+
+    FILE *stream = fopen(file.path, "rb");
+    if (!stream)
+    {
+        return false;
+    }
+
+    WorldCacheHeader header;
+    bool valid = ReadArray(stream, &header, sizeof(header), 1)
+        && header.magic == WorldCacheMagic
+        && header.version == WorldCacheVersion
+        && header.hash == hash
+        && header.vertexSize == static_cast<int>(sizeof(gl3_brushvert_t))
+        && header.numsurfaces == model->numsurfaces
+        && header.numtextures == model->numtextures
+        && header.numverts >= 0
+        && header.lightmapWidth >= 0 && header.lightmapWidth <= 4096
+        && header.lightmapHeight >= 0 && header.lightmapHeight <= 4096;
+
+    // read everything before touching the model so a bad file changes nothing
+    std::vector<int> basevertex;
+    std::vector<WorldCacheSurface> surfaces;
+
+    if (valid)
+    {
+        basevertex.resize(header.numtextures);
+        surfaces.resize(header.numsurfaces);
+        vertices.resize(header.numverts);
+        atlas.resize(header.lightmapWidth * header.lightmapHeight);
+
+        valid = ReadArray(stream, basevertex)
+            && ReadArray(stream, surfaces)
+            && ReadArray(stream, vertices)
+            && ReadArray(stream, atlas);
+    }
+
+    fclose(stream);
+
+    for (int i = 0; valid && i < model->numsurfaces; i++)
+    {
+        const gl3_surface_t &surface = model->surfaces[i];
+        const gl3_fatsurface_t &fat = model->fatsurfaces[i];
+        int textureIndex = static_cast<int>(surface.texture - model->textures);
+        int firstvert = surfaces[i].firstvert - basevertex[textureIndex];
+
+        valid = firstvert >= 0 && firstvert + fat.numverts <= UINT16_MAX + 1 && surfaces[i].firstvert + fat.numverts <= header.numverts;
+    }
+
+    if (!valid)
+    {
+        vertices.clear();
+        atlas.clear();
+        return false;
+    }
+
+    for (int i = 0; i < model->numtextures; i++)
+    {
+        model->textures[i].basevertex = basevertex[i];
+    }
+
+    for (int i = 0; i < model->numsurfaces; i++)
+    {
+        gl3_surface_t &surface = model->surfaces[i];
+        gl3_fatsurface_t &fat = model->fatsurfaces[i];
+        int textureIndex = static_cast<int>(surface.texture - model->textures);
+
+        fat.firstvert = surfaces[i].firstvert;
+        fat.lightmap_x = surfaces[i].lightmap_x;
+        fat.lightmap_y = surfaces[i].lightmap_y;
+
+        surface.firstvert = fat.firstvert - basevertex[textureIndex];
+        surface.numverts = fat.numverts;
+    }
+
+    model->lightmap_width = header.lightmapWidth;
+    model->lightmap_height = header.lightmapHeight;
+    return true;
+}
+
+void worldCacheSave(const WorldCacheFile &file, uint64_t hash, const gl3_worldmodel_t *model, const std::vector<gl3_brushvert_t> &vertices, const std::vector<Color32> &atlas)
+{
+    if (!file.path[0] || !hash)
+    {
+        return;
+    }
+
+    WorldCacheHeader header;
+    header.magic = WorldCacheMagic;
+    header.version = WorldCacheVersion;
+    header.hash = hash;
+    header.vertexSize = sizeof(gl3_brushvert_t);
+    header.numsurfaces = model->numsurfaces;
+    header.numtextures = model->numtextures;
+    header.numverts = static_cast<int>(vertices.size());
+    header.lightmapWidth = atlas.empty() ? 0 : model->lightmap_width;
+    header.lightmapHeight = atlas.empty() ? 0 : model->lightmap_height;
+
+    std::vector<int> basevertex(model->numtextures);
+    for (int i = 0; i < model->numtextures; i++)
+    {
+        basevertex[i] = model->textures[i].basevertex;
+    }
+
+    std::vector<WorldCacheSurface> surfaces(model->numsurfaces);
+    for (int i = 0; i < model->numsurfaces; i++)
+    {
+        const gl3_fatsurface_t &fat = model->fatsurfaces[i];
+        surfaces[i] = { fat.firstvert, fat.lightmap_x, fat.lightmap_y };
+    }
+
+    // write to a temporary file first so a crash or a second client can't leave half a cache behind
+    char tempPath[sizeof(file.path) + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", file.path);
+
+    FILE *stream = fopen(tempPath, "wb");
+    if (!stream)
+    {
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, stream) == 1
+        && fwrite(basevertex.data(), sizeof(int), basevertex.size(), stream) == basevertex.size()
+        && fwrite(surfaces.data(), sizeof(WorldCacheSurface), surfaces.size(), stream) == surfaces.size()
+        && fwrite(vertices.data(), sizeof(gl3_brushvert_t), vertices.size(), stream) == vertices.size()
+        && fwrite(atlas.data(), sizeof(Color32), atlas.size(), stream) == atlas.size();
+
+    written = (fclose(stream) == 0) && written;
+
+    // rename doesn't replace on windows
+    remove(file.path);
+
+    if (!written || rename(tempPath, file.path))
+    {
+        remove(tempPath);
+    }
+}
+
+}
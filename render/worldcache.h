@@ -0,0 +1,44 @@
+#ifndef WORLDCACHE_H
+#define WORLDCACHE_H
+
+namespace Render
+{
+
+struct gl3_worldmodel_t;
+struct gl3_brushvert_t;
+
+// compiled world cache: the world vertex buffer, per-texture vertex ranges,
+// lightmap placements and atlas of a map get written to <gamedir>/gl3cache
+// after a build and read back on later loads instead of rebuilding them.
+// files are keyed by a hash of the bsp lumps the build reads
+
+struct WorldCacheFile
+{
+    char path[256]; // empty if the cache is disabled
+    byte *bsp; // engine allocated, free with worldCacheFreeBsp
+    int bspLength;
+};
+
+// registers gl3_world_cache
+void worldCacheInit();
+
+// main thread, loads the bsp for hashing and works out the cache file name
+void worldCacheOpen(WorldCacheFile &file, const model_t *engineModel);
+
+// main thread
+void worldCacheFreeBsp(WorldCacheFile &file);
+
+// the rest don't touch the engine or gl and can run on a worker
+
+// 0 if the bsp couldn't be loaded
+uint64_t worldCacheHash(const WorldCacheFile &file);
+
+// fills in the model's vertex ranges and lightmap placements, returns false
+// on a missing or stale cache without having touched the model
+bool worldCacheLoad(const WorldCacheFile &file, uint64_t hash, gl3_worldmodel_t *model, std::vector<gl3_brushvert_t> &vertices, std::vector<Color32> &atlas);
+
+void worldCacheSave(const WorldCacheFile &file, uint64_t hash, const gl3_worldmodel_t *model, const std::vector<gl3_brushvert_t> &vertices, const std::vector<Color32> &atlas);
+
+}
+
+#endif
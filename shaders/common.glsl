@@ -15,9 +15,6 @@ layout(std140) uniform FrameConstants
 
     vec4 clientTime; // FIXME: could pack with... something
 
-    vec4 lightPositions[MAX_SHADER_LIGHTS]; // w stores 1/radius
-    vec4 lightColors[MAX_SHADER_LIGHTS];
-
     // accessed with lightstyles[i].x
     vec4 lightstyles[MAX_LIGHTSTYLES];
 };
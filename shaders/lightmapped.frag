@@ -15,8 +15,33 @@ in float f_fogFactor;
 
 out vec4 fragColor;
 
-// made this the fuck up, completely wrong and based on nothing
 #if defined(HAS_DLIGHTS)
+// binned by lightClusterUpdate
+layout(std140) uniform LightConstants
+{
+    vec4 lightPositions[MAX_SHADER_LIGHTS]; // w stores 1/radius
+    vec4 lightColors[MAX_SHADER_LIGHTS];
+
+    vec4 clusterTileScale; // xy: gl_FragCoord to tile, zw: bias
+    vec4 clusterDepth; // xyz: view forward, w: -dot(forward, origin)
+    vec4 clusterSlice; // x: log2 depth scale, y: bias
+
+    // bit per light
+    uvec4 clusterMasks[LIGHT_CLUSTER_COUNT / 4];
+};
+
+uint ClusterMask()
+{
+    vec2 tile = gl_FragCoord.xy * clusterTileScale.xy + clusterTileScale.zw;
+    float depth = dot(fragPosition, clusterDepth.xyz) + clusterDepth.w;
+    float slice = log2(max(depth, 1.0)) * clusterSlice.x + clusterSlice.y;
+
+    ivec3 cluster = clamp(ivec3(floor(vec3(tile, slice))), ivec3(0), ivec3(LIGHT_CLUSTERS_X - 1, LIGHT_CLUSTERS_Y - 1, LIGHT_CLUSTERS_Z - 1));
+    int index = cluster.x + (cluster.y + cluster.z * LIGHT_CLUSTERS_Y) * LIGHT_CLUSTERS_X;
+    return clusterMasks[index / 4][index % 4];
+}
+
+// made this the fuck up, completely wrong and based on nothing
 vec3 AddLight(vec3 pos, float invRadius, vec3 color)
 {
     float dist = distance(pos, fragPosition);
@@ -63,11 +88,16 @@ void main()
 #endif
 
 #if defined(HAS_DLIGHTS)
-    for (int i = 0; i < MAX_SHADER_LIGHTS; i++)
+    // only the lights binned to this cluster
+    uint mask = ClusterMask();
+    for (int i = 0; mask != 0u; i++, mask >>= 1u)
     {
-        lightmap += AddLight(lightPositions[i].xyz,
-            lightPositions[i].w,
-            lightColors[i].rgb);
+        if ((mask & 1u) != 0u)
+        {
+            lightmap += AddLight(lightPositions[i].xyz,
+                lightPositions[i].w,
+                lightColors[i].rgb);
+        }
     }
 #endif
 
@@ -1,14 +1,16 @@
 #include "common.glsl"
 #include "brush_common.glsl"
 
-// note: lightmap width is stored in a_position.w (temp test)
-in vec4 a_position;
+in vec3 a_position;
 in vec2 a_texCoord;
 in vec2 a_lightmapTexCoord;
 in vec4 a_styles;
 
 uniform float u_scroll;
 
+// only for its size
+uniform sampler2D u_lightmap;
+
 out vec3 fragPosition;
 out vec4 texCoord;
 
@@ -22,14 +24,16 @@ void main()
     texCoord = vec4(a_texCoord, a_lightmapTexCoord);
     texCoord.x += u_scroll;
 
-    uvec4 styles = uvec4(a_styles);
+    // the top two bits of each style are a part of the lightmap width in luxels
+    vec4 widthBits = floor(a_styles / 64.0);
+    uvec4 styles = uvec4(a_styles - widthBits * 64.0);
     f_lightmapWeights.x = lightstyles[styles.x].x;
     f_lightmapWeights.y = lightstyles[styles.y].x;
     f_lightmapWeights.z = lightstyles[styles.z].x;
     f_lightmapWeights.w = lightstyles[styles.w].x;
-    f_lightmapWidth = a_position.w;
+    f_lightmapWidth = dot(widthBits, vec4(1.0, 4.0, 16.0, 64.0)) / float(textureSize(u_lightmap, 0).x);
 
-    vec3 position = vec4(a_position.xyz, 1.0) * modelMatrix;
+    vec3 position = vec4(a_position, 1.0) * modelMatrix;
     fragPosition = position;
 
     gl_Position = viewProjectionMatrix * vec4(position, 1.0);
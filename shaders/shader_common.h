@@ -1,7 +1,13 @@
 // this file is included by both c++ code and shaders
 
-// FIXME: bullshit way of doing dlights!!!
-#define MAX_SHADER_LIGHTS 4
+// every engine dlight fits, see lightcluster.cpp
+#define MAX_SHADER_LIGHTS 32
+
+// view space froxels the dlights get binned into, a bit per light in each
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 16
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
 
 // already defined, will cause a warning if the definition doesn't match
 #define MAX_LIGHTSTYLES 64
@@ -20,3 +26,6 @@
 
 // there's probably an engine constant for this...
 #define STUDIO_MAX_ELIGHTS 3
+
+// instances per instanced studio draw, 96 bytes each
+#define STUDIO_MAX_INSTANCES 64
@@ -1,7 +1,7 @@
 #include "common.glsl"
 #include "studio_common.glsl"
 
-in vec3 a_position;
+in vec3 a_position; // snorm, scaled by positionScale.x
 in vec3 a_normal;
 in vec2 a_texCoord;
 in float a_bone;
@@ -16,6 +16,21 @@ out vec4 f_color;
 // engine's v_lambert1, doesn't change
 const float k_lambert = 1.4953241;
 
+#if defined(INSTANCED)
+// a * b for 3x4 affine matrices stored as rows
+mat3x4 ConcatTransforms(mat3x4 a, mat3x4 b)
+{
+    mat3x4 result;
+
+    for (int i = 0; i < 3; i++)
+    {
+        result[i] = a[i].x * b[0] + a[i].y * b[1] + a[i].z * b[2] + vec4(0.0, 0.0, 0.0, a[i].w);
+    }
+
+    return result;
+}
+#endif
+
 // FIXME: try cleaning up if viewproj matrix gets split
 vec2 ChromeTexCoords(mat3x4 bone, vec3 normal)
 {
@@ -76,18 +91,18 @@ float ApplyBrightness(float value)
     return pow(value, float(1.0 / k_gamma));
 }
 
-vec4 ComputeColor(vec3 position, vec3 normal)
+vec4 ComputeColor(vec3 position, vec3 normal, vec4 color, vec3 lightDirection, vec2 light)
 {
     if ((u_flags & STUDIO_SHADER_COLOR_ONLY) != 0)
     {
         // color as-is, used for additive and glowshell
-        return renderColor;
+        return color;
     }
 
     if ((u_flags & STUDIO_SHADER_FULLBRIGHT) != 0)
     {
         // no lighting, alpha as-is
-        return vec4(1.0, 1.0, 1.0, renderColor.a);
+        return vec4(1.0, 1.0, 1.0, color.a);
     }
 
     float diffuse;
@@ -98,28 +113,41 @@ vec4 ComputeColor(vec3 position, vec3 normal)
     else
     {
         // assumes that k_lambert >= 1.0
-        float NdotL = dot(normal, lightDir.xyz);
+        float NdotL = dot(normal, lightDirection);
         diffuse = (1.0 - NdotL) * (1.0 / k_lambert);
         diffuse = min(diffuse, 1.0);
     }
 
-    diffuse = ambientLight + (shadeLight * diffuse);
+    diffuse = light.x + (light.y * diffuse);
     diffuse = min(ApplyBrightness(diffuse), 1.0);
 
-    vec3 color = renderColor.rgb * diffuse;
+    vec3 result = color.rgb * diffuse;
 
 #if defined(HAS_ELIGHTS)
-    color = ApplyElights(color, position, normal);
+    result = ApplyElights(result, position, normal);
 #endif
 
-    return vec4(color, renderColor.a);
+    return vec4(result, color.a);
 }
 
 void main()
 {
     mat3x4 bone = bones[int(a_bone)];
 
-    vec3 position = vec4(a_position, 1.0) * bone;
+#if defined(INSTANCED)
+    StudioInstance instance = instances[gl_InstanceID];
+    bone = ConcatTransforms(instance.transform, bone);
+
+    vec4 color = instance.renderColor;
+    vec3 lightDirection = instance.lightDir.xyz;
+    vec2 light = instance.ambientAndShadeLight.xy;
+#else
+    vec4 color = renderColor;
+    vec3 lightDirection = lightDir.xyz;
+    vec2 light = ambientAndShadeLight.xy;
+#endif
+
+    vec3 position = vec4(a_position * positionScale.x, 1.0) * bone;
     vec3 normal = normalize(a_normal * mat3(bone));
 
     // shell effect
@@ -128,7 +156,7 @@ void main()
     bool chrome = (u_flags & STUDIO_SHADER_CHROME) != 0;
     f_texCoord = chrome ? ChromeTexCoords(bone, normal) : a_texCoord;
 
-    f_color = ComputeColor(position, normal);
+    f_color = ComputeColor(position, normal, color, lightDirection, light);
 
     mat4 viewProj = u_viewmodel ? vmViewProjectionMatrix : viewProjectionMatrix;
 
@@ -5,13 +5,36 @@ layout(std140) uniform ModelConstants
     vec4 lightDir;
     vec4 ambientAndShadeLight; // x = ambientlight, y = shadelight
     vec4 chromeOriginAndShellScale; // chrome origin (xyz) and glowshell scale (w)
+    vec4 positionScale; // x = snorm position scale
 
     vec4 elightPositions[STUDIO_MAX_ELIGHTS];
     vec4 elightColors[STUDIO_MAX_ELIGHTS]; // 4th component stores radius^2
+};
 
+// the submodel's bone palette, in a block of its own so passes
+// over the same pose can share it
+layout(std140) uniform BoneConstants
+{
     mat3x4 bones[MAX_SHADER_BONES];
 };
 
+#if defined(INSTANCED)
+// static props drawn in one go, the bones are relative to the
+// model and each instance brings its own transform and lighting
+struct StudioInstance
+{
+    mat3x4 transform;
+    vec4 renderColor;
+    vec4 lightDir;
+    vec4 ambientAndShadeLight;
+};
+
+layout(std140) uniform InstanceConstants
+{
+    StudioInstance instances[STUDIO_MAX_INSTANCES];
+};
+#endif
+
 // awful packing
 #define ambientLight ambientAndShadeLight.x
 #define shadeLight ambientAndShadeLight.y
@@ -0,0 +1,392 @@
+// job_test - cpu-only checks for render/job.cpp, no gl or game needed
+//
+// runs everything once with the jobs inline on the main thread and once with workers
+#include "stdafx.h"
+#include "job.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+using namespace Render;
+
+static int s_failures;
+
+#define CHECK(exp) \
+    do \
+    { \
+        if (!(exp)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #exp); \
+            s_failures++; \
+        } \
+    } while (0)
+
+// GL3_ASSERT ends up here in debug builds
+[[noreturn]] void Render::platformError(const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+
+    printf("\n");
+    exit(1);
+}
+
+static void SleepMilliseconds(int milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+// the threads some jobs ran on
+struct ThreadSet
+{
+    std::mutex mutex;
+    std::vector<std::thread::id> ids;
+
+    void Add()
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        std::thread::id id = std::this_thread::get_id();
+        if (std::find(ids.begin(), ids.end(), id) == ids.end())
+        {
+            ids.push_back(id);
+        }
+    }
+};
+
+static void SumJob(void *context, int begin, int end)
+{
+    std::atomic<int> *sum = static_cast<std::atomic<int> *>(context);
+    *sum += begin + end;
+}
+
+static void TestCounters()
+{
+    JobCounter empty;
+    CHECK(jobDone(empty));
+
+    JobCounter counter;
+    std::atomic<int> sum{};
+
+    for (int i = 0; i < 100; i++)
+    {
+        jobAdd(&counter, SumJob, &sum, i, 1);
+    }
+
+    jobWait(counter);
+
+    // 0 + 1 + ... + 99 plus one per job
+    CHECK(jobDone(counter));
+    CHECK(counter.value.load() == 0);
+    CHECK(sum.load() == 4950 + 100);
+
+    // the counter can be waited on again after more jobs are added
+    jobAdd(&counter, SumJob, &sum, 1000, 0);
+    jobWait(counter);
+    CHECK(jobDone(counter));
+    CHECK(sum.load() == 4950 + 100 + 1000);
+}
+
+struct NestedContext
+{
+    JobCounter *counter;
+    std::atomic<int> leaves;
+};
+
+static void NestedLeafJob(void *context, int, int)
+{
+    static_cast<NestedContext *>(context)->leaves++;
+}
+
+// adds more jobs to the counter it's running under, the counter must not hit zero in between
+static void NestedJob(void *context, int begin, int end)
+{
+    NestedContext *nested = static_cast<NestedContext *>(context);
+
+    for (int i = begin; i < end; i++)
+    {
+        jobAdd(nested->counter, NestedLeafJob, nested);
+    }
+}
+
+static void TestNestedJobs()
+{
+    JobCounter counter;
+    NestedContext nested;
+    nested.counter = &counter;
+    nested.leaves = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        jobAdd(&counter, NestedJob, &nested, 0, 16);
+    }
+
+    jobWait(counter);
+    CHECK(nested.leaves.load() == 8 * 16);
+}
+
+struct ParallelForContext
+{
+    explicit ParallelForContext(int itemCount)
+        : hits(itemCount)
+        , count{ itemCount }
+    {
+    }
+
+    std::vector<std::atomic<int>> hits;
+    std::atomic<int> largestRange{};
+    std::atomic<int> badRanges{};
+    int count;
+};
+
+static void ParallelForJob(void *context, int begin, int end)
+{
+    ParallelForContext *test = static_cast<ParallelForContext *>(context);
+
+    if (begin < 0 || end > test->count || begin >= end)
+    {
+        test->badRanges++;
+        return;
+    }
+
+    int size = end - begin;
+    int largest = test->largestRange.load();
+    while (size > largest && !test->largestRange.compare_exchange_weak(largest, size))
+    {
+    }
+
+    for (int i = begin; i < end; i++)
+    {
+        test->hits[i]++;
+    }
+}
+
+static void TestParallelFor()
+{
+    const int counts[] = { 0, 1, 2, 7, 63, 64, 65, 1000 };
+    const int grains[] = { 1, 7, 64, 1000, 5000 };
+
+    for (int count : counts)
+    {
+        for (int grain : grains)
+        {
+            ParallelForContext test{ count };
+            jobParallelFor(count, grain, ParallelForJob, &test);
+
+            // without workers, or if it fits in one range, it all runs in a single call
+            int largestExpected = (jobWorkerCount() && count > grain) ? grain : count;
+
+            // every item exactly once, in ranges no bigger than the grain
+            int missed = 0;
+            for (int i = 0; i < count; i++)
+            {
+                missed += (test.hits[i].load() != 1);
+            }
+
+            CHECK(missed == 0);
+            CHECK(test.badRanges.load() == 0);
+            CHECK(test.largestRange.load() <= largestExpected);
+        }
+    }
+}
+
+static void RecordThreadJob(void *context, int, int)
+{
+    SleepMilliseconds(2);
+    static_cast<ThreadSet *>(context)->Add();
+}
+
+struct StealContext
+{
+    ThreadSet runners;
+};
+
+// queues its jobs on whichever worker runs it, the others have to steal them
+static void AddFromWorkerJob(void *context, int, int)
+{
+    StealContext *steal = static_cast<StealContext *>(context);
+
+    JobCounter counter;
+    for (int i = 0; i < 32; i++)
+    {
+        jobAdd(&counter, RecordThreadJob, &steal->runners);
+    }
+
+    jobWait(counter);
+}
+
+static void TestWorkStealing()
+{
+    if (!jobWorkerCount())
+    {
+        return;
+    }
+
+    // everything goes to the main thread's queue, only stealing gets it onto the workers
+    {
+        ThreadSet threads;
+        JobCounter counter;
+
+        for (int i = 0; i < 64; i++)
+        {
+            jobAdd(&counter, RecordThreadJob, &threads);
+        }
+
+        jobWait(counter);
+        CHECK(threads.ids.size() > 1);
+    }
+
+    // and the other way around, from a worker's queue to the rest
+    {
+        StealContext steal;
+        JobCounter counter;
+
+        jobAdd(&counter, AddFromWorkerJob, &steal);
+        jobWait(counter);
+
+        CHECK(steal.runners.ids.size() > 1);
+    }
+}
+
+struct MainThreadContext
+{
+    std::thread::id mainThread;
+    std::vector<int> order; // only touched on the main thread
+    int wrongThread;
+};
+
+struct MainThreadCallContext
+{
+    MainThreadContext *test;
+    int index;
+    int sleep;
+};
+
+static void MainThreadCall(void *context)
+{
+    MainThreadCallContext *call = static_cast<MainThreadCallContext *>(context);
+    MainThreadContext *test = call->test;
+
+    if (std::this_thread::get_id() != test->mainThread)
+    {
+        test->wrongThread++;
+        return;
+    }
+
+    test->order.push_back(call->index);
+    SleepMilliseconds(call->sleep);
+}
+
+struct QueueFromJobContext
+{
+    MainThreadCallContext calls[4];
+    JobCounter *counter;
+};
+
+static void QueueFromJob(void *context, int, int)
+{
+    QueueFromJobContext *queue = static_cast<QueueFromJobContext *>(context);
+
+    for (MainThreadCallContext &call : queue->calls)
+    {
+        jobQueueMainThread(MainThreadCall, &call, queue->counter);
+    }
+}
+
+static void TestMainThreadQueue()
+{
+    MainThreadContext test;
+    test.mainThread = std::this_thread::get_id();
+    test.wrongThread = 0;
+
+    // queued from a job, jobWait runs them on the main thread in order
+    {
+        JobCounter counter;
+        QueueFromJobContext queue;
+        queue.counter = &counter;
+
+        for (int i = 0; i < 4; i++)
+        {
+            queue.calls[i] = { &test, i, 0 };
+        }
+
+        jobAdd(&counter, QueueFromJob, &queue);
+        jobWait(counter);
+
+        CHECK(jobDone(counter));
+        CHECK(test.wrongThread == 0);
+        CHECK((test.order == std::vector<int>{ 0, 1, 2, 3 }));
+    }
+
+    // a time limit stops after the first call that goes over it, the rest stay queued
+    {
+        test.order.clear();
+
+        JobCounter counter;
+        MainThreadCallContext calls[4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            calls[i] = { &test, i, 10 };
+            jobQueueMainThread(MainThreadCall, &calls[i], &counter);
+        }
+
+        CHECK(!jobDone(counter));
+
+        int ran = jobRunMainThreadQueue(0.001);
+        CHECK(ran == 1);
+        CHECK(counter.value.load() == 3);
+
+        // no limit runs the rest
+        ran = jobRunMainThreadQueue();
+        CHECK(ran == 3);
+        CHECK(jobDone(counter));
+        CHECK((test.order == std::vector<int>{ 0, 1, 2, 3 }));
+
+        CHECK(jobRunMainThreadQueue() == 0);
+        CHECK(jobRunMainThreadQueue(0.001) == 0);
+    }
+
+    // without a counter
+    {
+        test.order.clear();
+
+        MainThreadCallContext call{ &test, 7, 0 };
+        jobQueueMainThread(MainThreadCall, &call);
+
+        CHECK(jobRunMainThreadQueue() == 1);
+        CHECK((test.order == std::vector<int>{ 7 }));
+    }
+}
+
+static void RunAll(int workerCount)
+{
+    jobInit(workerCount);
+    CHECK(jobWorkerCount() == workerCount);
+
+    TestCounters();
+    TestNestedJobs();
+    TestParallelFor();
+    TestWorkStealing();
+    TestMainThreadQueue();
+
+    jobShutdown();
+    CHECK(jobWorkerCount() == 0);
+}
+
+int main()
+{
+    RunAll(0);
+    RunAll(3);
+
+    if (s_failures)
+    {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}